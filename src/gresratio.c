@@ -0,0 +1,1178 @@
+// gresratio.c
+
+/*
+ * Config loading and ratio evaluation for libgresratio, see gresratio.h.
+ * Everything here runs either at config load, which may allocate and log
+ * freely, or in gr_evaluate(), which must not allocate.
+ */
+
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include "gresratio_internal.h"
+#include "gresratio_tres.h"
+
+#define MAX_CONFIG_SIZE (64 << 20)
+#define SWITCH "enable_gres_ratio_plugin"
+#define SECTION "gresratio"
+#define PARTITION_SECTION SECTION "."
+#define ENABLE_SECTION "Enable"
+#define MAX_RATIO_DEN 1000000000 // at most 9 decimals are kept exactly
+
+const char *gr_log_name = "job_submit_require_cpu_gpu_ratio";
+
+/* Generation handed to the next parsed config, 0 is never used. */
+static atomic_uint_fast64_t next_generation = 1;
+
+static void log_stderr(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+}
+
+gr_log_fn gr_info_fn = log_stderr;
+gr_log_fn gr_error_fn = log_stderr;
+gr_log_fn gr_debug_fn = NULL;
+
+void gr_set_log(gr_log_fn info_fn, gr_log_fn error_fn) {
+    gr_info_fn = info_fn;
+    gr_error_fn = error_fn;
+}
+
+void gr_set_debug(gr_log_fn debug_fn) {
+    gr_debug_fn = debug_fn;
+}
+
+/* Duplicates a config slice into *dst, replacing any previous value. */
+static int dup_slice(char **dst, gr_slice_t v) {
+    char *copy;
+    if (v.len == 0 || (copy = strndup(v.ptr, v.len)) == NULL)
+        return -1;
+    free(*dst);
+    *dst = copy;
+    return 0;
+}
+
+static uint64_t gcd(uint64_t a, uint64_t b) {
+    while (b) {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/*
+ * Parses a decimal into the fraction *num / *den, den a power of ten up to
+ * MAX_RATIO_DEN and num (the digits without the point) below 2^32. Returns
+ * the number of characters used, 0 if there is no number or it does not fit.
+ */
+static size_t parse_decimal(const char *p, const char *end, uint64_t *num,
+                            uint64_t *den) {
+    const char *start = p;
+    bool digits = false;
+
+    *num = 0;
+    *den = 1;
+    while (p < end && *p >= '0' && *p <= '9') {
+        *num = *num * 10 + (*p++ - '0');
+        digits = true;
+        if (*num > UINT32_MAX)
+            return 0;
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+            if (*den == MAX_RATIO_DEN)
+                return 0;
+            *num = *num * 10 + (*p - '0');
+            *den *= 10;
+            digits = true;
+            if (*num > UINT32_MAX)
+                return 0;
+        }
+    }
+    return digits ? (size_t) (p - start) : 0;
+}
+
+/*
+ * Parses a card ratio such as 2, 2.0, 3.33 or 10/3 into an exact positive
+ * rational in lowest terms. The whole slice must be used.
+ */
+static int slice_to_ratio(gr_slice_t v, gr_ratio_t *out) {
+    const char *p = v.ptr, *end = v.ptr + v.len;
+    uint64_t num, den, n2 = 1, d2 = 1;
+    size_t used = parse_decimal(p, end, &num, &den);
+
+    if (used == 0)
+        return -1;
+    p += used;
+    if (p < end && *p == '/') {
+        p++;
+        if ((used = parse_decimal(p, end, &d2, &n2)) == 0)
+            return -1;
+        p += used;
+    }
+    /* (num / den) / (d2 / n2) */
+    num *= n2;
+    den *= d2;
+    if (p != end || num == 0 || den == 0)
+        return -1;
+
+    uint64_t g = gcd(num, den);
+    num /= g;
+    den /= g;
+    if (num > UINT32_MAX || den > UINT32_MAX)
+        return -1;
+    out->num = num;
+    out->den = den;
+    return 0;
+}
+
+/*
+ * Parses a trace ring size such as 65536, 512K, 64M or 1G, rounded up to a
+ * power of two between GR_TRACE_MIN_SIZE and GR_TRACE_MAX_SIZE.
+ */
+static int slice_to_size(gr_slice_t v, uint64_t *out) {
+    uint64_t n = 0;
+    size_t i = 0;
+
+    for (; i < v.len && v.ptr[i] >= '0' && v.ptr[i] <= '9' && n < (1ull << 40);
+         i++)
+        n = n * 10 + (v.ptr[i] - '0');
+    if (i == 0)
+        return -1;
+    if (i + 1 == v.len && strchr("kKmMgG", v.ptr[i])) {
+        int c = v.ptr[i] | 0x20;
+        n <<= c == 'k' ? 10 : c == 'm' ? 20 : 30;
+    } else if (i != v.len) {
+        return -1;
+    }
+    if (n < GR_TRACE_MIN_SIZE || n > GR_TRACE_MAX_SIZE)
+        return -1;
+    *out = n & (n - 1) ? 1ull << (64 - __builtin_clzll(n)) : n;
+    return 0;
+}
+
+/* Reads the whole file into a NUL terminated malloc'd buffer. */
+char *gr_read_file(const char *filename, size_t *len) {
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        gr_error("cannot open %s: %m", filename);
+        return NULL;
+    }
+
+    struct stat st;
+    char *buffer = NULL;
+    if (fstat(fileno(file), &st) != 0 || st.st_size > MAX_CONFIG_SIZE) {
+        gr_error("cannot size %s", filename);
+    } else if ((buffer = malloc(st.st_size + 1)) == NULL) {
+        gr_error("cannot allocate config buffer");
+    } else {
+        *len = fread(buffer, 1, st.st_size, file);
+        buffer[*len] = '\0';
+    }
+    fclose(file);
+    return buffer;
+}
+
+/* FNV-1a over the name, ASCII lower cased when fold is set. */
+static uint32_t name_hash(const char *name, size_t len, bool fold) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = name[i];
+        if (fold && c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        h = (h ^ c) * 16777619u;
+    }
+    return h;
+}
+
+int gr_index_lookup(const struct name_index *idx, const char *name,
+                    size_t len) {
+    if (idx->slots == NULL)
+        return -1;
+    uint32_t h = name_hash(name, len, idx->fold);
+    for (uint32_t i = h & idx->mask;; i = (i + 1) & idx->mask) {
+        const struct name_slot *slot = &idx->slots[i];
+        if (slot->id == 0)
+            return -1;
+        /* Compare first: a shorter name ends before slot->name[len]. */
+        if (slot->hash == h &&
+            (idx->fold ? strncasecmp(slot->name, name, len) :
+                         strncmp(slot->name, name, len)) == 0 &&
+            slot->name[len] == '\0')
+            return slot->id - 1;
+    }
+}
+
+static void slot_insert(struct name_slot *slots, uint32_t mask, uint32_t h,
+                        const char *name, uint32_t id) {
+    uint32_t i = h & mask;
+    while (slots[i].id != 0)
+        i = (i + 1) & mask;
+    slots[i].hash = h;
+    slots[i].id = id;
+    slots[i].name = name;
+}
+
+/* Adds a name that is not in the map yet, growing it as needed. */
+int gr_index_insert(struct name_index *idx, const char *name, int id) {
+    if (idx->slots == NULL || (idx->count + 1) * 2 > idx->mask + 1) {
+        uint32_t size = idx->slots ? (idx->mask + 1) * 2 : 16;
+        struct name_slot *slots = calloc(size, sizeof(*slots));
+        if (slots == NULL)
+            return -1;
+        for (uint32_t i = 0; idx->slots && i <= idx->mask; i++) {
+            if (idx->slots[i].id)
+                slot_insert(slots, size - 1, idx->slots[i].hash,
+                            idx->slots[i].name, idx->slots[i].id);
+        }
+        free(idx->slots);
+        idx->slots = slots;
+        idx->mask = size - 1;
+    }
+    slot_insert(idx->slots, idx->mask,
+                name_hash(name, strlen(name), idx->fold), name, id + 1);
+    idx->count++;
+    return 0;
+}
+
+/* Returns the id of a card, interning its name on first use. */
+int gr_intern_card(struct gr_config *cfg, gr_slice_t name) {
+    if (name.len == 0)
+        return -1;
+
+    int id = gr_index_lookup(&cfg->card_index, name.ptr, name.len);
+    if (id >= 0)
+        return id;
+
+    if (cfg->num_entries == cfg->max_entries) {
+        int max = cfg->max_entries ? cfg->max_entries * 2 : 16;
+        struct card *entries = realloc(cfg->entries, max * sizeof(*entries));
+        if (entries == NULL)
+            return -1;
+        cfg->entries = entries;
+        cfg->max_entries = max;
+    }
+
+    struct card *entry = &cfg->entries[cfg->num_entries];
+    if ((entry->name = strndup(name.ptr, name.len)) == NULL)
+        return -1;
+    entry->ratio = (gr_ratio_t) { 0, 0 };
+    if (gr_index_insert(&cfg->card_index, entry->name, cfg->num_entries)) {
+        free(entry->name);
+        return -1;
+    }
+    return cfg->num_entries++;
+}
+
+/* Returns the policy of a partition, creating it on first use. */
+static struct partition_policy *get_policy(struct gr_config *cfg,
+                                           gr_slice_t name) {
+    if (name.len == 0)
+        return NULL;
+
+    int id = gr_index_lookup(&cfg->part_index, name.ptr, name.len);
+    if (id >= 0)
+        return &cfg->parts[id];
+
+    if (cfg->num_parts == cfg->max_parts) {
+        int max = cfg->max_parts ? cfg->max_parts * 2 : 8;
+        struct partition_policy *parts =
+            realloc(cfg->parts, max * sizeof(*parts));
+        if (parts == NULL)
+            return NULL;
+        cfg->parts = parts;
+        cfg->max_parts = max;
+    }
+
+    struct partition_policy *policy = &cfg->parts[cfg->num_parts];
+    memset(policy, 0, sizeof(*policy));
+    policy->default_id = -1;
+    policy->enforce_ratio = -1;
+    policy->untyped = -1;
+    if ((policy->name = strndup(name.ptr, name.len)) == NULL)
+        return NULL;
+    if (gr_index_insert(&cfg->part_index, policy->name, cfg->num_parts)) {
+        free(policy->name);
+        return NULL;
+    }
+    cfg->num_parts++;
+    return policy;
+}
+
+/* Records a card.* line of a partition section, applied by validate_config(). */
+static int add_override(struct partition_policy *policy, int id,
+                        gr_ratio_t ratio) {
+    struct card_override *overrides = realloc(policy->overrides,
+        (policy->num_overrides + 1) * sizeof(*overrides));
+    if (overrides == NULL)
+        return -1;
+    overrides[policy->num_overrides].id = id;
+    overrides[policy->num_overrides].ratio = ratio;
+    policy->overrides = overrides;
+    policy->num_overrides++;
+    return 0;
+}
+
+int gr_list_each(gr_slice_t list, gr_name_fn fn, void *arg) {
+    const char *p = list.ptr, *end = list.ptr + list.len;
+    if (p < end && *p == '[' && end[-1] == ']') {
+        p++;
+        end--;
+    }
+    while (p < end) {
+        const char *comma = memchr(p, ',', end - p);
+        const char *stop = comma ? comma : end;
+        gr_slice_t name = { p, stop - p };
+        while (name.len && strchr(" \t\"'", name.ptr[0])) {
+            name.ptr++;
+            name.len--;
+        }
+        while (name.len && strchr(" \t\"'", name.ptr[name.len - 1]))
+            name.len--;
+        if (fn(name, arg))
+            return -1;
+        p = comma ? comma + 1 : end;
+    }
+    return 0;
+}
+
+static int add_partition(gr_slice_t name, void *arg) {
+    return get_policy(arg, name) ? 0 : -1;
+}
+
+/* Applies one key = value line to cfg. */
+static int apply_setting(struct gr_config *cfg, const gr_kv_t *kv) {
+    bool in_ratio = gr_slice_eq(kv->section, SECTION);
+    gr_slice_t part = kv->section;
+    gr_slice_t name = kv->key;
+    struct partition_policy *policy = NULL;
+
+    if (gr_slice_eq(kv->key, SWITCH) &&
+        (in_ratio || kv->section.len == 0 ||
+         gr_slice_eq(kv->section, ENABLE_SECTION))) {
+        bool enabled;
+        if (gr_slice_to_bool(kv->value, &enabled))
+            return -1;
+        cfg->disabled = !enabled;
+        return 0;
+    }
+
+    if (!in_ratio) {
+        if (!gr_slice_consume(&part, PARTITION_SECTION))
+            return 0; // other sections are not ours
+        if ((policy = get_policy(cfg, part)) == NULL)
+            return -1;
+    }
+
+    if (gr_slice_eq(kv->key, "default_card"))
+        return dup_slice(policy ? &policy->default_card : &cfg->default_card,
+                         kv->value);
+
+    if (!policy && gr_slice_eq(kv->key, "partition"))
+        return gr_list_each(kv->value, add_partition, cfg);
+
+    if (gr_slice_eq(kv->key, "untyped_gpu")) {
+        static const char *const modes[] = {
+            [GR_UNTYPED_DEFAULT] = "default",
+            [GR_UNTYPED_STRICTEST] = "strictest",
+            [GR_UNTYPED_LENIENT] = "lenient",
+        };
+        for (int m = 0; m < 3; m++) {
+            if (gr_slice_caseeq(kv->value, modes[m])) {
+                *(policy ? &policy->untyped : &cfg->untyped) = m;
+                return 0;
+            }
+        }
+        return -1;
+    }
+
+    if (!policy && gr_slice_eq(kv->key, "node_inventory"))
+        return dup_slice(&cfg->node_inventory, kv->value);
+
+    if (!policy && gr_slice_eq(kv->key, "derive_ratios"))
+        return gr_slice_to_bool(kv->value, &cfg->derive_ratios);
+
+    if (!policy && gr_slice_eq(kv->key, "stats_segment")) {
+        if (kv->value.len < 2 || kv->value.len > 200 || kv->value.ptr[0] != '/' ||
+            memchr(kv->value.ptr + 1, '/', kv->value.len - 1))
+            return -1;
+        return dup_slice(&cfg->stats_segment, kv->value);
+    }
+
+    if (!policy && gr_slice_eq(kv->key, "trace_file"))
+        return dup_slice(&cfg->trace_file, kv->value);
+
+    if (!policy && gr_slice_eq(kv->key, "trace_size"))
+        return slice_to_size(kv->value, &cfg->trace_size);
+
+    if (!policy && gr_slice_eq(kv->key, "trace_salt")) {
+        cfg->trace_salt = 14695981039346656037ull;
+        for (size_t i = 0; i < kv->value.len; i++)
+            cfg->trace_salt = (cfg->trace_salt ^ (unsigned char) kv->value.ptr[i]) *
+                              1099511628211ull;
+        return 0;
+    }
+
+    if (!policy && gr_slice_eq(kv->key, "mode")) {
+        if (gr_slice_caseeq(kv->value, "enforce"))
+            cfg->mode = GR_MODE_ENFORCE;
+        else if (gr_slice_caseeq(kv->value, "adjust"))
+            cfg->mode = GR_MODE_ADJUST;
+        else
+            return -1;
+        return 0;
+    }
+
+    if (!policy && gr_slice_consume(&name, "exempt_")) {
+        static const char *const kinds[] = {
+            [GR_EXEMPT_USERS] = "users",
+            [GR_EXEMPT_ACCOUNTS] = "accounts",
+            [GR_EXEMPT_QOS] = "qos",
+            [GR_EXEMPT_RESERVATIONS] = "reservations",
+        };
+        for (int k = 0; k < 4; k++)
+            if (gr_slice_eq(name, kinds[k]))
+                return gr_exempt_add(&cfg->exempt, k, kv->value);
+        name = kv->key;
+    }
+
+    if (gr_slice_eq(kv->key, "enforce_ratio")) {
+        bool on;
+        if (gr_slice_to_bool(kv->value, &on))
+            return -1;
+        if (policy)
+            policy->enforce_ratio = on;
+        else
+            cfg->enforce_ratio = on;
+        return 0;
+    }
+
+    if (gr_slice_consume(&name, "card.")) {
+        gr_ratio_t ratio;
+        int id;
+        if (slice_to_ratio(kv->value, &ratio) ||
+            (id = gr_intern_card(cfg, name)) < 0)
+            return -1;
+        if (policy)
+            return add_override(policy, id, ratio);
+        cfg->entries[id].ratio = ratio;
+        return 0;
+    }
+
+    gr_info("ignoring unknown setting %.*s",
+         (int) kv->key.len, kv->key.ptr);
+    return 0;
+}
+
+
+/* Whether lines of section can matter to apply_setting(). */
+static bool our_section(gr_slice_t section) {
+    gr_slice_t part = section;
+    return section.len == 0 || gr_slice_eq(section, SECTION) ||
+           gr_slice_consume(&part, PARTITION_SECTION) ||
+           gr_slice_eq(section, ENABLE_SECTION);
+}
+
+/*
+ * Parses a config buffer into cfg. Returns 0 or -1. The file may be shared
+ * with other tools, so TOML the lexer does not handle (multi-line arrays,
+ * inline tables spanning lines) is skipped in sections that are not ours.
+ */
+static int parse_config(struct gr_config *cfg, const char *buf, size_t len,
+                        const char *name) {
+    gr_lexer_t lx;
+    gr_kv_t kv;
+    int rc;
+
+    gr_lexer_init(&lx, buf, len);
+    while ((rc = gr_lexer_next(&lx, &kv)) != 0) {
+        if (rc < 0) {
+            if (!our_section(lx.section))
+                continue;
+            gr_error("%s:%u: syntax error", name, lx.line);
+            return -1;
+        }
+        if (apply_setting(cfg, &kv)) {
+            gr_error("%s:%u: invalid value for %.*s", name, kv.line,
+                     (int) kv.key.len, kv.key.ptr);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void gr_config_free(gr_config_t *cfg) {
+    if (cfg == NULL)
+        return;
+    for (int i = 0; i < cfg->num_entries; i++)
+        free(cfg->entries[i].name);
+    for (int i = 0; i < cfg->num_parts; i++) {
+        free(cfg->parts[i].name);
+        free(cfg->parts[i].default_card);
+        free(cfg->parts[i].ratios);
+        free(cfg->parts[i].accept);
+        free(cfg->parts[i].weights);
+        free(cfg->parts[i].cards);
+        free(cfg->parts[i].derived);
+        free(cfg->parts[i].overrides);
+        free(cfg->parts[i].no_gres.text);
+        free(cfg->parts[i].bad_gres.text);
+        free(cfg->parts[i].mixed_gres.text);
+        for (int id = 0; cfg->parts[i].ratio_tails && id < cfg->num_entries;
+             id++)
+            free(cfg->parts[i].ratio_tails[id].text);
+        for (int id = 0; cfg->parts[i].hints && id < cfg->num_entries; id++)
+            free(cfg->parts[i].hints[id].text);
+        free(cfg->parts[i].ratio_tails);
+        free(cfg->parts[i].hints);
+        free(cfg->parts[i].nearest);
+    }
+    free(cfg->default_card);
+    free(cfg->node_inventory);
+    free(cfg->entries);
+    free(cfg->card_index.slots);
+    free(cfg->parts);
+    free(cfg->part_index.slots);
+    gr_exempt_free(&cfg->exempt);
+    free(cfg->stats_segment);
+    free(cfg->stats_parts);
+    free(cfg->stats_cards);
+    free(cfg->trace_file);
+    free(cfg);
+}
+
+/* Formats num / den like %f (six decimals, rounded) with integer math. */
+static size_t format_fixed(char *p, uint32_t num, uint32_t den) {
+    uint64_t micros = ((uint64_t) num * 1000000 + den / 2) / den;
+    char digits[24];
+    size_t n = 0;
+
+    for (int i = 0; i < 6; i++, micros /= 10)
+        digits[n++] = '0' + micros % 10;
+    digits[n++] = '.';
+    do {
+        digits[n++] = '0' + micros % 10;
+        micros /= 10;
+    } while (micros);
+
+    for (size_t i = 0; i < n; i++)
+        p[i] = digits[n - 1 - i];
+    return n;
+}
+
+static int set_text(struct msg_text *msg, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+
+static int set_text(struct msg_text *msg, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vasprintf(&msg->text, fmt, ap);
+    va_end(ap);
+    if (len < 0) {
+        msg->text = NULL;
+        return -1;
+    }
+    msg->len = len;
+    return 0;
+}
+
+/* Preformats the rejection messages of a policy, see gr_format_message(). */
+static int build_templates(struct gr_config *cfg,
+                           struct partition_policy *policy) {
+    if (set_text(&policy->no_gres,
+                 "Error: partition %s requires a GPU request.\n",
+                 policy->name) ||
+        set_text(&policy->bad_gres,
+                 "Error: invalid GPU request on partition %s.\n",
+                 policy->name) ||
+        set_text(&policy->mixed_gres,
+                 "Error: the job mixes GPU types, partition %s only accepts "
+                 "one type per job.\n", policy->name))
+        return -1;
+
+    policy->ratio_tails = calloc(cfg->num_entries ? cfg->num_entries : 1,
+                                 sizeof(*policy->ratio_tails));
+    policy->hints = calloc(cfg->num_entries ? cfg->num_entries : 1,
+                           sizeof(*policy->hints));
+    if (policy->ratio_tails == NULL || policy->hints == NULL)
+        return -1;
+    for (int id = 0; id < cfg->num_entries; id++) {
+        gr_ratio_t r = policy->ratios[id];
+        char num[24];
+
+        if (r.num == 0)
+            continue;
+        num[format_fixed(num, r.num, r.den)] = '\0';
+        if (set_text(&policy->ratio_tails[id],
+                     " is less than or more than required ratio %s.\n", num))
+            return -1;
+        /* A whole CPUs per GPU ratio has a flag for it. */
+        if (r.den == 1 ?
+            set_text(&policy->hints[id], "Try --cpus-per-gpu=%u (", r.num) :
+            set_text(&policy->hints[id], "Try "))
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * Precomputes the CPU count accepted with 1..GR_TABLE_GPUS GPUs of each
+ * card, so the common case is a single load and compare.
+ */
+static int build_accept_table(struct gr_config *cfg,
+                              struct partition_policy *policy) {
+    size_t n = (size_t) (cfg->num_entries ? cfg->num_entries : 1) *
+               GR_TABLE_GPUS;
+
+    if ((policy->accept = calloc(n, sizeof(*policy->accept))) == NULL)
+        return -1;
+    for (int id = 0; id < cfg->num_entries; id++) {
+        gr_ratio_t r = policy->ratios[id];
+
+        for (uint64_t gpus = 1; r.num && gpus <= GR_TABLE_GPUS; gpus++) {
+            uint64_t cpus = gpus * r.num;
+            if (cpus % r.den == 0 && cpus / r.den <= UINT32_MAX)
+                policy->accept[id * GR_TABLE_GPUS + gpus - 1] = cpus / r.den;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Accepted requests of a card come in steps of den GPUs and num CPUs. For
+ * each CPU count up to GR_TABLE_CPUS this keeps the step count closest to
+ * it, so a rejection can suggest the nearest request without searching.
+ */
+static uint16_t nearest_gpus(gr_ratio_t r, uint64_t ncpu) {
+    uint64_t k = ncpu / r.num;
+    if (k == 0 || (ncpu - k * r.num) * 2 > r.num)
+        k++;
+    return k * r.den > UINT16_MAX ? 0 : k * r.den;
+}
+
+static int build_nearest_table(struct gr_config *cfg,
+                               struct partition_policy *policy) {
+    size_t n = (size_t) (cfg->num_entries ? cfg->num_entries : 1) *
+               GR_TABLE_CPUS;
+
+    if ((policy->nearest = calloc(n, sizeof(*policy->nearest))) == NULL)
+        return -1;
+    for (int id = 0; id < cfg->num_entries; id++) {
+        gr_ratio_t r = policy->ratios[id];
+        for (uint64_t ncpu = 1; r.num && ncpu <= GR_TABLE_CPUS; ncpu++)
+            policy->nearest[id * GR_TABLE_CPUS + ncpu - 1] =
+                nearest_gpus(r, ncpu);
+    }
+    return 0;
+}
+
+/*
+ * Scales every card ratio of a policy to the common denominator scale, so a
+ * mixed request is checked as ncpu * scale == sum(count * weight) with no
+ * per entry division.
+ */
+static int build_weights(struct gr_config *cfg,
+                         struct partition_policy *policy) {
+    policy->scale = 1;
+    for (int id = 0; id < cfg->num_entries; id++) {
+        gr_ratio_t r = policy->ratios[id];
+        if (r.num == 0)
+            continue;
+        policy->scale = policy->scale / gcd(policy->scale, r.den) * r.den;
+        if (policy->scale > UINT32_MAX) {
+            gr_error("card ratio denominators on partition %s are too large "
+                     "to combine, use fewer decimals", policy->name);
+            return -1;
+        }
+    }
+
+    size_t n = cfg->num_entries > 0 ? (size_t) cfg->num_entries : 1;
+    if ((policy->weights = calloc(n, sizeof(*policy->weights))) == NULL)
+        return -1;
+    for (int id = 0; id < cfg->num_entries; id++) {
+        gr_ratio_t r = policy->ratios[id];
+        if (r.num)
+            policy->weights[id] = r.num * (policy->scale / r.den);
+    }
+    return 0;
+}
+
+/* Returns <0, 0 or >0 as a needs fewer, as many or more CPUs per GPU than b. */
+static int ratio_cmp(gr_ratio_t a, gr_ratio_t b) {
+    uint64_t l = (uint64_t) a.num * b.den, r = (uint64_t) b.num * a.den;
+    return (l > r) - (l < r);
+}
+
+/*
+ * Picks the card gpu:N requests are checked against: with untyped_gpu set
+ * and an inventory, one scan of the partition's card bitset for the
+ * strictest or most lenient ratio, default_card otherwise.
+ */
+static void pick_untyped_card(struct gr_config *cfg,
+                              struct partition_policy *policy) {
+    policy->untyped_id = policy->default_id;
+    if (policy->untyped == GR_UNTYPED_DEFAULT || policy->cards == NULL)
+        return;
+
+    int best = -1;
+    for (int w = 0; w * 64 < cfg->num_entries; w++) {
+        for (uint64_t bits = policy->cards[w]; bits; bits &= bits - 1) {
+            int id = w * 64 + __builtin_ctzll(bits);
+            int cmp;
+            if (policy->ratios[id].num == 0)
+                continue;
+            if (best >= 0) {
+                cmp = ratio_cmp(policy->ratios[id], policy->ratios[best]);
+                if (policy->untyped == GR_UNTYPED_STRICTEST ? cmp <= 0 : cmp >= 0)
+                    continue;
+            }
+            best = id;
+        }
+    }
+    if (best >= 0)
+        policy->untyped_id = best;
+    else
+        gr_info("no card with a ratio found on the nodes of partition %s, "
+                "gpu:N requests use default_card", policy->name);
+}
+
+/*
+ * Builds the per partition ratio tables and rejects configs that would make
+ * every GPU job on a partition fail.
+ */
+static int validate_config(struct gr_config *cfg) {
+    /* Old configs without any partition enforced es1. */
+    if (cfg->num_parts == 0 &&
+        get_policy(cfg, (gr_slice_t) { "es1", 3 }) == NULL)
+        return -1;
+    if (cfg->default_card == NULL &&
+        (cfg->default_card = strdup("V100")) == NULL)
+        return -1;
+    if (cfg->derive_ratios && cfg->node_inventory == NULL) {
+        gr_error("derive_ratios needs a node_inventory");
+        return -1;
+    }
+    if (cfg->node_inventory && gr_inventory_load(cfg, cfg->node_inventory))
+        return -1;
+
+    for (int i = 0; i < cfg->num_parts; i++) {
+        struct partition_policy *policy = &cfg->parts[i];
+        const char *def = policy->default_card ? policy->default_card :
+                                                 cfg->default_card;
+
+        policy->ratios = calloc(cfg->num_entries ? cfg->num_entries : 1,
+                                sizeof(gr_ratio_t));
+        if (policy->ratios == NULL)
+            return -1;
+        /* card.* under [gresratio] wins over what the nodes have. */
+        for (int id = 0; id < cfg->num_entries; id++)
+            policy->ratios[id] = cfg->entries[id].ratio.num ||
+                                 policy->derived == NULL ?
+                cfg->entries[id].ratio : policy->derived[id];
+        free(policy->derived);
+        policy->derived = NULL;
+        for (int j = 0; j < policy->num_overrides; j++)
+            policy->ratios[policy->overrides[j].id] =
+                policy->overrides[j].ratio;
+        free(policy->overrides);
+        policy->overrides = NULL;
+        policy->num_overrides = 0;
+
+        policy->default_id = gr_index_lookup(&cfg->card_index, def,
+                                             strlen(def));
+        if (!cfg->disabled && (policy->default_id < 0 ||
+                               policy->ratios[policy->default_id].num == 0)) {
+            gr_error("default_card %s has no card ratio on partition %s",
+                     def, policy->name);
+            return -1;
+        }
+        if (policy->enforce_ratio < 0)
+            policy->enforce_ratio = cfg->enforce_ratio;
+        if (policy->untyped < 0)
+            policy->untyped = cfg->untyped;
+        if (build_templates(cfg, policy) || build_accept_table(cfg, policy) ||
+            build_nearest_table(cfg, policy) ||
+            build_weights(cfg, policy))
+            return -1;
+    }
+
+    for (int i = 0; i < cfg->num_parts; i++)
+        pick_untyped_card(cfg, &cfg->parts[i]);
+    return 0;
+}
+
+gr_config_t *gr_config_parse(const char *buf, size_t len, const char *name) {
+    struct gr_config *cfg = calloc(1, sizeof(*cfg));
+    if (cfg == NULL) {
+        gr_error("cannot allocate config");
+        return NULL;
+    }
+
+    cfg->card_index.fold = true;
+    cfg->enforce_ratio = true;
+    cfg->trace_size = GR_TRACE_DEFAULT_SIZE;
+    if (parse_config(cfg, buf, len, name) || validate_config(cfg)) {
+        gr_config_free(cfg);
+        return NULL;
+    }
+    cfg->generation = atomic_fetch_add(&next_generation, 1);
+    return cfg;
+}
+
+gr_config_t *gr_config_load(const char *filename) {
+    size_t len = 0;
+    char *buffer = gr_read_file(filename, &len);
+    if (buffer == NULL)
+        return NULL;
+
+    gr_config_t *cfg = gr_config_parse(buffer, len, filename);
+    free(buffer);
+    return cfg;
+}
+
+bool gr_config_enabled(const gr_config_t *cfg) {
+    return cfg != NULL && !cfg->disabled;
+}
+
+gr_mode_t gr_config_mode(const gr_config_t *cfg) {
+    return cfg ? cfg->mode : GR_MODE_ENFORCE;
+}
+
+uint64_t gr_config_generation(const gr_config_t *cfg) {
+    return cfg == NULL ? 0 : cfg->generation;
+}
+
+int gr_config_num_cards(const gr_config_t *cfg) {
+    return cfg->num_entries;
+}
+
+int gr_config_num_partitions(const gr_config_t *cfg) {
+    return cfg->num_parts;
+}
+
+const char *gr_card_name(const gr_config_t *cfg, int card_id) {
+    if (card_id < 0 || card_id >= cfg->num_entries)
+        return NULL;
+    return cfg->entries[card_id].name;
+}
+
+const char *gr_partition_name(const gr_config_t *cfg, int policy_id) {
+    if (policy_id < 0 || policy_id >= cfg->num_parts)
+        return NULL;
+    return cfg->parts[policy_id].name;
+}
+
+/* Reduces n / d to a ratio that fits gr_ratio_t, approximating if needed. */
+static gr_ratio_t reduce_ratio(unsigned __int128 n, unsigned __int128 d) {
+    unsigned __int128 a = n, b = d;
+    while (b) {
+        unsigned __int128 t = a % b;
+        a = b;
+        b = t;
+    }
+    n /= a;
+    d /= a;
+    while (n > UINT32_MAX || d > UINT32_MAX) {
+        n = (n + 1) / 2;
+        d = (d + 1) / 2;
+    }
+    return (gr_ratio_t) { n, d };
+}
+
+/*
+ * Checks a job against the policy of one enforced partition. The GPU
+ * entries of the TRES string are resolved to card ids and their CPU
+ * requirement summed as they are tokenized; other resources are ignored.
+ */
+static gr_decision_t check_partition(const struct gr_config *cfg,
+                                     const struct partition_policy *policy,
+                                     const char *gres, uint32_t ncpu,
+                                     gr_result_t *res) {
+    res->partition = policy->name;
+    res->policy_id = policy - cfg->parts;
+    res->card_id = -1;
+    res->mixed = false;
+
+    /* Require GRES on a GRES partition. */
+    if (gres == NULL) {
+        gr_debug("missed GRES on partition %s", policy->name);
+        return GR_REJECT_NO_GRES;
+    }
+
+    gr_tres_iter_t it;
+    gr_tres_t tres;
+    uint64_t gpus = 0, known = 0;
+    unsigned __int128 need = 0; // required CPUs * policy->scale
+    int rc;
+
+    gr_tres_init(&it, gres);
+    while ((rc = gr_tres_next(&it, &tres)) > 0) {
+        if (!gr_slice_eq(tres.name, "gpu"))
+            continue;
+        if ((gpus += tres.count) > INT32_MAX)
+            break;
+
+        int index;
+        if (tres.type.len) {
+            index = gr_index_lookup(&cfg->card_index, tres.type.ptr,
+                                    tres.type.len);
+        } else {
+            // No card name, use default
+            gr_debug("User did not specify gpu, assuming default gpu");
+            res->default_card = true;
+            index = policy->untyped_id;
+        }
+
+        if (index == -1 || policy->ratios[index].num == 0) {
+            // Card not found in entries
+            gr_debug("config does not contain values for card %.*s on partition %s",
+                     (int) tres.type.len, tres.type.ptr, policy->name);
+            continue;
+        }
+        if (res->card_id < 0)
+            res->card_id = index;
+        else if (index != res->card_id)
+            res->mixed = true;
+        known += tres.count;
+        need += (unsigned __int128) tres.count * policy->weights[index];
+    }
+
+    if (rc < 0 || gpus == 0 || gpus > INT32_MAX) {
+        gr_debug("missed GRES of %s", gres);
+        res->mixed = false;
+        return GR_REJECT_BAD_GRES;
+    }
+    if (res->card_id < 0)
+        return GR_ACCEPT; // no card with a ratio here
+    res->gpus = known;
+
+    if (res->mixed) {
+        if (!policy->enforce_ratio) {
+            gr_debug("mixed GPU types in %s on partition %s", gres,
+                     policy->name);
+            return GR_REJECT_BAD_GRES;
+        }
+        res->ratio = reduce_ratio(need, (unsigned __int128) known *
+                                        policy->scale);
+        return (unsigned __int128) ncpu * policy->scale == need ?
+            GR_ACCEPT : GR_REJECT_RATIO;
+    }
+
+    // ncpu / gpus == num / den, exactly
+    int index = res->card_id;
+    bool match;
+    res->ratio = policy->ratios[index];
+    if (known <= GR_TABLE_GPUS)
+        match = ncpu != 0 &&
+            ncpu == policy->accept[index * GR_TABLE_GPUS + known - 1];
+    else
+        match = (uint64_t) ncpu * res->ratio.den == known * res->ratio.num;
+    return match ? GR_ACCEPT : GR_REJECT_RATIO;
+}
+
+/*
+ * part may name several partitions ("es1,es2"), each one with a policy is
+ * checked. Partitions without a policy cost one hash probe and never look
+ * at the GRES.
+ */
+gr_decision_t gr_evaluate(const gr_config_t *cfg, const char *part,
+                          const char *tres, uint32_t ncpu, gr_result_t *res) {
+    gr_result_t local;
+    if (res == NULL)
+        res = &local;
+    memset(res, 0, sizeof(*res));
+    res->card_id = -1;
+    res->policy_id = -1;
+    res->cpus = ncpu;
+
+    if (cfg == NULL || cfg->disabled == 1)
+        return res->decision = GR_ACCEPT;
+
+    if (part == NULL) {
+        gr_debug("missed partition info");
+        return res->decision = GR_ACCEPT;
+    }
+
+    for (;;) {
+        const char *comma = strchr(part, ',');
+        size_t len = comma ? (size_t) (comma - part) : strlen(part);
+        int id = gr_index_lookup(&cfg->part_index, part, len);
+
+        if (id >= 0) {
+            res->decision = check_partition(cfg, &cfg->parts[id], tres, ncpu,
+                                            res);
+            if (res->decision != GR_ACCEPT)
+                return res->decision;
+        }
+        if (comma == NULL)
+            break;
+        part = comma + 1;
+    }
+    return res->decision = GR_ACCEPT;
+}
+
+/* CPUs the policy of a ratio rejection accepts with the same GPUs, or 0. */
+static uint32_t accepted_cpus(const struct gr_config *cfg,
+                              const gr_result_t *res) {
+    const struct partition_policy *policy = &cfg->parts[res->policy_id];
+
+    if (!res->mixed && res->gpus <= GR_TABLE_GPUS)
+        return policy->accept[res->card_id * GR_TABLE_GPUS + res->gpus - 1];
+    uint64_t cpus = (uint64_t) res->gpus * res->ratio.num;
+    if (cpus % res->ratio.den || cpus / res->ratio.den > UINT32_MAX)
+        return 0;
+    return cpus / res->ratio.den;
+}
+
+/*
+ * Each pass fixes the CPU count for the partition that rejected it. A job
+ * on several partitions settles within one pass per partition, or the
+ * partitions disagree.
+ */
+uint32_t gr_adjust_cpus(const gr_config_t *cfg, const char *part,
+                        const char *tres, uint32_t ncpu, gr_result_t *res) {
+    gr_result_t local;
+    uint32_t cpus = ncpu;
+    if (res == NULL)
+        res = &local;
+
+    for (int pass = 0; cfg && pass <= cfg->num_parts; pass++) {
+        gr_decision_t v = gr_evaluate(cfg, part, tres, cpus, res);
+        if (v == GR_ACCEPT)
+            return pass > 0 ? cpus : 0;
+        if (v != GR_REJECT_RATIO || (cpus = accepted_cpus(cfg, res)) == 0)
+            break;
+    }
+    gr_evaluate(cfg, part, tres, ncpu, res);
+    return 0;
+}
+
+/* Bounded appender for gr_format_message(), counts what did not fit. */
+struct out {
+    char *buf;
+    size_t size;
+    size_t len;
+};
+
+static void put(struct out *o, const char *s, size_t n) {
+    if (o->len + 1 < o->size) {
+        size_t room = o->size - o->len - 1;
+        memcpy(o->buf + o->len, s, n < room ? n : room);
+    }
+    o->len += n;
+}
+
+/* Puts "1 GPU", "8 CPUs" and the like. */
+static void put_count(struct out *o, uint64_t n, const char *unit) {
+    char digits[24];
+    size_t len = 0;
+
+    do {
+        digits[sizeof(digits) - ++len] = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    put(o, digits + sizeof(digits) - len, len);
+    put(o, " ", 1);
+    put(o, unit, 3);
+    if (len > 1 || digits[sizeof(digits) - 1] != '1')
+        put(o, "s", 1);
+}
+
+/*
+ * Suggestion line of a single card rejection: the CPUs for the requested
+ * GPUs, and the accepted request closest to the requested CPUs, both read
+ * from the tables built at load for the common sizes.
+ */
+static void put_hint(struct out *o, const struct partition_policy *policy,
+                     const gr_result_t *res) {
+    gr_ratio_t r = policy->ratios[res->card_id];
+    uint64_t cpus = 0, near;
+
+    if (res->gpus <= GR_TABLE_GPUS)
+        cpus = policy->accept[res->card_id * GR_TABLE_GPUS + res->gpus - 1];
+    else if ((uint64_t) res->gpus * r.num % r.den == 0)
+        cpus = (uint64_t) res->gpus * r.num / r.den;
+    if (res->cpus >= 1 && res->cpus <= GR_TABLE_CPUS)
+        near = policy->nearest[res->card_id * GR_TABLE_CPUS + res->cpus - 1];
+    else
+        near = nearest_gpus(r, res->cpus);
+    if (near == res->gpus || near * r.num / r.den > UINT32_MAX)
+        near = 0;
+    if (cpus == 0 && near == 0)
+        return;
+
+    put(o, policy->hints[res->card_id].text,
+        cpus ? policy->hints[res->card_id].len : 4); // "Try "
+    if (cpus) {
+        put_count(o, cpus, "CPU");
+        put(o, " with ", 6);
+        put_count(o, res->gpus, "GPU");
+        if (r.den == 1)
+            put(o, ")", 1);
+    }
+    if (near) {
+        put(o, cpus ? " or " : "", cpus ? 4 : 0);
+        put_count(o, near, "GPU");
+        put(o, " with ", 6);
+        put_count(o, near * r.num / r.den, "CPU");
+    }
+    put(o, ".\n", 2);
+}
+
+int gr_format_message(const gr_config_t *cfg, const gr_result_t *res,
+                      char *buf, size_t size) {
+    static const char default_prefix[] =
+        "No GPU Specified, please specifiy which gpu when submitting jobs. (ex, V100) \n";
+    static const char ratio_head[] = " Error: GPU/CPU ratio ";
+    static const char mixed_tail[] =
+        " is less than or more than the weighted ratio of the requested cards ";
+    struct out o = { buf, size, 0 };
+
+    if (res->decision != GR_ACCEPT && res->policy_id >= 0) {
+        const struct partition_policy *policy = &cfg->parts[res->policy_id];
+        const struct msg_text *tail;
+        char num[24];
+
+        switch (res->decision) {
+        case GR_ACCEPT:
+            break;
+        case GR_REJECT_NO_GRES:
+            put(&o, policy->no_gres.text, policy->no_gres.len);
+            break;
+        case GR_REJECT_BAD_GRES:
+            tail = res->mixed ? &policy->mixed_gres : &policy->bad_gres;
+            put(&o, tail->text, tail->len);
+            break;
+        case GR_REJECT_RATIO:
+            if (res->default_card)
+                put(&o, default_prefix, sizeof(default_prefix) - 1);
+            else
+                put(&o, " ", 1);
+            put(&o, ratio_head, sizeof(ratio_head) - 1);
+            put(&o, num, format_fixed(num, res->cpus, res->gpus));
+            if (res->mixed) {
+                put(&o, mixed_tail, sizeof(mixed_tail) - 1);
+                put(&o, num, format_fixed(num, res->ratio.num,
+                                          res->ratio.den));
+                put(&o, ".\n", 2);
+                break;
+            }
+            tail = &policy->ratio_tails[res->card_id];
+            put(&o, tail->text, tail->len);
+            put_hint(&o, policy, res);
+            break;
+        }
+    }
+    if (size)
+        buf[o.len < size ? o.len : size - 1] = '\0';
+    return o.len;
+}
@@ -0,0 +1,265 @@
+// gresratio.h
+
+/*
+ * libgresratio: the CPU/GPU ratio policy shared by the job_submit plugin,
+ * the tests and the benchmarks. It has no Slurm dependency; the plugin maps
+ * its decisions to Slurm error codes and hooks its logging up to slurmctld.
+ *
+ * A config is loaded into an immutable snapshot which can then be evaluated
+ * from any number of threads. gr_live_* keeps a snapshot current with
+ * changes to the config file without ever blocking evaluators.
+ */
+
+#ifndef GRESRATIO_H
+#define GRESRATIO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct gr_config gr_config_t;
+
+/* What the plugin does with a job whose CPU count is off the ratio. */
+typedef enum {
+    GR_MODE_ENFORCE, // reject it
+    GR_MODE_ADJUST,  // change its CPU count to the accepted one
+} gr_mode_t;
+
+/* Outcome of evaluating one job. */
+typedef enum {
+    GR_ACCEPT = 0,      // ratio matches or no policy applies to the job
+    GR_REJECT_NO_GRES,  // enforced partition but no GRES requested
+    GR_REJECT_BAD_GRES, // GRES that is not a GPU request, or mixes cards
+                        // where enforce_ratio is off (mixed is set)
+    GR_REJECT_RATIO,    // CPU count does not match the card ratio
+} gr_decision_t;
+
+/* Exact CPUs per GPU ratio, num / den in lowest terms, num 0 for none. */
+typedef struct {
+    uint32_t num;
+    uint32_t den;
+} gr_ratio_t;
+
+/* Details of a decision, enough to explain a rejection to the user. */
+typedef struct {
+    gr_decision_t decision;
+    const char *partition; // policy that decided, NULL if none applied
+    int policy_id;         // index of that policy, -1 if none applied
+    int card_id;           // -1 if no card was resolved
+    bool default_card;     // the request did not name a card type
+    bool mixed;            // several cards, card_id is the first one
+    uint32_t gpus;         // GPUs of cards with a ratio on the partition
+    uint32_t cpus;
+    gr_ratio_t ratio;      // required CPUs per GPU, weighted if mixed
+} gr_result_t;
+
+/* printf style logger, Slurm's info() and error() fit. */
+typedef void (*gr_log_fn)(const char *fmt, ...);
+
+/* Routes library logging, NULL silences a level. Defaults go to stderr. */
+void gr_set_log(gr_log_fn info_fn, gr_log_fn error_fn);
+
+/*
+ * Routes the per job details of gr_evaluate() (unknown cards, missing
+ * GRES), which run on every cache miss; Slurm's debug() fits. Off unless
+ * set, NULL turns it off again.
+ */
+void gr_set_debug(gr_log_fn debug_fn);
+
+/* Prefix of every log line, the plugin name by default. */
+extern const char *gr_log_name;
+
+/*
+ * Loads and validates a config file or buffer. Returns NULL (after logging
+ * why) if it cannot be used. name is only used in messages.
+ */
+gr_config_t *gr_config_load(const char *filename);
+gr_config_t *gr_config_parse(const char *buf, size_t len, const char *name);
+void gr_config_free(gr_config_t *cfg);
+
+bool gr_config_enabled(const gr_config_t *cfg);
+gr_mode_t gr_config_mode(const gr_config_t *cfg);
+/* Unique per loaded config, 0 for NULL. Reloads get a new generation. */
+uint64_t gr_config_generation(const gr_config_t *cfg);
+int gr_config_num_cards(const gr_config_t *cfg);
+int gr_config_num_partitions(const gr_config_t *cfg);
+const char *gr_card_name(const gr_config_t *cfg, int card_id);
+/* Partition of a policy_id from gr_result_t, NULL if out of range. */
+const char *gr_partition_name(const gr_config_t *cfg, int policy_id);
+
+/*
+ * True if the job's user, account, QOS or reservation is listed in one of
+ * the exempt_* settings, which lift the ratio altogether. Names may be
+ * NULL. A bit test per UID and one hashed lookup per name, without any
+ * when nothing is exempt; meant to run before a job's TRES are looked at.
+ */
+bool gr_exempt(const gr_config_t *cfg, uint32_t uid, const char *account,
+               const char *qos, const char *reservation);
+
+/*
+ * Evaluates a job: partition may be a comma separated list, tres is the
+ * job's tres_per_node and may be NULL. res may be NULL. Never allocates.
+ */
+gr_decision_t gr_evaluate(const gr_config_t *cfg, const char *partition,
+                          const char *tres, uint32_t ncpu, gr_result_t *res);
+
+/*
+ * For a job gr_evaluate() rejects for its ratio, the CPU count all of its
+ * partitions accept with the same GPUs, taken from the precomputed accept
+ * table where it can be. Returns 0, with res describing the original
+ * rejection, when there is none (no whole CPU count fits the ratio, or its
+ * partitions disagree) or the job was not rejected for its ratio.
+ */
+uint32_t gr_adjust_cpus(const gr_config_t *cfg, const char *partition,
+                        const char *tres, uint32_t ncpu, gr_result_t *res);
+
+/*
+ * Writes the user facing explanation of a rejection into buf, returns the
+ * length snprintf would have written. Copies text preformatted at load and
+ * never allocates.
+ */
+int gr_format_message(const gr_config_t *cfg, const gr_result_t *res,
+                      char *buf, size_t size);
+
+/*
+ * gr_evaluate() behind a fixed size, lock-free decision cache keyed by
+ * (partition, tres, ncpu) and the config generation, so scripted floods of
+ * identical jobs skip parsing. On rejection msg (if not NULL) receives the
+ * gr_format_message() text. Safe to call from any number of threads.
+ */
+gr_decision_t gr_evaluate_cached(const gr_config_t *cfg,
+                                 const char *partition, const char *tres,
+                                 uint32_t ncpu, gr_result_t *res,
+                                 char *msg, size_t size);
+
+/* Card ids of gr_card_id() besides the index of a card.* setting. */
+#define GR_CARD_UNTYPED (-1) // gpu:N, checked as the partition's card for those
+#define GR_CARD_UNKNOWN (-2) // a type the config has no ratio for
+
+/* Card id of a GPU type, NULL for none. Partition policy id, or -1. */
+int gr_card_id(const gr_config_t *cfg, const char *name);
+int gr_partition_id(const gr_config_t *cfg, const char *name);
+
+/*
+ * Checks n requests of one card type each against the policy of one
+ * partition in bulk: request i is ngpu[i] GPUs of card card_id[i] with
+ * ncpu[i] CPUs, per node as gr_evaluate() sees them. Sets bit i of accept
+ * ((n + 63) / 64 words) when gr_evaluate() would accept it, as it does for
+ * cards without a ratio there and for any policy_id of -1; 0 GPUs is
+ * rejected as a bad request. delta (may be NULL) gets the CPUs to add, negative to remove,
+ * to match the ratio, or 0 when accepted or no whole count matches.
+ * Returns the number accepted. Never allocates.
+ */
+size_t gr_evaluate_batch(const gr_config_t *cfg, int policy_id, size_t n,
+                         const uint32_t *ncpu, const uint32_t *ngpu,
+                         const int32_t *card_id, uint64_t *accept,
+                         int32_t *delta);
+
+/* Kernels of gr_evaluate_batch(). */
+typedef enum {
+    GR_BATCH_SCALAR,
+    GR_BATCH_AVX2,
+    GR_BATCH_AVX512,
+} gr_batch_isa_t;
+
+/*
+ * The kernel in use, by default the widest the CPU supports. gr_batch_use()
+ * picks another, for tests and benchmarks; -1 if the CPU lacks it.
+ */
+gr_batch_isa_t gr_batch_isa(void);
+int gr_batch_use(gr_batch_isa_t isa);
+const char *gr_batch_isa_name(gr_batch_isa_t isa);
+
+/* Slurm's values for job_descriptor counts that were not set. */
+#define GR_NO_VAL   0xfffffffe
+#define GR_NO_VAL16 0xfffe
+
+/*
+ * The job_descriptor fields a job's CPU/GPU ratio depends on. Strings may
+ * be NULL, counts GR_NO_VAL / GR_NO_VAL16 or 0 when not set.
+ */
+typedef struct {
+    const char *tres_per_node;
+    const char *tres_per_job;    // --gpus
+    const char *tres_per_task;   // --gpus-per-task
+    const char *tres_per_socket; // --gpus-per-socket
+    const char *cpus_per_tres;   // --cpus-per-gpu
+    uint32_t min_cpus;           // of the whole job
+    uint32_t min_nodes;
+    uint32_t num_tasks;
+    uint16_t cpus_per_task;
+    uint16_t ntasks_per_node;
+    uint16_t sockets_per_node;
+    uint16_t pn_min_cpus;
+} gr_job_t;
+
+#define GR_SHAPE_TRES 192
+
+/* A job request as each of its nodes sees it, what gr_evaluate() checks. */
+typedef struct {
+    const char *tres;  // GPUs per node: tres_per_node itself or buf
+    uint32_t cpus;     // CPUs per node
+    uint32_t nodes;    // nodes the job was divided by, 1 if it did not divide evenly
+    char buf[GR_SHAPE_TRES];
+} gr_shape_t;
+
+/*
+ * Brings a job to per node shape: GPUs from whichever tres_per_* is set,
+ * CPUs from --cpus-per-gpu, else the largest of min_cpus, tasks *
+ * cpus_per_task and nodes * pn_min_cpus, both divided by the node count.
+ * A plain single node tres_per_node request is passed through untouched;
+ * otherwise GPU entries are rewritten as gpu:<type>:<count>. When the job
+ * does not split evenly over its nodes it is checked as a whole. Never
+ * allocates.
+ */
+void gr_job_shape(const gr_job_t *job, gr_shape_t *shape);
+
+/* Job fields that give a job cpus CPUs per node, see gr_job_adjust(). */
+typedef struct {
+    uint32_t min_cpus;
+    uint32_t cpus_per_gpu; // for cpus_per_tres, 0 if the job has none
+} gr_job_cpus_t;
+
+/*
+ * Works out the min_cpus, and for a --cpus-per-gpu job the CPUs per GPU,
+ * that make shape (from gr_job_shape()) come out at cpus CPUs per node.
+ * Returns -1 if cpus_per_task or pn_min_cpus would still hold the job to
+ * more CPUs, or the CPUs do not divide evenly over the GPUs.
+ */
+int gr_job_adjust(const gr_job_t *job, const gr_shape_t *shape, uint32_t cpus,
+                  gr_job_cpus_t *out);
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses; // includes lookups too long to cache
+    uint32_t slots;
+} gr_cache_stats_t;
+
+/* Sums the cache counters since the process started. */
+void gr_cache_stats(gr_cache_stats_t *stats);
+
+/*
+ * Counters published in the stats_segment shared memory, see
+ * gresratio_stats.h. gr_stats_start() returns the time of a call's start
+ * (1 for calls not sampled for latency), or 0 if no segment is open, in
+ * which case recording is a no-op.
+ * gr_stats_record() counts an evaluated job against the partition and
+ * card in res, gr_stats_exempt() one let through by exempt_*.
+ */
+uint64_t gr_stats_start(void);
+void gr_stats_record(const gr_config_t *cfg, const gr_result_t *res,
+                     bool adjusted, uint64_t start);
+void gr_stats_exempt(uint64_t start);
+
+/*
+ * Live snapshot of a config file. Readers pin the current snapshot with
+ * gr_live_acquire() and must gr_live_release() it with the returned token;
+ * neither ever blocks. A watcher thread reloads the file when it changes
+ * and keeps the previous snapshot if the new file is invalid.
+ */
+int gr_live_start(const char *filename, bool watch);
+void gr_live_stop(void);
+const gr_config_t *gr_live_acquire(unsigned *token);
+void gr_live_release(unsigned token);
+
+#endif
@@ -0,0 +1,323 @@
+// gresratio_batch.c
+
+/*
+ * Bulk ratio checks over structure of arrays input, for the offline tools
+ * that evaluate millions of requests already resolved to (CPUs, GPUs,
+ * card). The ratio test is the cross multiplication ncpu * den ==
+ * ngpu * num in 64 bits, with num and den gathered per lane from the
+ * policy's card ratios; the CPU count a rejected request would need comes
+ * from the accept table gr_evaluate() uses, so the kernels never divide.
+ * Lanes asking for more GPUs than the table holds are finished by the
+ * scalar code, as are the last n % width requests.
+ *
+ * The kernel is picked on first use from what the CPU supports: AVX-512F,
+ * AVX2 or plain C. The vector kernels are compiled with target attributes,
+ * so the library itself needs no -m flags and runs on any x86-64.
+ */
+
+#include <stdatomic.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include "gresratio_internal.h"
+
+/* What a kernel needs of a policy, looked up once per batch. */
+struct batch_policy {
+    const gr_ratio_t *ratios; // by card id
+    const uint32_t *accept;   // see partition_policy
+    int num_cards;
+    int untyped_id;
+};
+
+/*
+ * One request the way check_partition() treats a single card type: no
+ * GPUs is a bad request, no ratio for the card accepts, otherwise the
+ * exact ratio decides. *delta gets the CPUs to add to match, or 0.
+ */
+static bool batch_one(const struct batch_policy *p, uint32_t ncpu,
+                      uint32_t ngpu, int32_t card, int32_t *delta) {
+    *delta = 0;
+    if (ngpu == 0)
+        return false;
+    if (card == GR_CARD_UNTYPED)
+        card = p->untyped_id;
+    if (card < 0 || card >= p->num_cards || p->ratios[card].num == 0)
+        return true;
+
+    gr_ratio_t r = p->ratios[card];
+    uint64_t need = (uint64_t) ngpu * r.num;
+    if ((uint64_t) ncpu * r.den == need)
+        return true;
+
+    uint64_t cpus = 0;
+    if (ngpu <= GR_TABLE_GPUS)
+        cpus = p->accept[card * GR_TABLE_GPUS + ngpu - 1];
+    else if (need % r.den == 0 && need / r.den <= UINT32_MAX)
+        cpus = need / r.den;
+    if (cpus)
+        *delta = (int32_t) ((uint32_t) cpus - ncpu);
+    return false;
+}
+
+static void batch_scalar(const struct batch_policy *p, size_t from, size_t n,
+                         const uint32_t *ncpu, const uint32_t *ngpu,
+                         const int32_t *card_id, uint64_t *accept,
+                         int32_t *delta) {
+    for (size_t i = from; i < n; i++) {
+        int32_t d;
+        if (batch_one(p, ncpu[i], ngpu[i], card_id[i], &d))
+            accept[i / 64] |= 1ull << (i % 64);
+        if (delta)
+            delta[i] = d;
+    }
+}
+
+/* Redoes the lanes in mask of the block at i in scalar code. */
+static void batch_fixup(const struct batch_policy *p, size_t i,
+                        unsigned mask, const uint32_t *ncpu,
+                        const uint32_t *ngpu, const int32_t *card_id,
+                        int32_t *delta) {
+    for (; mask; mask &= mask - 1) {
+        size_t k = i + __builtin_ctz(mask);
+        batch_one(p, ncpu[k], ngpu[k], card_id[k], &delta[k]);
+    }
+}
+
+#if defined(__x86_64__)
+
+/* Lanes of 8 requests; products of the even and odd lanes separately. */
+__attribute__((target("avx2")))
+static size_t batch_avx2(const struct batch_policy *p, size_t n,
+                         const uint32_t *ncpu, const uint32_t *ngpu,
+                         const int32_t *card_id, uint64_t *accept,
+                         int32_t *delta) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i untyped = _mm256_set1_epi32(GR_CARD_UNTYPED);
+    const __m256i untyped_id = _mm256_set1_epi32(p->untyped_id);
+    const __m256i num_cards = _mm256_set1_epi32(p->num_cards);
+    const __m256i table_gpus = _mm256_set1_epi32(GR_TABLE_GPUS);
+    const __m256i one = _mm256_set1_epi32(1);
+    const int *nums = (const int *) &p->ratios[0].num;
+    const int *dens = (const int *) &p->ratios[0].den;
+    size_t i;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i cpu = _mm256_loadu_si256((const __m256i *) (ncpu + i));
+        __m256i gpu = _mm256_loadu_si256((const __m256i *) (ngpu + i));
+        __m256i card = _mm256_loadu_si256((const __m256i *) (card_id + i));
+
+        card = _mm256_blendv_epi8(card, untyped_id,
+                                  _mm256_cmpeq_epi32(card, untyped));
+        __m256i valid = _mm256_andnot_si256(
+            _mm256_cmpgt_epi32(zero, card),
+            _mm256_cmpgt_epi32(num_cards, card));
+        __m256i num = _mm256_mask_i32gather_epi32(zero, nums, card, valid, 8);
+        __m256i den = _mm256_mask_i32gather_epi32(zero, dens, card, valid, 8);
+
+        /* ncpu * den == ngpu * num, 64 bit products of unsigned lanes */
+        __m256i even = _mm256_cmpeq_epi64(_mm256_mul_epu32(cpu, den),
+                                          _mm256_mul_epu32(gpu, num));
+        __m256i odd = _mm256_cmpeq_epi64(
+            _mm256_mul_epu32(_mm256_srli_epi64(cpu, 32),
+                             _mm256_srli_epi64(den, 32)),
+            _mm256_mul_epu32(_mm256_srli_epi64(gpu, 32),
+                             _mm256_srli_epi64(num, 32)));
+        __m256i match = _mm256_blend_epi32(even, odd, 0xaa);
+        __m256i no_ratio = _mm256_cmpeq_epi32(num, zero);
+        __m256i no_gpus = _mm256_cmpeq_epi32(gpu, zero);
+        __m256i ok = _mm256_andnot_si256(no_gpus,
+                                         _mm256_or_si256(no_ratio, match));
+        unsigned bits = _mm256_movemask_ps(_mm256_castsi256_ps(ok));
+        accept[i / 64] |= (uint64_t) bits << (i % 64);
+        if (delta == NULL)
+            continue;
+
+        /* CPUs the accept table has for rejected lanes of 1..16 GPUs */
+        __m256i off = _mm256_or_si256(ok, no_gpus);
+        __m256i in_table = _mm256_andnot_si256(
+            _mm256_or_si256(off, _mm256_cmpgt_epi32(gpu, table_gpus)),
+            _mm256_cmpgt_epi32(gpu, zero));
+        __m256i slot = _mm256_add_epi32(_mm256_slli_epi32(card, 4),
+                                        _mm256_sub_epi32(gpu, one));
+        __m256i cpus = _mm256_mask_i32gather_epi32(
+            zero, (const int *) p->accept, slot, in_table, 4);
+        __m256i d = _mm256_andnot_si256(_mm256_cmpeq_epi32(cpus, zero),
+                                        _mm256_sub_epi32(cpus, cpu));
+        _mm256_storeu_si256((__m256i *) (delta + i), d);
+
+        /* above 16 GPUs, or counts past INT32_MAX: rare, done one by one */
+        __m256i rest = _mm256_andnot_si256(_mm256_or_si256(off, in_table),
+                                           _mm256_set1_epi32(-1));
+        unsigned left = _mm256_movemask_ps(_mm256_castsi256_ps(rest));
+        if (left)
+            batch_fixup(p, i, left, ncpu, ngpu, card_id, delta);
+    }
+    return i;
+}
+
+/* Lanes of 16 requests, the products widened to 64 bits in two halves. */
+__attribute__((target("avx512f")))
+static size_t batch_avx512(const struct batch_policy *p, size_t n,
+                           const uint32_t *ncpu, const uint32_t *ngpu,
+                           const int32_t *card_id, uint64_t *accept,
+                           int32_t *delta) {
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i untyped_id = _mm512_set1_epi32(p->untyped_id);
+    const __m512i num_cards = _mm512_set1_epi32(p->num_cards);
+    const __m512i one = _mm512_set1_epi32(1);
+    const int *nums = (const int *) &p->ratios[0].num;
+    const int *dens = (const int *) &p->ratios[0].den;
+    size_t i;
+
+    for (i = 0; i + 16 <= n; i += 16) {
+        __m512i cpu = _mm512_loadu_si512(ncpu + i);
+        __m512i gpu = _mm512_loadu_si512(ngpu + i);
+        __m512i card = _mm512_loadu_si512(card_id + i);
+
+        card = _mm512_mask_mov_epi32(card, _mm512_cmpeq_epi32_mask(
+            card, _mm512_set1_epi32(GR_CARD_UNTYPED)), untyped_id);
+        __mmask16 valid = _mm512_cmplt_epu32_mask(card, num_cards);
+        __m512i num = _mm512_mask_i32gather_epi32(zero, valid, card, nums, 8);
+        __m512i den = _mm512_mask_i32gather_epi32(zero, valid, card, dens, 8);
+
+        __m512i lo = _mm512_cvtepu32_epi64(_mm512_castsi512_si256(cpu));
+        __m512i hi = _mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(cpu, 1));
+        __m512i lhs_lo = _mm512_mul_epu32(lo, _mm512_cvtepu32_epi64(
+            _mm512_castsi512_si256(den)));
+        __m512i lhs_hi = _mm512_mul_epu32(hi, _mm512_cvtepu32_epi64(
+            _mm512_extracti64x4_epi64(den, 1)));
+        __m512i rhs_lo = _mm512_mul_epu32(
+            _mm512_cvtepu32_epi64(_mm512_castsi512_si256(gpu)),
+            _mm512_cvtepu32_epi64(_mm512_castsi512_si256(num)));
+        __m512i rhs_hi = _mm512_mul_epu32(
+            _mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(gpu, 1)),
+            _mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(num, 1)));
+        __mmask16 match = _mm512_cmpeq_epi64_mask(lhs_lo, rhs_lo) |
+                          _mm512_cmpeq_epi64_mask(lhs_hi, rhs_hi) << 8;
+        __mmask16 no_ratio = _mm512_cmpeq_epi32_mask(num, zero);
+        __mmask16 has_gpus = _mm512_cmpneq_epi32_mask(gpu, zero);
+        __mmask16 ok = has_gpus & (no_ratio | match);
+        accept[i / 64] |= (uint64_t) ok << (i % 64);
+        if (delta == NULL)
+            continue;
+
+        __mmask16 off = ok | ~has_gpus;
+        __mmask16 in_table = ~off & _mm512_cmple_epu32_mask(
+            gpu, _mm512_set1_epi32(GR_TABLE_GPUS));
+        __m512i slot = _mm512_add_epi32(_mm512_slli_epi32(card, 4),
+                                        _mm512_sub_epi32(gpu, one));
+        __m512i cpus = _mm512_mask_i32gather_epi32(zero, in_table, slot,
+                                                   p->accept, 4);
+        __m512i d = _mm512_maskz_sub_epi32(
+            _mm512_cmpneq_epi32_mask(cpus, zero), cpus, cpu);
+        _mm512_storeu_si512(delta + i, d);
+
+        unsigned left = (uint16_t) ~(off | in_table);
+        if (left)
+            batch_fixup(p, i, left, ncpu, ngpu, card_id, delta);
+    }
+    return i;
+}
+
+#endif
+
+/* -1 until the first batch picks the widest kernel the CPU runs. */
+static atomic_int isa = -1;
+
+static bool isa_supported(gr_batch_isa_t want) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (want == GR_BATCH_AVX512)
+        return __builtin_cpu_supports("avx512f");
+    if (want == GR_BATCH_AVX2)
+        return __builtin_cpu_supports("avx2");
+#endif
+    return want == GR_BATCH_SCALAR;
+}
+
+gr_batch_isa_t gr_batch_isa(void) {
+    int current = atomic_load_explicit(&isa, memory_order_relaxed);
+
+    if (current < 0) {
+        current = isa_supported(GR_BATCH_AVX512) ? GR_BATCH_AVX512 :
+                  isa_supported(GR_BATCH_AVX2) ? GR_BATCH_AVX2 :
+                  GR_BATCH_SCALAR;
+        atomic_store_explicit(&isa, current, memory_order_relaxed);
+    }
+    return current;
+}
+
+int gr_batch_use(gr_batch_isa_t want) {
+    if (!isa_supported(want))
+        return -1;
+    atomic_store_explicit(&isa, want, memory_order_relaxed);
+    return 0;
+}
+
+const char *gr_batch_isa_name(gr_batch_isa_t which) {
+    switch (which) {
+    case GR_BATCH_AVX512:
+        return "avx512";
+    case GR_BATCH_AVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+size_t gr_evaluate_batch(const gr_config_t *cfg, int policy_id, size_t n,
+                         const uint32_t *ncpu, const uint32_t *ngpu,
+                         const int32_t *card_id, uint64_t *accept,
+                         int32_t *delta) {
+    size_t done = 0, accepted = 0;
+
+    memset(accept, 0, (n + 63) / 64 * sizeof(*accept));
+    if (cfg == NULL || cfg->disabled == 1 || policy_id < 0 ||
+        policy_id >= cfg->num_parts) {
+        for (size_t i = 0; i < n; i++)
+            accept[i / 64] |= 1ull << (i % 64);
+        if (delta)
+            memset(delta, 0, n * sizeof(*delta));
+        return n;
+    }
+
+    const struct partition_policy *policy = &cfg->parts[policy_id];
+    struct batch_policy p = {
+        .ratios = policy->ratios,
+        .accept = policy->accept,
+        .num_cards = cfg->num_entries,
+        .untyped_id = policy->untyped_id,
+    };
+
+    switch (gr_batch_isa()) {
+#if defined(__x86_64__)
+    case GR_BATCH_AVX512:
+        done = batch_avx512(&p, n, ncpu, ngpu, card_id, accept, delta);
+        break;
+    case GR_BATCH_AVX2:
+        done = batch_avx2(&p, n, ncpu, ngpu, card_id, accept, delta);
+        break;
+#endif
+    default:
+        break;
+    }
+    batch_scalar(&p, done, n, ncpu, ngpu, card_id, accept, delta);
+
+    for (size_t w = 0; w < (n + 63) / 64; w++)
+        accepted += __builtin_popcountll(accept[w]);
+    return accepted;
+}
+
+int gr_card_id(const gr_config_t *cfg, const char *name) {
+    if (name == NULL)
+        return GR_CARD_UNTYPED;
+    int id = gr_index_lookup(&cfg->card_index, name, strlen(name));
+    return id < 0 ? GR_CARD_UNKNOWN : id;
+}
+
+int gr_partition_id(const gr_config_t *cfg, const char *name) {
+    return gr_index_lookup(&cfg->part_index, name, strlen(name));
+}
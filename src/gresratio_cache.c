@@ -0,0 +1,211 @@
+// gresratio_cache.c
+
+/*
+ * Decision cache for libgresratio. Workflow managers submit the same
+ * (partition, tres_per_node, min_cpus) over and over, so the decision and
+ * its message are memoized in a direct mapped table.
+ *
+ * Every slot is guarded by its own sequence counter: a writer claims the
+ * slot by moving the counter to an odd value (and simply skips caching if
+ * another writer holds it), readers copy the slot and retry as a miss if
+ * the counter moved underneath them. Nobody ever waits.
+ *
+ * The key bytes are stored in the slot so a hash collision can only cost a
+ * miss. The config generation is part of the key, so a reload invalidates
+ * every slot without touching the table.
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "gresratio_internal.h"
+
+#ifndef GR_CACHE_SLOTS
+#define GR_CACHE_SLOTS 1024 // power of two
+#endif
+#define KEY_SIZE 96  // partition and tres, back to back
+#define MSG_SIZE 320 // longest cached message, including the NUL
+#define NULL_LEN 0xff // key length marking a NULL string
+#define STRIPES 16
+
+struct memo_entry {
+    atomic_uint seq; // odd while a writer fills the slot
+    uint32_t ncpu;
+    uint64_t hash;
+    uint64_t generation; // 0 for a slot that was never filled
+    uint8_t part_len;
+    uint8_t tres_len;
+    uint16_t msg_len;
+    gr_result_t res;
+    char key[KEY_SIZE];
+    char msg[MSG_SIZE];
+} __attribute__((aligned(64)));
+
+static struct memo_entry table[GR_CACHE_SLOTS];
+
+/* Counters striped over cache lines so threads do not share one. */
+struct memo_counter {
+    atomic_uint_fast64_t hits;
+    atomic_uint_fast64_t misses;
+} __attribute__((aligned(64)));
+
+static struct memo_counter counters[STRIPES];
+static atomic_uint next_stripe;
+static _Thread_local struct memo_counter *my_counter;
+
+static struct memo_counter *counter(void) {
+    if (my_counter == NULL)
+        my_counter = &counters[atomic_fetch_add(&next_stripe, 1) % STRIPES];
+    return my_counter;
+}
+
+/* FNV-1a over the key, ncpu is folded in last. */
+static uint64_t memo_hash(const char *part, size_t part_len,
+                          const char *tres, size_t tres_len, uint32_t ncpu) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < part_len; i++)
+        h = (h ^ (unsigned char) part[i]) * 1099511628211ULL;
+    h = (h ^ NULL_LEN) * 1099511628211ULL;
+    for (size_t i = 0; i < tres_len; i++)
+        h = (h ^ (unsigned char) tres[i]) * 1099511628211ULL;
+    h ^= ncpu;
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    return h ^ (h >> 32);
+}
+
+/* Key length, NULL_LEN for NULL and -1 if too long for a slot. */
+static int key_len(const char *s, size_t room) {
+    if (s == NULL)
+        return NULL_LEN;
+    size_t len = strnlen(s, room + 1);
+    return len > room ? -1 : (int) len;
+}
+
+static bool memo_lookup(const struct memo_entry *e, uint64_t h,
+                        uint64_t gen, const char *part, int part_len,
+                        const char *tres, int tres_len, uint32_t ncpu,
+                        gr_result_t *res, char *msg, size_t size) {
+    unsigned seq = atomic_load_explicit(&e->seq, memory_order_acquire);
+    if (seq & 1)
+        return false;
+
+    if (e->hash != h || e->generation != gen || e->ncpu != ncpu ||
+        e->part_len != part_len || e->tres_len != tres_len)
+        return false;
+    size_t plen = part_len == NULL_LEN ? 0 : part_len;
+    size_t tlen = tres_len == NULL_LEN ? 0 : tres_len;
+    if ((plen && memcmp(e->key, part, plen) != 0) ||
+        (tlen && memcmp(e->key + plen, tres, tlen) != 0))
+        return false;
+
+    *res = e->res;
+    if (msg != NULL && size > 0) {
+        size_t n = e->msg_len < size ? e->msg_len : size - 1;
+        memcpy(msg, e->msg, n);
+        msg[n] = '\0';
+    }
+
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&e->seq, memory_order_relaxed) == seq;
+}
+
+static void memo_store(struct memo_entry *e, uint64_t h, uint64_t gen,
+                       const char *part, int part_len, const char *tres,
+                       int tres_len, uint32_t ncpu, const gr_result_t *res,
+                       const char *msg, int msg_len) {
+    unsigned seq = atomic_load_explicit(&e->seq, memory_order_relaxed);
+    if ((seq & 1) ||
+        !atomic_compare_exchange_strong_explicit(&e->seq, &seq, seq + 1,
+                                                 memory_order_relaxed,
+                                                 memory_order_relaxed))
+        return; // another thread is filling this slot
+    atomic_thread_fence(memory_order_release);
+
+    size_t plen = part_len == NULL_LEN ? 0 : part_len;
+    size_t tlen = tres_len == NULL_LEN ? 0 : tres_len;
+    e->hash = h;
+    e->generation = gen;
+    e->ncpu = ncpu;
+    e->part_len = part_len;
+    e->tres_len = tres_len;
+    if (plen)
+        memcpy(e->key, part, plen);
+    if (tlen)
+        memcpy(e->key + plen, tres, tlen);
+    e->res = *res;
+    e->msg_len = msg_len;
+    memcpy(e->msg, msg, msg_len + 1);
+
+    atomic_store_explicit(&e->seq, seq + 2, memory_order_release);
+}
+
+gr_decision_t gr_evaluate_cached(const gr_config_t *cfg,
+                                 const char *part, const char *tres,
+                                 uint32_t ncpu, gr_result_t *res,
+                                 char *msg, size_t size) {
+    struct memo_counter *c = counter();
+    gr_result_t local;
+    if (res == NULL)
+        res = &local;
+
+    int part_len = key_len(part, KEY_SIZE);
+    int tres_len = part_len < 0 ? -1 :
+        key_len(tres, KEY_SIZE - (part_len == NULL_LEN ? 0 : part_len));
+    uint64_t gen = gr_config_generation(cfg);
+
+    if (tres_len < 0 || gen == 0) {
+        atomic_fetch_add_explicit(&c->misses, 1, memory_order_relaxed);
+        gr_stats_cache(false);
+        if (gr_evaluate(cfg, part, tres, ncpu, res) != GR_ACCEPT && msg)
+            gr_format_message(cfg, res, msg, size);
+        else if (msg && size)
+            msg[0] = '\0';
+        return res->decision;
+    }
+
+    /* Configs evaluated side by side (ratio-replay) must not share slots. */
+    uint64_t h = memo_hash(part, part_len == NULL_LEN ? 0 : part_len,
+                           tres, tres_len == NULL_LEN ? 0 : tres_len, ncpu) ^
+                 gen * 0x9e3779b97f4a7c15ULL;
+    struct memo_entry *e = &table[h & (GR_CACHE_SLOTS - 1)];
+
+    if (memo_lookup(e, h, gen, part, part_len, tres, tres_len, ncpu, res,
+                    msg, size)) {
+        atomic_fetch_add_explicit(&c->hits, 1, memory_order_relaxed);
+        gr_stats_cache(true);
+        return res->decision;
+    }
+    atomic_fetch_add_explicit(&c->misses, 1, memory_order_relaxed);
+    gr_stats_cache(false);
+
+    char text[MSG_SIZE];
+    int len = 0;
+    if (gr_evaluate(cfg, part, tres, ncpu, res) != GR_ACCEPT)
+        len = gr_format_message(cfg, res, text, sizeof(text));
+    else
+        text[0] = '\0';
+
+    if (len >= 0 && len < MSG_SIZE)
+        memo_store(e, h, gen, part, part_len, tres, tres_len, ncpu, res,
+                   text, len);
+    if (msg == NULL || size == 0)
+        return res->decision;
+    if (len >= 0 && len < MSG_SIZE)
+        snprintf(msg, size, "%s", text);
+    else
+        gr_format_message(cfg, res, msg, size);
+    return res->decision;
+}
+
+void gr_cache_stats(gr_cache_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 0; i < STRIPES; i++) {
+        stats->hits += atomic_load_explicit(&counters[i].hits,
+                                            memory_order_relaxed);
+        stats->misses += atomic_load_explicit(&counters[i].misses,
+                                              memory_order_relaxed);
+    }
+    stats->slots = GR_CACHE_SLOTS;
+}
@@ -0,0 +1,521 @@
+// gresratio_columns.c
+
+/*
+ * Column files for libgresratio, see gresratio_columns.h for the layout.
+ * The writer keeps every column in memory and interns strings in the same
+ * open addressing index the config uses; writing groups the rows by
+ * partition with one counting sort. Mapping checks every section and code
+ * once, so the tools can index by code without bounds checks.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "gresratio_columns.h"
+#include "gresratio_internal.h"
+#include "gresratio_tres.h"
+
+#define WRITE_CHUNK 65536 // elements gathered per fwrite
+#define MAX_ROWS UINT32_MAX
+
+struct dict {
+    struct name_index index;
+    char **names;
+    uint32_t num;
+    uint32_t max;
+    uint64_t bytes; // of the string table
+};
+
+struct gr_columns_writer {
+    uint64_t rows;
+    uint64_t max_rows;
+    uint64_t *jobid;
+    uint32_t *user;
+    uint32_t *account;
+    uint16_t *partition;
+    uint32_t *tres;
+    uint16_t *card;
+    uint32_t *gpus;
+    uint32_t *cpus;
+    struct dict dicts[GR_NUM_DICTS];
+};
+
+/* Element size of each column. */
+static const uint8_t widths[GR_NUM_COLS] = {
+    [GR_COL_JOBID] = 8, [GR_COL_USER] = 4, [GR_COL_ACCOUNT] = 4,
+    [GR_COL_PARTITION] = 2, [GR_COL_TRES] = 4, [GR_COL_CARD] = 2,
+    [GR_COL_GPUS] = 4, [GR_COL_CPUS] = 4,
+};
+
+/* Codes a dictionary can hand out, by the width of its column. */
+static const uint32_t max_codes[GR_NUM_DICTS] = {
+    [GR_DICT_USER] = UINT32_MAX, [GR_DICT_ACCOUNT] = UINT32_MAX,
+    [GR_DICT_PARTITION] = UINT16_MAX, [GR_DICT_TRES] = UINT32_MAX,
+    [GR_DICT_CARD] = GR_COLS_NO_CARD,
+};
+
+static uint64_t align_up(uint64_t n) {
+    return (n + GR_COLS_ALIGN - 1) & ~(uint64_t) (GR_COLS_ALIGN - 1);
+}
+
+/* Writer. */
+
+gr_columns_writer_t *gr_columns_writer(void) {
+    return calloc(1, sizeof(gr_columns_writer_t));
+}
+
+void gr_columns_writer_free(gr_columns_writer_t *w) {
+    if (w == NULL)
+        return;
+    for (int d = 0; d < GR_NUM_DICTS; d++) {
+        for (uint32_t i = 0; i < w->dicts[d].num; i++)
+            free(w->dicts[d].names[i]);
+        free(w->dicts[d].names);
+        free(w->dicts[d].index.slots);
+    }
+    free(w->jobid);
+    free(w->user);
+    free(w->account);
+    free(w->partition);
+    free(w->tres);
+    free(w->card);
+    free(w->gpus);
+    free(w->cpus);
+    free(w);
+}
+
+/* Code of s[0, len), interned on first use. Returns -1 when full. */
+static int64_t intern(struct dict *d, enum gr_dict which, const char *s,
+                      size_t len) {
+    int id = gr_index_lookup(&d->index, s, len);
+    if (id >= 0)
+        return id;
+
+    if (d->num == max_codes[which]) {
+        gr_error("more than %u distinct values in a column",
+                 max_codes[which]);
+        return -1;
+    }
+    if (d->num == d->max) {
+        uint32_t max = d->max ? d->max * 2 : 64;
+        char **names = realloc(d->names, max * sizeof(*names));
+        if (names == NULL)
+            return -1;
+        d->names = names;
+        d->max = max;
+    }
+    char *copy = strndup(s, len);
+    if (copy == NULL || gr_index_insert(&d->index, copy, d->num) != 0) {
+        free(copy);
+        return -1;
+    }
+    d->names[d->num] = copy;
+    d->bytes += len + 1;
+    return d->num++;
+}
+
+static int64_t intern_string(struct dict *d, enum gr_dict which,
+                             const char *s) {
+    return s ? intern(d, which, s, strlen(s)) : intern(d, which, "", 0);
+}
+
+static int grow_rows(gr_columns_writer_t *w) {
+    uint64_t max = w->max_rows ? w->max_rows * 2 : 4096;
+    void *p;
+
+#define GROW(col)                                                       \
+    if ((p = realloc(w->col, max * sizeof(*w->col))) == NULL)           \
+        return -1;                                                      \
+    w->col = p;
+    GROW(jobid) GROW(user) GROW(account) GROW(partition) GROW(tres)
+    GROW(card) GROW(gpus) GROW(cpus)
+#undef GROW
+    w->max_rows = max;
+    return 0;
+}
+
+/*
+ * The one GPU type a shaped request asks for, as check_partition() sees
+ * it: other resources are ignored, several types or no GPUs at all leave
+ * it to be checked by its TRES string.
+ */
+static int64_t card_of(gr_columns_writer_t *w, const char *tres,
+                       uint32_t *gpus) {
+    gr_tres_iter_t it;
+    gr_tres_t entry;
+    gr_slice_t type = { NULL, 0 };
+    uint64_t count = 0;
+    bool found = false;
+    int rc;
+
+    *gpus = 0;
+    gr_tres_init(&it, tres);
+    while ((rc = gr_tres_next(&it, &entry)) > 0) {
+        if (!gr_slice_eq(entry.name, "gpu"))
+            continue;
+        if (found && (entry.type.len != type.len ||
+                      memcmp(entry.type.ptr, type.ptr, type.len) != 0))
+            return GR_COLS_NO_CARD;
+        found = true;
+        type = entry.type;
+        if ((count += entry.count) > INT32_MAX)
+            return GR_COLS_NO_CARD;
+    }
+    if (rc < 0 || count == 0)
+        return GR_COLS_NO_CARD;
+    *gpus = count;
+    return intern(&w->dicts[GR_DICT_CARD], GR_DICT_CARD,
+                  type.len ? type.ptr : "", type.len);
+}
+
+int gr_columns_add(gr_columns_writer_t *w, const gr_columns_row_t *row) {
+    gr_shape_t shape;
+    uint64_t i = w->rows;
+    int64_t codes[4], card;
+    uint32_t gpus;
+
+    if (i == MAX_ROWS) {
+        gr_error("more than %u rows", MAX_ROWS);
+        return -1;
+    }
+    if (i == w->max_rows && grow_rows(w) != 0)
+        return -1;
+
+    gr_job_shape(&row->job, &shape);
+    codes[0] = intern_string(&w->dicts[GR_DICT_USER], GR_DICT_USER,
+                             row->user);
+    codes[1] = intern_string(&w->dicts[GR_DICT_ACCOUNT], GR_DICT_ACCOUNT,
+                             row->account);
+    codes[2] = intern_string(&w->dicts[GR_DICT_PARTITION], GR_DICT_PARTITION,
+                             row->partition);
+    codes[3] = intern_string(&w->dicts[GR_DICT_TRES], GR_DICT_TRES,
+                             shape.tres);
+    card = card_of(w, shape.tres, &gpus);
+    for (int k = 0; k < 4; k++)
+        if (codes[k] < 0)
+            return -1;
+    if (card < 0)
+        return -1;
+
+    w->jobid[i] = row->jobid;
+    w->user[i] = codes[0];
+    w->account[i] = codes[1];
+    w->partition[i] = codes[2];
+    w->tres[i] = codes[3];
+    w->card[i] = card;
+    w->gpus[i] = gpus;
+    w->cpus[i] = shape.cpus;
+    w->rows++;
+    return 0;
+}
+
+static int pad_to(FILE *file, uint64_t offset) {
+    static const char zeros[GR_COLS_ALIGN];
+    long at = ftell(file);
+
+    if (at < 0 || (uint64_t) at > offset)
+        return -1;
+    return fwrite(zeros, 1, offset - at, file) == offset - at ? 0 : -1;
+}
+
+/* Writes column data in row order, elements of width bytes. */
+static int write_column(FILE *file, const void *data, int width,
+                        const uint32_t *order, uint64_t rows) {
+    static char chunk[WRITE_CHUNK * 8];
+
+    for (uint64_t start = 0; start < rows; start += WRITE_CHUNK) {
+        uint64_t n = rows - start < WRITE_CHUNK ? rows - start : WRITE_CHUNK;
+        for (uint64_t k = 0; k < n; k++)
+            memcpy(chunk + k * width,
+                   (const char *) data + (uint64_t) order[start + k] * width,
+                   width);
+        if (fwrite(chunk, width, n, file) != n)
+            return -1;
+    }
+    return 0;
+}
+
+/* Lays out the sections, header first. */
+static void layout(const gr_columns_writer_t *w, struct gr_cols_header *hdr) {
+    uint64_t offset = align_up(sizeof(*hdr));
+
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, GR_COLS_MAGIC, sizeof(hdr->magic));
+    hdr->version = GR_COLS_VERSION;
+    hdr->header_size = sizeof(*hdr);
+    hdr->rows = w->rows;
+    for (int c = 0; c < GR_NUM_COLS; c++) {
+        hdr->columns[c] = (struct gr_cols_section) {
+            offset, w->rows * widths[c] };
+        offset = align_up(offset + hdr->columns[c].size);
+    }
+    for (int d = 0; d < GR_NUM_DICTS; d++) {
+        struct gr_cols_dict *dict = &hdr->dicts[d];
+        dict->count = w->dicts[d].num;
+        dict->offsets = (struct gr_cols_section) {
+            offset, (uint64_t) dict->count * 4 };
+        offset = align_up(offset + dict->offsets.size);
+        dict->strings = (struct gr_cols_section) {
+            offset, w->dicts[d].bytes };
+        offset = align_up(offset + dict->strings.size);
+    }
+    hdr->groups = (struct gr_cols_section) {
+        offset, (uint64_t) (w->dicts[GR_DICT_PARTITION].num + 1) * 8 };
+}
+
+static int write_file(const gr_columns_writer_t *w, FILE *file,
+                      const struct gr_cols_header *hdr,
+                      const uint32_t *order, const uint64_t *groups) {
+    const void *data[GR_NUM_COLS] = {
+        w->jobid, w->user, w->account, w->partition, w->tres, w->card,
+        w->gpus, w->cpus,
+    };
+
+    if (fwrite(hdr, sizeof(*hdr), 1, file) != 1)
+        return -1;
+    for (int c = 0; c < GR_NUM_COLS; c++)
+        if (pad_to(file, hdr->columns[c].offset) != 0 ||
+            write_column(file, data[c], widths[c], order, w->rows) != 0)
+            return -1;
+    for (int d = 0; d < GR_NUM_DICTS; d++) {
+        const struct dict *dict = &w->dicts[d];
+        uint32_t offset = 0;
+
+        if (pad_to(file, hdr->dicts[d].offsets.offset) != 0)
+            return -1;
+        for (uint32_t i = 0; i < dict->num; i++) {
+            if (fwrite(&offset, 4, 1, file) != 1)
+                return -1;
+            offset += strlen(dict->names[i]) + 1;
+        }
+        if (pad_to(file, hdr->dicts[d].strings.offset) != 0)
+            return -1;
+        for (uint32_t i = 0; i < dict->num; i++)
+            if (fwrite(dict->names[i], strlen(dict->names[i]) + 1, 1,
+                       file) != 1)
+                return -1;
+    }
+    if (pad_to(file, hdr->groups.offset) != 0 ||
+        fwrite(groups, 8, w->dicts[GR_DICT_PARTITION].num + 1, file) !=
+            w->dicts[GR_DICT_PARTITION].num + 1)
+        return -1;
+    return 0;
+}
+
+int gr_columns_write(gr_columns_writer_t *w, const char *path) {
+    uint32_t parts = w->dicts[GR_DICT_PARTITION].num;
+    uint64_t *groups = calloc(parts + 1, sizeof(*groups));
+    uint32_t *order = malloc((w->rows ? w->rows : 1) * sizeof(*order));
+    struct gr_cols_header hdr;
+    FILE *file = NULL;
+    int rc = -1;
+
+    if (groups == NULL || order == NULL) {
+        gr_error("cannot allocate %llu rows",
+                 (unsigned long long) w->rows);
+        goto out;
+    }
+    for (uint64_t i = 0; i < w->rows; i++)
+        groups[w->partition[i] + 1]++;
+    for (uint32_t p = 0; p < parts; p++)
+        groups[p + 1] += groups[p];
+    for (uint64_t i = 0; i < w->rows; i++)
+        order[groups[w->partition[i]]++] = i;
+    /* groups[p] now is the end of group p, shift back to starts */
+    memmove(groups + 1, groups, parts * sizeof(*groups));
+    groups[0] = 0;
+
+    layout(w, &hdr);
+    if (hdr.dicts[GR_DICT_USER].strings.size > UINT32_MAX ||
+        hdr.dicts[GR_DICT_ACCOUNT].strings.size > UINT32_MAX ||
+        hdr.dicts[GR_DICT_TRES].strings.size > UINT32_MAX) {
+        gr_error("string table too large for %s", path);
+        goto out;
+    }
+    if ((file = fopen(path, "w")) == NULL) {
+        gr_error("cannot create %s: %m", path);
+        goto out;
+    }
+    if (write_file(w, file, &hdr, order, groups) != 0) {
+        gr_error("cannot write %s: %m", path);
+        goto out;
+    }
+    rc = 0;
+
+out:
+    if (file && fclose(file) != 0 && rc == 0) {
+        gr_error("cannot write %s: %m", path);
+        rc = -1;
+    }
+    if (rc != 0 && file)
+        unlink(path);
+    free(groups);
+    free(order);
+    return rc;
+}
+
+/* Reader. */
+
+int gr_columns_probe(const char *path) {
+    char magic[8];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    bool match;
+
+    if (fd < 0)
+        return 0;
+    match = read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+            memcmp(magic, GR_COLS_MAGIC, sizeof(magic)) == 0;
+    close(fd);
+    return match;
+}
+
+static bool section_ok(const struct gr_cols_section *s, uint64_t file_size,
+                       uint64_t want) {
+    return s->offset % GR_COLS_ALIGN == 0 && s->size == want &&
+           s->offset <= file_size && s->size <= file_size - s->offset;
+}
+
+static bool dict_ok(const struct gr_cols_dict *d, const char *map,
+                    uint64_t file_size) {
+    if (!section_ok(&d->offsets, file_size, (uint64_t) d->count * 4) ||
+        !section_ok(&d->strings, file_size, d->strings.size) ||
+        (d->count && (d->strings.size == 0 ||
+                      map[d->strings.offset + d->strings.size - 1] != '\0')))
+        return false;
+    const uint32_t *offsets = (const uint32_t *) (map + d->offsets.offset);
+    for (uint32_t i = 0; i < d->count; i++)
+        if (offsets[i] >= d->strings.size)
+            return false;
+    return true;
+}
+
+/* Every code of a column is in its dictionary. */
+static bool codes_ok(const uint32_t *column, uint64_t rows, uint32_t count) {
+    for (uint64_t i = 0; i < rows; i++)
+        if (column[i] >= count)
+            return false;
+    return true;
+}
+
+/* Every card code is in the dictionary or GR_COLS_NO_CARD. */
+static bool cards_ok(const uint16_t *card, uint64_t rows, uint32_t count) {
+    for (uint64_t i = 0; i < rows; i++)
+        if (card[i] >= count && card[i] != GR_COLS_NO_CARD)
+            return false;
+    return true;
+}
+
+static bool groups_ok(const uint64_t *groups, uint32_t parts, uint64_t rows,
+                      const uint16_t *partition) {
+    if (groups[0] != 0 || groups[parts] != rows)
+        return false;
+    for (uint32_t p = 0; p < parts; p++) {
+        if (groups[p] > groups[p + 1])
+            return false;
+        for (uint64_t i = groups[p]; i < groups[p + 1]; i++)
+            if (partition[i] != p)
+                return false;
+    }
+    return true;
+}
+
+gr_columns_t *gr_columns_map(const char *path) {
+    gr_columns_t *cols = calloc(1, sizeof(*cols));
+    const struct gr_cols_header *hdr;
+    struct stat st;
+    const char *map;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (cols == NULL || fd < 0 || fstat(fd, &st) != 0) {
+        gr_error("cannot open column file %s: %m", path);
+        goto fail;
+    }
+    if ((size_t) st.st_size < sizeof(*hdr)) {
+        gr_error("%s is not a column file", path);
+        goto fail;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        gr_error("cannot map column file %s: %m", path);
+        goto fail;
+    }
+    close(fd);
+    fd = -1;
+    hdr = (const struct gr_cols_header *) map;
+    cols->hdr = hdr;
+    cols->map_size = st.st_size;
+    cols->rows = hdr->rows;
+
+    bool ok = memcmp(hdr->magic, GR_COLS_MAGIC, sizeof(hdr->magic)) == 0 &&
+              hdr->version == GR_COLS_VERSION &&
+              hdr->header_size == sizeof(*hdr) && hdr->rows <= MAX_ROWS;
+    for (int c = 0; ok && c < GR_NUM_COLS; c++)
+        ok = section_ok(&hdr->columns[c], st.st_size, hdr->rows * widths[c]);
+    for (int d = 0; ok && d < GR_NUM_DICTS; d++)
+        ok = dict_ok(&hdr->dicts[d], map, st.st_size);
+    uint32_t parts = ok ? hdr->dicts[GR_DICT_PARTITION].count : 0;
+    ok = ok && section_ok(&hdr->groups, st.st_size, (parts + 1ull) * 8);
+    if (!ok) {
+        gr_error("%s is not a column file of this version", path);
+        gr_columns_unmap(cols);
+        return NULL;
+    }
+
+#define COLUMN(c) (const void *) (map + hdr->columns[c].offset)
+    cols->jobid = COLUMN(GR_COL_JOBID);
+    cols->user = COLUMN(GR_COL_USER);
+    cols->account = COLUMN(GR_COL_ACCOUNT);
+    cols->partition = COLUMN(GR_COL_PARTITION);
+    cols->tres = COLUMN(GR_COL_TRES);
+    cols->card = COLUMN(GR_COL_CARD);
+    cols->gpus = COLUMN(GR_COL_GPUS);
+    cols->cpus = COLUMN(GR_COL_CPUS);
+#undef COLUMN
+    cols->groups = (const uint64_t *) (map + hdr->groups.offset);
+
+    if (!codes_ok(cols->user, cols->rows, hdr->dicts[GR_DICT_USER].count) ||
+        !codes_ok(cols->account, cols->rows,
+                  hdr->dicts[GR_DICT_ACCOUNT].count) ||
+        !codes_ok(cols->tres, cols->rows, hdr->dicts[GR_DICT_TRES].count) ||
+        !cards_ok(cols->card, cols->rows, hdr->dicts[GR_DICT_CARD].count) ||
+        !groups_ok(cols->groups, parts, cols->rows, cols->partition)) {
+        gr_error("%s has codes outside its dictionaries", path);
+        gr_columns_unmap(cols);
+        return NULL;
+    }
+    return cols;
+
+fail:
+    if (fd >= 0)
+        close(fd);
+    free(cols);
+    return NULL;
+}
+
+void gr_columns_unmap(gr_columns_t *cols) {
+    if (cols == NULL)
+        return;
+    munmap((void *) cols->hdr, cols->map_size);
+    free(cols);
+}
+
+uint32_t gr_columns_dict_size(const gr_columns_t *cols, enum gr_dict dict) {
+    return cols->hdr->dicts[dict].count;
+}
+
+const char *gr_columns_string(const gr_columns_t *cols, enum gr_dict dict,
+                              uint32_t code) {
+    const struct gr_cols_dict *d = &cols->hdr->dicts[dict];
+    const char *base = (const char *) cols->hdr;
+
+    if (code >= d->count)
+        return NULL;
+    const uint32_t *offsets = (const uint32_t *) (base + d->offsets.offset);
+    const char *s = base + d->strings.offset + offsets[code];
+    return *s ? s : NULL;
+}
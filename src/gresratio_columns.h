@@ -0,0 +1,132 @@
+// gresratio_columns.h
+
+/*
+ * Column files: job requests stored column by column for the offline tools,
+ * written by ratio-columns from squeue or sacct output and mapped read only
+ * by ratio-replay, so a question about a year of jobs does not parse a
+ * year of text again.
+ *
+ * A file is a header, then every column and dictionary in its own section,
+ * 64 byte aligned so the columns can be handed to gr_evaluate_batch() in
+ * place. Requests are stored already in per node shape (gr_job_shape()):
+ * CPUs and GPUs per node, and the one GPU type they ask for as a card code.
+ * Requests that are not a plain single type GPU request (no GRES, several
+ * types, other resources only) get GR_COLS_NO_CARD and are evaluated from
+ * their TRES string instead.
+ *
+ * User, account, partition, TRES and card are dictionary codes into the
+ * string table of their column, in order of first appearance; the empty
+ * string stands for not set. Rows are grouped by partition code, in input
+ * order within a partition, and the partition section holds each group's
+ * first row, so a tool walks one policy at a time.
+ */
+
+#ifndef GRESRATIO_COLUMNS_H
+#define GRESRATIO_COLUMNS_H
+
+#include <stdint.h>
+
+#include "gresratio.h"
+
+#define GR_COLS_MAGIC "GRCOLS1"
+#define GR_COLS_VERSION 1
+#define GR_COLS_ALIGN 64
+#define GR_COLS_NO_CARD 0xffff // card code of requests checked by TRES
+
+/* Columns, the element type in the comment. */
+enum gr_col {
+    GR_COL_JOBID,     // uint64_t, 0 if not a number
+    GR_COL_USER,      // uint32_t code
+    GR_COL_ACCOUNT,   // uint32_t code
+    GR_COL_PARTITION, // uint16_t code
+    GR_COL_TRES,      // uint32_t code, GPUs per node as gr_job_shape() wrote them
+    GR_COL_CARD,      // uint16_t code, GR_COLS_NO_CARD, "" for gpu:N
+    GR_COL_GPUS,      // uint32_t per node
+    GR_COL_CPUS,      // uint32_t per node
+    GR_NUM_COLS,
+};
+
+/* Dictionaries, by the column they belong to. */
+enum gr_dict {
+    GR_DICT_USER,
+    GR_DICT_ACCOUNT,
+    GR_DICT_PARTITION,
+    GR_DICT_TRES,
+    GR_DICT_CARD,
+    GR_NUM_DICTS,
+};
+
+/* Bytes [offset, offset + size) of the file. */
+struct gr_cols_section {
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct gr_cols_dict {
+    uint32_t count;
+    uint32_t reserved;
+    struct gr_cols_section offsets; // uint32_t per code, into strings
+    struct gr_cols_section strings; // NUL terminated
+};
+
+struct gr_cols_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t rows;
+    struct gr_cols_section columns[GR_NUM_COLS];
+    struct gr_cols_dict dicts[GR_NUM_DICTS];
+    struct gr_cols_section groups; // uint64_t first row per partition code, and rows
+};
+
+/* A column file mapped read only; the arrays point into the mapping. */
+typedef struct {
+    uint64_t rows;
+    const uint64_t *jobid;
+    const uint32_t *user;
+    const uint32_t *account;
+    const uint16_t *partition;
+    const uint32_t *tres;
+    const uint16_t *card;
+    const uint32_t *gpus;
+    const uint32_t *cpus;
+    const uint64_t *groups; // dict_size(GR_DICT_PARTITION) + 1 entries
+    const struct gr_cols_header *hdr;
+    size_t map_size;
+} gr_columns_t;
+
+/* Maps a column file, NULL (after logging why) if it is not one. */
+gr_columns_t *gr_columns_map(const char *path);
+void gr_columns_unmap(gr_columns_t *cols);
+
+/* True if path starts like a column file, for tools that take both. */
+int gr_columns_probe(const char *path);
+
+uint32_t gr_columns_dict_size(const gr_columns_t *cols, enum gr_dict dict);
+
+/* The string of a code, NULL for the empty string (not set). */
+const char *gr_columns_string(const gr_columns_t *cols, enum gr_dict dict,
+                              uint32_t code);
+
+/* Builds a column file in memory. */
+typedef struct gr_columns_writer gr_columns_writer_t;
+
+/* One job as read from squeue or sacct; strings may be NULL. */
+typedef struct {
+    uint64_t jobid;
+    const char *user;
+    const char *account;
+    const char *partition;
+    gr_job_t job;
+} gr_columns_row_t;
+
+gr_columns_writer_t *gr_columns_writer(void);
+void gr_columns_writer_free(gr_columns_writer_t *w);
+
+/* Shapes the job and appends it. Returns 0 or -1 when out of memory. */
+int gr_columns_add(gr_columns_writer_t *w, const gr_columns_row_t *row);
+
+/* Writes the file, grouping rows by partition. Returns 0 or -1. */
+int gr_columns_write(gr_columns_writer_t *w, const char *path);
+
+#endif
@@ -0,0 +1,204 @@
+// gresratio_exempt.c
+
+/*
+ * Users, accounts, QOS and reservations the ratio does not apply to. UIDs
+ * go into a bitmap as dense as the largest listed UID allows, names into
+ * the same open addressing index the cards use, so the per job check is a
+ * bit test and at most three hashed lookups, all skipped when nothing is
+ * exempt.
+ */
+
+#include <errno.h>
+#include <pwd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gresratio_internal.h"
+
+/* UIDs past this go to the sorted overflow list instead of the bitmap. */
+#define MAX_BITMAP_UID (1u << 22)
+#define MAX_PW_BUF (1 << 20) // getpwnam_r buffer, doubled on ERANGE up to this
+
+static int add_uid(struct gr_exempt *ex, uint32_t uid) {
+    if (uid < MAX_BITMAP_UID) {
+        uint32_t words = uid / 64 + 1;
+        if (words > ex->uid_words) {
+            uint64_t *bits = realloc(ex->uid_bits, words * sizeof(*bits));
+            if (bits == NULL)
+                return -1;
+            memset(bits + ex->uid_words, 0,
+                   (words - ex->uid_words) * sizeof(*bits));
+            ex->uid_bits = bits;
+            ex->uid_words = words;
+        }
+        ex->uid_bits[uid / 64] |= 1ull << (uid % 64);
+        return 0;
+    }
+
+    int i = ex->num_big_uids;
+    uint32_t *big = realloc(ex->big_uids, (i + 1) * sizeof(*big));
+    if (big == NULL)
+        return -1;
+    for (; i > 0 && big[i - 1] > uid; i--)
+        big[i] = big[i - 1];
+    big[i] = uid;
+    ex->big_uids = big;
+    ex->num_big_uids++;
+    return 0;
+}
+
+/*
+ * A UID or a user name, resolved once here rather than per job. Large
+ * passwd or LDAP entries do not fit the suggested buffer, so it grows.
+ */
+static int add_user(struct gr_exempt *ex, gr_slice_t name) {
+    char buf[256], *pwbuf = NULL;
+    struct passwd pw, *found = NULL;
+    long size = sysconf(_SC_GETPW_R_SIZE_MAX);
+    uint64_t uid = 0;
+    size_t i;
+    int rc;
+
+    for (i = 0; i < name.len && name.ptr[i] >= '0' && name.ptr[i] <= '9'; i++)
+        uid = uid * 10 + (name.ptr[i] - '0');
+    if (i == name.len && i > 0 && i <= 10) {
+        if (uid > UINT32_MAX - 2) // NO_VAL and INFINITE are never users
+            return -1;
+        return add_uid(ex, uid);
+    }
+
+    if (name.len >= sizeof(buf))
+        return -1;
+    memcpy(buf, name.ptr, name.len);
+    buf[name.len] = '\0';
+    if (size <= 0)
+        size = 1024;
+    do {
+        char *grown = realloc(pwbuf, size);
+        if (grown == NULL) {
+            free(pwbuf);
+            return -1;
+        }
+        pwbuf = grown;
+        rc = getpwnam_r(buf, &pw, pwbuf, size, &found);
+        size *= 2;
+    } while (rc == ERANGE && size <= MAX_PW_BUF);
+    free(pwbuf);
+    if (rc != 0) {
+        gr_error("cannot look up user %s in exempt_users: %s, ignored", buf,
+                 strerror(rc));
+        return 0;
+    }
+    if (found == NULL) {
+        gr_info("unknown user %s in exempt_users, ignored", buf);
+        return 0;
+    }
+    return add_uid(ex, pw.pw_uid);
+}
+
+static int add_name(struct gr_name_set *set, gr_slice_t name) {
+    if (gr_index_lookup(&set->index, name.ptr, name.len) >= 0)
+        return 0;
+
+    char **names = realloc(set->names, (set->num + 1) * sizeof(*names));
+    if (names == NULL)
+        return -1;
+    set->names = names;
+    if ((names[set->num] = strndup(name.ptr, name.len)) == NULL)
+        return -1;
+    if (gr_index_insert(&set->index, names[set->num], set->num)) {
+        free(names[set->num]);
+        return -1;
+    }
+    set->num++;
+    return 0;
+}
+
+struct exempt_arg {
+    struct gr_exempt *ex;
+    enum gr_exempt_kind kind;
+};
+
+static int add_exempt(gr_slice_t name, void *arg) {
+    struct exempt_arg *a = arg;
+    int rc;
+
+    if (name.len == 0)
+        return -1;
+    switch (a->kind) {
+    case GR_EXEMPT_USERS:
+        rc = add_user(a->ex, name);
+        break;
+    case GR_EXEMPT_ACCOUNTS:
+        rc = add_name(&a->ex->accounts, name);
+        break;
+    case GR_EXEMPT_QOS:
+        rc = add_name(&a->ex->qos, name);
+        break;
+    default:
+        rc = add_name(&a->ex->reservations, name);
+        break;
+    }
+    if (rc == 0)
+        a->ex->any = true;
+    return rc;
+}
+
+int gr_exempt_add(struct gr_exempt *ex, enum gr_exempt_kind kind,
+                  gr_slice_t list) {
+    struct exempt_arg arg = { ex, kind };
+
+    /* Slurm folds account and QOS names to lower case, not reservations. */
+    ex->accounts.index.fold = true;
+    ex->qos.index.fold = true;
+    return gr_list_each(list, add_exempt, &arg);
+}
+
+static void free_set(struct gr_name_set *set) {
+    for (int i = 0; i < set->num; i++)
+        free(set->names[i]);
+    free(set->names);
+    free(set->index.slots);
+}
+
+void gr_exempt_free(struct gr_exempt *ex) {
+    free(ex->uid_bits);
+    free(ex->big_uids);
+    free_set(&ex->accounts);
+    free_set(&ex->qos);
+    free_set(&ex->reservations);
+}
+
+static bool big_uid(const struct gr_exempt *ex, uint32_t uid) {
+    int lo = 0, hi = ex->num_big_uids;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (ex->big_uids[mid] < uid)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < ex->num_big_uids && ex->big_uids[lo] == uid;
+}
+
+static bool in_set(const struct gr_name_set *set, const char *name) {
+    return name && set->num && gr_index_lookup(&set->index, name,
+                                               strlen(name)) >= 0;
+}
+
+bool gr_exempt(const gr_config_t *cfg, uint32_t uid, const char *account,
+               const char *qos, const char *reservation) {
+    const struct gr_exempt *ex;
+
+    if (cfg == NULL || !(ex = &cfg->exempt)->any)
+        return false;
+    if (uid / 64 < ex->uid_words) {
+        if (ex->uid_bits[uid / 64] & 1ull << (uid % 64))
+            return true;
+    } else if (ex->num_big_uids && big_uid(ex, uid)) {
+        return true;
+    }
+    return in_set(&ex->accounts, account) || in_set(&ex->qos, qos) ||
+           in_set(&ex->reservations, reservation);
+}
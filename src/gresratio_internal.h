@@ -0,0 +1,230 @@
+// gresratio_internal.h
+
+/*
+ * Snapshot layout and helpers shared by the libgresratio sources. Not part
+ * of the public API in gresratio.h.
+ */
+
+#ifndef GRESRATIO_INTERNAL_H
+#define GRESRATIO_INTERNAL_H
+
+#include "gresratio.h"
+#include "gresratio_lexer.h"
+
+/* GPU counts whose accepted CPU count is precomputed per card. */
+#define GR_TABLE_GPUS 16
+/* CPU counts whose closest accepted request is precomputed per card. */
+#define GR_TABLE_CPUS 256
+/* Bounds and default of trace_size. */
+#define GR_TRACE_MIN_SIZE (64 << 10)
+#define GR_TRACE_MAX_SIZE (16ull << 30)
+#define GR_TRACE_DEFAULT_SIZE (64 << 20)
+
+/* How gpu:N requests without a card type are checked. */
+enum gr_untyped {
+    GR_UNTYPED_DEFAULT,   // as default_card
+    GR_UNTYPED_STRICTEST, // as the partition card needing the most CPUs per GPU
+    GR_UNTYPED_LENIENT,   // as the partition card needing the fewest
+};
+
+/* Card data structure, the index into entries is the card id. */
+struct card {
+    char *name; // as written in the config
+    gr_ratio_t ratio; // ratio under [gresratio], num 0 if only set per partition
+};
+
+/* card.* line from a [gresratio.<partition>] section. */
+struct card_override {
+    int id;
+    gr_ratio_t ratio;
+};
+
+/* Message text preformatted at load, rejections only copy it. */
+struct msg_text {
+    char *text;
+    size_t len;
+};
+
+/* Ratio policy of one enforced partition. */
+struct partition_policy {
+    char *name;
+    char *default_card; // NULL to use the [gresratio] default_card
+    int default_id;
+    gr_ratio_t *ratios; // indexed by card id, num 0 if the card has no ratio here
+    uint32_t *accept; // [id * GR_TABLE_GPUS + gpus - 1]: the one accepted ncpu, 0 if none
+    int num_overrides; // overrides are folded into ratios at load
+    struct card_override *overrides;
+    struct msg_text no_gres; // rejection messages of this partition
+    struct msg_text bad_gres;
+    struct msg_text mixed_gres; // bad_gres of mixed cards without enforce_ratio
+    struct msg_text *ratio_tails; // per card id, text after the job's ratio
+    struct msg_text *hints; // per card id, start of the suggestion line
+    uint16_t *nearest; // [id * GR_TABLE_CPUS + ncpu - 1]: GPUs of the accepted request closest to ncpu CPUs, 0 if none
+    int enforce_ratio; // weigh mixed card requests, -1 to inherit [gresratio]
+    int untyped; // enum gr_untyped for gpu:N requests, -1 to inherit
+    int untyped_id; // card checked for gpu:N requests
+    uint64_t *cards; // bitset of card ids on the partition's nodes, or NULL
+    gr_ratio_t *derived; // per card id, CPUs per GPU of its nodes, load only
+    uint64_t scale; // lcm of the ratio denominators of this partition
+    uint64_t *weights; // per card id, CPUs per GPU * scale
+};
+
+/* Slot of a name index, id 0 marks an empty slot. */
+struct name_slot {
+    uint32_t hash;
+    uint32_t id; // index + 1
+    const char *name; // owned by the indexed table
+};
+
+/* Open addressing name -> index map, kept at most half full. */
+struct name_index {
+    uint32_t mask; // number of slots - 1, slots is a power of two
+    uint32_t count;
+    bool fold; // compare names ASCII case insensitively
+    struct name_slot *slots;
+};
+
+/* Names of one exempt_* key, the index points into names. */
+struct gr_name_set {
+    struct name_index index;
+    char **names;
+    int num;
+};
+
+/* Who the ratio does not apply to, see gr_exempt(). */
+struct gr_exempt {
+    bool any; // false skips every lookup
+    uint32_t uid_words;
+    uint64_t *uid_bits; // bit per UID below uid_words * 64
+    int num_big_uids;
+    uint32_t *big_uids; // sorted, UIDs too large for the bitmap
+    struct gr_name_set accounts;
+    struct gr_name_set qos;
+    struct gr_name_set reservations;
+};
+
+enum gr_exempt_kind {
+    GR_EXEMPT_USERS,
+    GR_EXEMPT_ACCOUNTS,
+    GR_EXEMPT_QOS,
+    GR_EXEMPT_RESERVATIONS,
+};
+
+/*
+ * Parsed configuration. A snapshot is never modified once published, a
+ * reload builds a new one and swaps it in.
+ */
+struct gr_config {
+    uint64_t generation; // unique per loaded snapshot, keys the decision cache
+    int disabled; // defaults to false or 0 or enabled
+    bool enforce_ratio; // default for partitions, true unless set false
+    int untyped; // default for partitions, see partition_policy
+    gr_mode_t mode; // what the plugin does with jobs off the ratio
+    char *node_inventory; // slurm.conf or scontrol show nodes dump, or NULL
+    bool derive_ratios; // ratios of cards without card.* come from the nodes
+    char *default_card;
+    int num_entries;
+    int max_entries;
+    struct card *entries;
+    struct name_index card_index; // card name -> card id
+    int num_parts;
+    int max_parts;
+    struct partition_policy *parts;
+    struct name_index part_index; // partition name -> parts index
+    struct gr_exempt exempt;
+    char *stats_segment; // shared memory name, NULL to publish no stats
+    uint8_t *stats_parts; // per parts index, its stats slot
+    uint8_t *stats_cards; // per card id, its stats slot
+    char *trace_file; // ring file jobs are traced to, NULL for none
+    uint64_t trace_size; // bytes of the ring, a power of two
+    uint64_t trace_salt; // keys the uid hash of traced jobs
+};
+
+extern gr_log_fn gr_info_fn;
+extern gr_log_fn gr_error_fn;
+extern gr_log_fn gr_debug_fn;
+
+#define gr_info(fmt, ...)                                               \
+    do {                                                                \
+        if (gr_info_fn)                                                 \
+            gr_info_fn("%s: " fmt, gr_log_name, ##__VA_ARGS__);         \
+    } while (0)
+
+#define gr_error(fmt, ...)                                              \
+    do {                                                                \
+        if (gr_error_fn)                                                \
+            gr_error_fn("%s: " fmt, gr_log_name, ##__VA_ARGS__);        \
+    } while (0)
+
+/* Per job details on the submit path, a NULL test when off. */
+#define gr_debug(fmt, ...)                                              \
+    do {                                                                \
+        if (gr_debug_fn)                                                \
+            gr_debug_fn("%s: " fmt, gr_log_name, ##__VA_ARGS__);        \
+    } while (0)
+
+/* Returns the index stored for name, or -1 if it is not in the map. */
+int gr_index_lookup(const struct name_index *idx, const char *name,
+                    size_t len);
+
+/* Returns the id of a card, interning its name on first use, or -1. */
+int gr_intern_card(struct gr_config *cfg, gr_slice_t name);
+
+/* Adds a name that is not in the map yet, name must outlive the map. */
+int gr_index_insert(struct name_index *idx, const char *name, int id);
+
+/* Called for each name of a list value, see gr_list_each(). */
+typedef int (*gr_name_fn)(gr_slice_t name, void *arg);
+
+/*
+ * Calls fn for every name of a list value: a, "a, b" or ["a", "b"], with
+ * blanks and quotes trimmed. Returns -1 as soon as fn does.
+ */
+int gr_list_each(gr_slice_t list, gr_name_fn fn, void *arg);
+
+/* Adds the names or UIDs of an exempt_* list value. Returns 0 or -1. */
+int gr_exempt_add(struct gr_exempt *ex, enum gr_exempt_kind kind,
+                  gr_slice_t list);
+void gr_exempt_free(struct gr_exempt *ex);
+
+/* Called for each host of a hostlist, host is not NUL terminated. */
+typedef int (*gr_host_fn)(const char *host, size_t len, void *arg);
+
+/* Hosts one hostlist may expand to, far past any real cluster. */
+#define GR_MAX_HOSTLIST (1 << 20)
+
+/*
+ * Calls fn for every host of a Slurm hostlist such as
+ * "n[0001-0003,0007].es1,gpu1". Returns -1 on a malformed list, one of
+ * more than GR_MAX_HOSTLIST hosts, or as soon as fn does.
+ */
+int gr_hostlist_expand(gr_slice_t list, gr_host_fn fn, void *arg);
+
+/*
+ * Reads a node inventory and fills the card bitset of every partition
+ * policy, and with cfg->derive_ratios its derived ratios, interning the
+ * cards it finds. Runs before the policy ratio tables are built. Returns 0
+ * or -1.
+ */
+int gr_inventory_load(struct gr_config *cfg, const char *filename);
+
+/*
+ * Creates the stats segment the first time a config names one and fills
+ * the stats slots of cfg. Called before cfg is published. Returns 0 or -1,
+ * in which case cfg is still usable but counted in slot 0.
+ */
+int gr_stats_attach(struct gr_config *cfg);
+void gr_stats_close(void);
+void gr_stats_cache(bool hit);
+
+/*
+ * Opens the trace file the first time a config names one, called before
+ * cfg is published like gr_stats_attach(). Returns 0 or -1.
+ */
+int gr_trace_attach(const struct gr_config *cfg);
+void gr_trace_close(void);
+
+/* Reads a whole file into a NUL terminated malloc'd buffer, logs failures. */
+char *gr_read_file(const char *filename, size_t *len);
+
+#endif
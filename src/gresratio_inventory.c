@@ -0,0 +1,572 @@
+// gresratio_inventory.c
+
+/*
+ * Node inventory for libgresratio: which GPU cards each enforced partition
+ * has, so that untyped gpu:N requests can be checked against the cards the
+ * job could actually land on, and with derive_ratios how many cores per GPU
+ * those nodes have.
+ *
+ * The inventory is either slurm.conf (NodeName= and PartitionName= lines)
+ * or a saved `scontrol show nodes` dump (NodeName= records listing their
+ * Partitions=). Both are read as one stream of Key=Value tokens. A record
+ * runs from its NodeName=/PartitionName= token until a blank line or a line
+ * starting in the first column: slurm.conf records are single (possibly
+ * \-continued) lines, scontrol indents the continuation of a record.
+ *
+ * Every NodeName record becomes one node group holding its cores and cards,
+ * hosts only map to their group. A n[0001-5000] line is one group and 5000
+ * hash inserts, partitions are resolved per group. Only runs at config load.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "gresratio_internal.h"
+#include "gresratio_tres.h"
+
+#define MAX_HOSTNAME 256
+#define TOO_MANY_HOSTS (-2) // from expand_host(), past GR_MAX_HOSTLIST
+#define ARENA_SIZE 65536 // bytes of host names per arena block
+
+enum record_kind { REC_NONE, REC_NODE, REC_PARTITION };
+
+/* Key=Value tokens of the record being read, slices into the buffer. */
+struct record {
+    enum record_kind kind;
+    gr_slice_t name;  // NodeName or PartitionName value
+    gr_slice_t gres;  // Gres
+    gr_slice_t nodes; // Nodes, partitions only
+    gr_slice_t parts; // Partitions, scontrol dump only
+    bool has_gres;
+    uint32_t cpus;    // CPUs or CPUTot, 0 when not given as the counts below
+    uint32_t sockets;
+    uint32_t cores;   // CoresPerSocket
+    uint32_t threads; // ThreadsPerCore
+};
+
+/* GPUs of one card on each node of a group. */
+struct group_card {
+    int id;
+    uint32_t count;
+};
+
+/* Hardware shared by the hosts of one NodeName record. */
+struct node_group {
+    uint32_t cores;
+    uint32_t gpus;  // of all cards, typed or not
+    int first_card; // into inventory.cards
+    int num_cards;
+    int stamp;      // policy index + 1 the group was last added to
+};
+
+/* Partition membership, resolved once every node is known. */
+struct pending_part {
+    int policy;
+    int group;        // from a node's Partitions=, -1 for a Nodes= list
+    gr_slice_t nodes;
+};
+
+/* Host names are carved out of blocks that never move. */
+struct arena {
+    struct arena *next;
+    size_t used;
+    char data[ARENA_SIZE];
+};
+
+/* Inventory being loaded. */
+struct inventory {
+    struct gr_config *cfg;
+    const char *filename;
+    int num_groups;
+    int max_groups;
+    struct node_group *groups;
+    int num_cards;
+    int max_cards;
+    struct group_card *cards;
+    struct name_index node_index; // host name -> group
+    struct arena *arena;
+    int num_nodes;
+    struct record defaults;   // NodeName=DEFAULT
+    int num_pending;
+    int max_pending;
+    struct pending_part *pending;
+    int group;                // group of the hosts being expanded
+    int policy;               // partition being resolved
+    unsigned unknown_nodes;
+    unsigned mixed_cores;     // nodes of a card disagreeing on cores per GPU
+};
+
+/* Writes n zero padded to width digits, returns the number written. */
+static int format_number(char *p, unsigned long n, int width) {
+    char digits[20];
+    int len = 0;
+
+    do {
+        digits[len++] = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    while (len < width)
+        digits[len++] = '0';
+    for (int i = 0; i < len; i++)
+        p[i] = digits[len - 1 - i];
+    return len;
+}
+
+/* Parses the digits in [p, end), -1 if empty, too long or not a number. */
+static int parse_number(const char *p, const char *end, unsigned long *out) {
+    unsigned long n = 0;
+
+    if (p == end || end - p > 18)
+        return -1;
+    for (; p < end; p++) {
+        if (*p < '0' || *p > '9')
+            return -1;
+        n = n * 10 + (*p - '0');
+    }
+    *out = n;
+    return 0;
+}
+
+/*
+ * Expands one host expression of a hostlist into buf after len bytes,
+ * counting the hosts against *left. Returns 0, -1 or TOO_MANY_HOSTS.
+ */
+static int expand_host(char *buf, size_t len, const char *p, const char *end,
+                       gr_host_fn fn, void *arg, unsigned long *left) {
+    const char *open = memchr(p, '[', end - p);
+    size_t head = open ? (size_t) (open - p) : (size_t) (end - p);
+
+    if (len + head >= MAX_HOSTNAME)
+        return -1;
+    memcpy(buf + len, p, head);
+    len += head;
+    if (open == NULL) {
+        if (*left == 0)
+            return TOO_MANY_HOSTS;
+        --*left;
+        return fn(buf, len, arg);
+    }
+
+    const char *close = memchr(open, ']', end - open);
+    if (close == NULL)
+        return -1;
+
+    for (const char *r = open + 1; r < close;) {
+        const char *comma = memchr(r, ',', close - r);
+        const char *stop = comma ? comma : close;
+        const char *dash = memchr(r, '-', stop - r);
+        const char *lo_end = dash ? dash : stop;
+        unsigned long lo, hi;
+        int width = lo_end - r;
+
+        if (parse_number(r, lo_end, &lo))
+            return -1;
+        hi = lo;
+        if (dash && (parse_number(dash + 1, stop, &hi) || hi < lo))
+            return -1;
+        if (hi - lo >= *left)
+            return TOO_MANY_HOSTS; // every number is at least one host
+        if (len + 20 >= MAX_HOSTNAME)
+            return -1;
+
+        /* Only the digits are rewritten, the prefix stays in buf. */
+        for (unsigned long n = lo; n <= hi; n++) {
+            int w = format_number(buf + len, n, width);
+            int rc = expand_host(buf, len + w, close + 1, end, fn, arg, left);
+            if (rc)
+                return rc;
+        }
+        r = comma ? comma + 1 : close;
+    }
+    return 0;
+}
+
+/*
+ * Several bracket groups ("r[1-2]n[01-02]") expand left to right and the
+ * zero padding of a range start is kept. The host count is capped so a
+ * range like n[0-4294967295] fails at once instead of stalling a reload.
+ */
+int gr_hostlist_expand(gr_slice_t list, gr_host_fn fn, void *arg) {
+    char buf[MAX_HOSTNAME];
+    const char *p = list.ptr, *end = list.ptr + list.len;
+    unsigned long left = GR_MAX_HOSTLIST;
+
+    while (p < end) {
+        /* Hosts are split at commas outside of brackets. */
+        const char *q = p;
+        int depth = 0;
+        for (; q < end && (depth || *q != ','); q++) {
+            if (*q == '[')
+                depth++;
+            else if (*q == ']' && --depth < 0)
+                return -1;
+        }
+        if (depth)
+            return -1;
+        int rc = q > p ? expand_host(buf, 0, p, q, fn, arg, &left) : 0;
+        if (rc == TOO_MANY_HOSTS)
+            gr_error("hostlist %.*s has more than %d hosts", (int) list.len,
+                     list.ptr, GR_MAX_HOSTLIST);
+        if (rc)
+            return -1;
+        p = q + 1;
+    }
+    return 0;
+}
+
+/* Makes room in *array for element count, doubling *max as needed. */
+static int grow(void *array, int *max, int count, size_t size) {
+    if (count < *max)
+        return 0;
+    int n = *max ? *max * 2 : 16;
+    void *p = realloc(*(void **) array, n * size);
+    if (p == NULL)
+        return -1;
+    *(void **) array = p;
+    *max = n;
+    return 0;
+}
+
+static char *arena_strndup(struct inventory *inv, const char *s, size_t len) {
+    struct arena *a = inv->arena;
+
+    if (a == NULL || a->used + len + 1 > ARENA_SIZE) {
+        if ((a = malloc(sizeof(*a))) == NULL)
+            return NULL;
+        a->next = inv->arena;
+        a->used = 0;
+        inv->arena = a;
+    }
+    char *copy = a->data + a->used;
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    a->used += len + 1;
+    return copy;
+}
+
+static uint32_t or_default(uint32_t value, uint32_t fallback) {
+    return value ? value : fallback;
+}
+
+/*
+ * Cores of a node: CPUs / ThreadsPerCore when the CPU count is known,
+ * Sockets * CoresPerSocket otherwise. A record giving its own layout does
+ * not inherit the NodeName=DEFAULT CPU count.
+ */
+static uint32_t node_cores(const struct record *rec,
+                           const struct record *def) {
+    uint32_t threads = or_default(rec->threads, or_default(def->threads, 1));
+    uint32_t cpus = rec->cpus;
+
+    if (cpus == 0 && rec->sockets == 0 && rec->cores == 0)
+        cpus = def->cpus;
+    if (cpus)
+        return cpus >= threads ? cpus / threads : cpus;
+    return or_default(rec->sockets, or_default(def->sockets, 1)) *
+           or_default(rec->cores, or_default(def->cores, 1));
+}
+
+/*
+ * Creates the group of a NodeName record. Cards are interned when ratios
+ * are derived, otherwise cards the config has no ratio for are skipped.
+ */
+static int add_group(struct inventory *inv, const struct record *rec) {
+    gr_slice_t gres = rec->has_gres ? rec->gres : inv->defaults.gres;
+    gr_tres_iter_t it = { gres.ptr, gres.ptr + gres.len };
+    gr_tres_t tres;
+
+    if (grow(&inv->groups, &inv->max_groups, inv->num_groups,
+             sizeof(*inv->groups)))
+        return -1;
+    struct node_group *g = &inv->groups[inv->num_groups];
+    *g = (struct node_group) {
+        .cores = node_cores(rec, &inv->defaults),
+        .first_card = inv->num_cards,
+    };
+
+    while (gr_tres_next(&it, &tres) > 0) {
+        if (!gr_slice_eq(tres.name, "gpu"))
+            continue;
+        g->gpus += tres.count;
+        if (tres.type.len == 0)
+            continue;
+        int id = inv->cfg->derive_ratios ?
+            gr_intern_card(inv->cfg, tres.type) :
+            gr_index_lookup(&inv->cfg->card_index, tres.type.ptr,
+                            tres.type.len);
+        if (id < 0) {
+            if (inv->cfg->derive_ratios)
+                return -1;
+            continue;
+        }
+        if (grow(&inv->cards, &inv->max_cards, inv->num_cards,
+                 sizeof(*inv->cards)))
+            return -1;
+        inv->cards[inv->num_cards++] = (struct group_card) { id, tres.count };
+        g->num_cards++;
+    }
+    return inv->num_groups++;
+}
+
+/* Maps a host to the current group, the first NodeName line of a host wins. */
+static int add_node(const char *host, size_t len, void *arg) {
+    struct inventory *inv = arg;
+
+    if (gr_index_lookup(&inv->node_index, host, len) >= 0)
+        return 0;
+    char *name = arena_strndup(inv, host, len);
+    if (name == NULL || gr_index_insert(&inv->node_index, name, inv->group))
+        return -1;
+    inv->num_nodes++;
+    return 0;
+}
+
+static int add_pending(struct inventory *inv, int policy, int group,
+                       gr_slice_t nodes) {
+    if (grow(&inv->pending, &inv->max_pending, inv->num_pending,
+             sizeof(*inv->pending)))
+        return -1;
+    inv->pending[inv->num_pending++] =
+        (struct pending_part) { policy, group, nodes };
+    return 0;
+}
+
+static int end_record(struct inventory *inv, struct record *rec) {
+    enum record_kind kind = rec->kind;
+    rec->kind = REC_NONE;
+
+    if (kind == REC_NODE) {
+        if (gr_slice_caseeq(rec->name, "DEFAULT")) {
+            inv->defaults = *rec;
+            return 0;
+        }
+        if ((inv->group = add_group(inv, rec)) < 0)
+            return -1;
+        if (gr_hostlist_expand(rec->name, add_node, inv)) {
+            gr_error("%s: invalid NodeName=%.*s", inv->filename,
+                     (int) rec->name.len, rec->name.ptr);
+            return -1;
+        }
+
+        const char *p = rec->parts.ptr, *end = p + rec->parts.len;
+        while (p < end) {
+            const char *comma = memchr(p, ',', end - p);
+            const char *stop = comma ? comma : end;
+            int id = gr_index_lookup(&inv->cfg->part_index, p, stop - p);
+            if (id >= 0 && add_pending(inv, id, inv->group, rec->nodes))
+                return -1;
+            p = stop + 1;
+        }
+    } else if (kind == REC_PARTITION) {
+        int id = gr_index_lookup(&inv->cfg->part_index, rec->name.ptr,
+                                 rec->name.len);
+        if (id >= 0 && rec->nodes.len && add_pending(inv, id, -1, rec->nodes))
+            return -1;
+    }
+    return 0;
+}
+
+/* Value of a count field, 0 unless it is a plain number. */
+static uint32_t slice_to_count(gr_slice_t v) {
+    unsigned long n;
+    if (parse_number(v.ptr, v.ptr + v.len, &n) || n > UINT32_MAX)
+        return 0;
+    return n;
+}
+
+/* Walks the Key=Value tokens of the file, see the comment at the top. */
+static int read_records(struct inventory *inv, const char *p,
+                        const char *end) {
+    struct record rec = { .kind = REC_NONE };
+    const char *line = p;
+    bool line_empty = true, continued = false;
+
+    while (p < end) {
+        if (*p == '\n') {
+            if (line_empty && !continued && end_record(inv, &rec))
+                return -1;
+            line = ++p;
+            line_empty = true;
+            continued = false;
+            continue;
+        }
+        if (*p == '\\') {
+            continued = true;
+            p++;
+            continue;
+        }
+        if (*p == ' ' || *p == '\t' || *p == '\r') {
+            p++;
+            continue;
+        }
+        if (*p == '#') {
+            while (p < end && *p != '\n')
+                p++;
+            continue;
+        }
+
+        const char *start = p;
+        bool first_column = start == line && !continued;
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\n' &&
+               *p != '\r')
+            p++;
+        line_empty = false;
+        continued = false;
+
+        const char *eq = memchr(start, '=', p - start);
+        gr_slice_t key = { start, eq ? (size_t) (eq - start) : 0 };
+        gr_slice_t value = { eq ? eq + 1 : p, eq ? (size_t) (p - eq - 1) : 0 };
+        bool node = gr_slice_caseeq(key, "NodeName");
+
+        if (node || gr_slice_caseeq(key, "PartitionName") || first_column) {
+            if (end_record(inv, &rec))
+                return -1;
+            if (node || key.len)
+                rec = (struct record) {
+                    .kind = node ? REC_NODE :
+                        gr_slice_caseeq(key, "PartitionName") ?
+                        REC_PARTITION : REC_NONE,
+                    .name = value,
+                };
+        } else if (gr_slice_caseeq(key, "Gres")) {
+            rec.gres = value;
+            rec.has_gres = true;
+        } else if (gr_slice_caseeq(key, "Nodes")) {
+            rec.nodes = value;
+        } else if (gr_slice_caseeq(key, "Partitions")) {
+            rec.parts = value;
+        } else if (gr_slice_caseeq(key, "CPUs") ||
+                   gr_slice_caseeq(key, "CPUTot")) {
+            rec.cpus = slice_to_count(value);
+        } else if (gr_slice_caseeq(key, "Sockets")) {
+            rec.sockets = slice_to_count(value);
+        } else if (gr_slice_caseeq(key, "CoresPerSocket")) {
+            rec.cores = slice_to_count(value);
+        } else if (gr_slice_caseeq(key, "ThreadsPerCore")) {
+            rec.threads = slice_to_count(value);
+        }
+    }
+    return end_record(inv, &rec);
+}
+
+static uint32_t gcd32(uint32_t a, uint32_t b) {
+    while (b) {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/*
+ * Adds the cards of a group to a partition. A derived ratio is the fewest
+ * cores per GPU of any node with the card, so a job sized by it fits on
+ * every one of them.
+ */
+static void add_group_to_policy(struct inventory *inv, int policy,
+                                int group) {
+    struct partition_policy *pp = &inv->cfg->parts[policy];
+    struct node_group *g = &inv->groups[group];
+
+    if (g->stamp == policy + 1)
+        return;
+    g->stamp = policy + 1;
+
+    for (int i = 0; i < g->num_cards; i++) {
+        int id = inv->cards[g->first_card + i].id;
+        pp->cards[id / 64] |= UINT64_C(1) << (id % 64);
+        if (pp->derived == NULL || g->cores == 0)
+            continue;
+
+        uint32_t d = gcd32(g->cores, g->gpus);
+        gr_ratio_t r = { g->cores / d, g->gpus / d };
+        gr_ratio_t *cur = &pp->derived[id];
+        if (cur->num == 0) {
+            *cur = r;
+        } else if (cur->num != r.num || cur->den != r.den) {
+            inv->mixed_cores++;
+            if ((uint64_t) r.num * cur->den < (uint64_t) cur->num * r.den)
+                *cur = r;
+        }
+    }
+}
+
+static int add_partition_node(const char *host, size_t len, void *arg) {
+    struct inventory *inv = arg;
+    int group = gr_index_lookup(&inv->node_index, host, len);
+
+    if (group < 0)
+        inv->unknown_nodes++;
+    else
+        add_group_to_policy(inv, inv->policy, group);
+    return 0;
+}
+
+static void free_inventory(struct inventory *inv) {
+    while (inv->arena) {
+        struct arena *next = inv->arena->next;
+        free(inv->arena);
+        inv->arena = next;
+    }
+    free(inv->groups);
+    free(inv->cards);
+    free(inv->node_index.slots);
+    free(inv->pending);
+}
+
+int gr_inventory_load(struct gr_config *cfg, const char *filename) {
+    struct inventory inv = { .cfg = cfg, .filename = filename };
+    size_t len = 0;
+    char *buffer = gr_read_file(filename, &len);
+    int rc = -1;
+
+    if (buffer == NULL)
+        return -1;
+    if (read_records(&inv, buffer, buffer + len))
+        goto out;
+
+    /* Every card is interned by now. */
+    size_t words = cfg->num_entries > 0 ? (cfg->num_entries + 63) / 64 : 1;
+    for (int i = 0; i < cfg->num_parts; i++) {
+        struct partition_policy *policy = &cfg->parts[i];
+        free(policy->cards);
+        free(policy->derived);
+        policy->derived = NULL;
+        if ((policy->cards = calloc(words, sizeof(uint64_t))) == NULL)
+            goto out;
+        if (cfg->derive_ratios &&
+            (policy->derived = calloc(words * 64,
+                                      sizeof(gr_ratio_t))) == NULL)
+            goto out;
+    }
+
+    for (int i = 0; i < inv.num_pending; i++) {
+        struct pending_part *pp = &inv.pending[i];
+        inv.policy = pp->policy;
+        if (pp->group >= 0) {
+            add_group_to_policy(&inv, pp->policy, pp->group);
+        } else if (gr_slice_caseeq(pp->nodes, "ALL")) {
+            for (int g = 0; g < inv.num_groups; g++)
+                add_group_to_policy(&inv, pp->policy, g);
+        } else if (gr_hostlist_expand(pp->nodes, add_partition_node, &inv)) {
+            gr_error("%s: invalid Nodes=%.*s", filename, (int) pp->nodes.len,
+                     pp->nodes.ptr);
+            goto out;
+        }
+    }
+    if (inv.unknown_nodes)
+        gr_info("%s: %u partition nodes have no NodeName entry", filename,
+                inv.unknown_nodes);
+    if (inv.mixed_cores)
+        gr_info("%s: nodes of the same card differ in cores per GPU %u "
+                "times, the fewest is used", filename, inv.mixed_cores);
+    gr_info("%s: %d nodes on %d NodeName lines in inventory", filename,
+            inv.num_nodes, inv.num_groups);
+    rc = 0;
+
+out:
+    free_inventory(&inv);
+    free(buffer);
+    return rc;
+}
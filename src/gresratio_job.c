@@ -0,0 +1,179 @@
+// gresratio_job.c
+
+/*
+ * Per node shape of a job request. Slurm hands the plugin a whole job
+ * min_cpus next to GPUs that may be counted per node, per task, per socket
+ * or for the whole job; the card ratios are CPUs per GPU on one node. Both
+ * sides are scaled to whole job counts and divided by the node count once.
+ */
+
+#include <string.h>
+
+#include "gresratio_internal.h"
+#include "gresratio_tres.h"
+
+static inline bool set32(uint32_t v) {
+    return v != 0 && v != GR_NO_VAL;
+}
+
+static inline bool set16(uint16_t v) {
+    return v != 0 && v != GR_NO_VAL16;
+}
+
+static inline uint64_t max64(uint64_t a, uint64_t b) {
+    return a > b ? a : b;
+}
+
+/* CPUs per GPU of --cpus-per-gpu, "gres/gpu:N" as Slurm stores it. */
+static uint64_t cpus_per_gpu(const char *cpus_per_tres) {
+    gr_tres_iter_t it;
+    gr_tres_t tres;
+
+    gr_tres_init(&it, cpus_per_tres);
+    while (gr_tres_next(&it, &tres) > 0)
+        if (gr_slice_eq(tres.name, "gpu"))
+            return tres.count;
+    return 0;
+}
+
+/* Appends s, returns false once buf is full. */
+static bool append(char **p, const char *end, const char *s, size_t len) {
+    if ((size_t) (end - *p) <= len)
+        return false;
+    memcpy(*p, s, len);
+    *p += len;
+    return true;
+}
+
+static bool append_count(char **p, const char *end, uint64_t n) {
+    char digits[20];
+    size_t len = 0;
+
+    do {
+        digits[sizeof(digits) - ++len] = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    return append(p, end, digits + sizeof(digits) - len, len);
+}
+
+/*
+ * Writes the GPU entries of tres, each count * mul / div, as
+ * gpu:<type>:<count> into shape->buf. Returns false if tres has no GPU,
+ * does not parse, does not fit or does not divide.
+ */
+static bool rewrite(gr_shape_t *shape, const char *tres, uint64_t mul,
+                    uint64_t div) {
+    char *p = shape->buf, *end = shape->buf + sizeof(shape->buf);
+    gr_tres_iter_t it;
+    gr_tres_t t;
+    int rc;
+
+    gr_tres_init(&it, tres);
+    while ((rc = gr_tres_next(&it, &t)) > 0) {
+        if (!gr_slice_eq(t.name, "gpu"))
+            continue;
+        if (t.count > UINT32_MAX || mul > UINT32_MAX || t.count * mul % div)
+            return false;
+        uint64_t n = t.count * mul;
+        if ((p > shape->buf && !append(&p, end, ",", 1)) ||
+            !append(&p, end, "gpu:", 4) ||
+            (t.type.len && (!append(&p, end, t.type.ptr, t.type.len) ||
+                            !append(&p, end, ":", 1))) ||
+            !append_count(&p, end, n / div))
+            return false;
+    }
+    if (rc < 0 || p == shape->buf)
+        return false;
+    *p = '\0';
+    return true;
+}
+
+static uint64_t gpu_count(const char *tres) {
+    gr_tres_iter_t it;
+    gr_tres_t t;
+    uint64_t n = 0;
+
+    gr_tres_init(&it, tres);
+    while (gr_tres_next(&it, &t) > 0)
+        if (gr_slice_eq(t.name, "gpu"))
+            n += t.count;
+    return n;
+}
+
+static uint64_t job_nodes(const gr_job_t *job) {
+    return set32(job->min_nodes) ? job->min_nodes : 1;
+}
+
+/* --ntasks, else --ntasks-per-node on each node, else one per node. */
+static uint64_t job_tasks(const gr_job_t *job, uint64_t nodes) {
+    return set32(job->num_tasks) ? job->num_tasks :
+           set16(job->ntasks_per_node) ? job->ntasks_per_node * nodes : nodes;
+}
+
+void gr_job_shape(const gr_job_t *job, gr_shape_t *shape) {
+    uint64_t nodes = job_nodes(job);
+    uint64_t tasks = job_tasks(job, nodes);
+    uint64_t sockets = set16(job->sockets_per_node) ?
+                       job->sockets_per_node : 1;
+
+    /* GPUs of the whole job are count * mul, tres_per_node first as Slurm. */
+    const char *tres = job->tres_per_node;
+    uint64_t mul = nodes;
+    if (tres == NULL && (tres = job->tres_per_job) != NULL)
+        mul = 1;
+    if (tres == NULL && (tres = job->tres_per_task) != NULL)
+        mul = tasks;
+    if (tres == NULL && (tres = job->tres_per_socket) != NULL)
+        mul = sockets * nodes;
+
+    uint64_t per_gpu = job->cpus_per_tres ? cpus_per_gpu(job->cpus_per_tres) : 0;
+    uint64_t cpus = max64(set32(job->min_cpus) ? job->min_cpus : 0,
+                          max64(set16(job->cpus_per_task) ?
+                                tasks * job->cpus_per_task : 0,
+                                set16(job->pn_min_cpus) ?
+                                nodes * job->pn_min_cpus : 0));
+    if (per_gpu && tres) {
+        unsigned __int128 n = (unsigned __int128) per_gpu * gpu_count(tres) *
+                              mul;
+        cpus = n > UINT64_MAX / 2 ? UINT64_MAX / 2 : (uint64_t) n;
+    }
+
+    shape->tres = tres;
+    shape->nodes = 1;
+    if (tres == job->tres_per_node && nodes == 1 && per_gpu == 0) {
+        // The common case: nothing to rewrite
+        shape->cpus = cpus > UINT32_MAX ? UINT32_MAX : cpus;
+        return;
+    }
+
+    if (tres && cpus % nodes == 0 && rewrite(shape, tres, mul, nodes)) {
+        shape->tres = shape->buf;
+        shape->nodes = nodes;
+        cpus /= nodes;
+    } else if (tres && rewrite(shape, tres, mul, 1)) {
+        shape->tres = shape->buf;
+    }
+    shape->cpus = cpus > UINT32_MAX ? UINT32_MAX : cpus;
+}
+
+int gr_job_adjust(const gr_job_t *job, const gr_shape_t *shape, uint32_t cpus,
+                  gr_job_cpus_t *out) {
+    uint64_t nodes = job_nodes(job);
+    uint64_t total = (uint64_t) cpus * shape->nodes;
+
+    if (total > UINT32_MAX - 1 ||
+        (set16(job->cpus_per_task) &&
+         job_tasks(job, nodes) * job->cpus_per_task > total) ||
+        (set16(job->pn_min_cpus) && nodes * job->pn_min_cpus > total))
+        return -1;
+
+    out->min_cpus = total;
+    out->cpus_per_gpu = 0;
+    if (job->cpus_per_tres && cpus_per_gpu(job->cpus_per_tres)) {
+        uint64_t gpus = gpu_count(shape->tres);
+        if (gpus == 0 || cpus % gpus)
+            return -1;
+        out->cpus_per_gpu = cpus / gpus;
+    }
+    return 0;
+}
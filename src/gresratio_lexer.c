@@ -0,0 +1,159 @@
+// gresratio_lexer.c
+
+/*
+ * Hand written lexer for job_submit_ratio_config.toml. It walks the buffer
+ * once and never allocates; see gresratio_lexer.h for the interface.
+ */
+
+#include <string.h>
+#include <strings.h>
+
+#include "gresratio_lexer.h"
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static bool is_key_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+           (c >= '0' && c <= '9') || c == '_' || c == '-' || c == '.';
+}
+
+static const char *skip_space(const char *p, const char *end) {
+    while (p < end && is_space(*p))
+        p++;
+    return p;
+}
+
+/* True if only whitespace or a comment is left on the line. */
+static bool at_line_end(const char *p, const char *end) {
+    p = skip_space(p, end);
+    return p == end || *p == '#';
+}
+
+void gr_lexer_init(gr_lexer_t *lx, const char *buf, size_t len) {
+    lx->cur = buf;
+    lx->end = buf + len;
+    lx->section.ptr = buf;
+    lx->section.len = 0;
+    lx->line = 0;
+}
+
+int gr_lexer_next(gr_lexer_t *lx, gr_kv_t *kv) {
+    while (lx->cur < lx->end) {
+        const char *eol = memchr(lx->cur, '\n', lx->end - lx->cur);
+        if (eol == NULL)
+            eol = lx->end;
+        const char *p = skip_space(lx->cur, eol);
+        lx->cur = eol < lx->end ? eol + 1 : eol;
+        lx->line++;
+
+        if (p == eol || *p == '#')
+            continue;
+
+        /* [section] or [[array of tables]] header */
+        if (*p == '[') {
+            bool array = p + 1 < eol && p[1] == '[';
+            p = skip_space(p + 1 + array, eol);
+            const char *name = p;
+            while (p < eol && is_key_char(*p))
+                p++;
+            const char *name_end = p;
+            p = skip_space(p, eol);
+            if (name == name_end || p == eol || *p != ']')
+                return -1;
+            if (array && (++p == eol || *p != ']'))
+                return -1;
+            if (!at_line_end(p + 1, eol))
+                return -1;
+            lx->section.ptr = name;
+            lx->section.len = name_end - name;
+            continue;
+        }
+
+        /* key = value */
+        const char *key = p;
+        while (p < eol && is_key_char(*p))
+            p++;
+        if (p == key)
+            return -1;
+        kv->key.ptr = key;
+        kv->key.len = p - key;
+
+        p = skip_space(p, eol);
+        if (p == eol || *p != '=')
+            return -1;
+        p = skip_space(p + 1, eol);
+        if (p == eol)
+            return -1;
+
+        if (*p == '"' || *p == '\'') {
+            const char *close = memchr(p + 1, *p, eol - p - 1);
+            if (close == NULL)
+                return -1;
+            kv->value.ptr = p + 1;
+            kv->value.len = close - p - 1;
+            p = close + 1;
+        } else if (*p == '[') {
+            const char *start = p;
+            int depth = 0;
+            for (; p < eol; p++) {
+                if (*p == '[')
+                    depth++;
+                else if (*p == ']' && --depth == 0)
+                    break;
+            }
+            if (p == eol)
+                return -1;
+            p++;
+            kv->value.ptr = start;
+            kv->value.len = p - start;
+        } else {
+            const char *start = p;
+            while (p < eol && *p != '#')
+                p++;
+            const char *stop = p;
+            while (stop > start && is_space(stop[-1]))
+                stop--;
+            kv->value.ptr = start;
+            kv->value.len = stop - start;
+        }
+
+        if (!at_line_end(p, eol))
+            return -1;
+
+        kv->section = lx->section;
+        kv->line = lx->line;
+        return 1;
+    }
+    return 0;
+}
+
+bool gr_slice_eq(gr_slice_t s, const char *lit) {
+    size_t n = strlen(lit);
+    return s.len == n && memcmp(s.ptr, lit, n) == 0;
+}
+
+bool gr_slice_caseeq(gr_slice_t s, const char *lit) {
+    size_t n = strlen(lit);
+    return s.len == n && strncasecmp(s.ptr, lit, n) == 0;
+}
+
+bool gr_slice_consume(gr_slice_t *s, const char *prefix) {
+    size_t n = strlen(prefix);
+    if (s->len < n || memcmp(s->ptr, prefix, n) != 0)
+        return false;
+    s->ptr += n;
+    s->len -= n;
+    return true;
+}
+
+int gr_slice_to_bool(gr_slice_t s, bool *out) {
+    if (gr_slice_caseeq(s, "true"))
+        *out = true;
+    else if (gr_slice_caseeq(s, "false"))
+        *out = false;
+    else
+        return -1;
+    return 0;
+}
@@ -0,0 +1,57 @@
+// gresratio_lexer.h
+
+/*
+ * Single pass lexer for the subset of TOML used by
+ * job_submit_ratio_config.toml: [section] and [[table]] headers, comments
+ * and key = value lines. Keys and values are returned as slices pointing into
+ * the caller's buffer, nothing is copied or allocated.
+ */
+
+#ifndef GRESRATIO_LEXER_H
+#define GRESRATIO_LEXER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A non NUL terminated view into the config buffer. */
+typedef struct {
+    const char *ptr;
+    size_t len;
+} gr_slice_t;
+
+/* One key = value line and the section it appeared under. */
+typedef struct {
+    gr_slice_t section; // name between the brackets, empty before any header
+    gr_slice_t key;
+    gr_slice_t value;   // quotes stripped, comments and whitespace trimmed
+    unsigned line;
+} gr_kv_t;
+
+typedef struct {
+    const char *cur;
+    const char *end;
+    gr_slice_t section;
+    unsigned line;      // line of the last token, or of the syntax error
+} gr_lexer_t;
+
+void gr_lexer_init(gr_lexer_t *lx, const char *buf, size_t len);
+
+/*
+ * Advances to the next key = value line. Returns 1 and fills kv, 0 at the
+ * end of the buffer, or -1 on a malformed line (lx->line has its number,
+ * lx->section the section it is in). Lexing may go on after a -1, from
+ * the line that follows.
+ */
+int gr_lexer_next(gr_lexer_t *lx, gr_kv_t *kv);
+
+/* Exact and ASCII case insensitive comparisons against a C string. */
+bool gr_slice_eq(gr_slice_t s, const char *lit);
+bool gr_slice_caseeq(gr_slice_t s, const char *lit);
+
+/* Strips prefix from s if present, returns whether it was. */
+bool gr_slice_consume(gr_slice_t *s, const char *prefix);
+
+/* Parses true/false (any case). Returns 0 or -1 if s is not a boolean. */
+int gr_slice_to_bool(gr_slice_t s, bool *out);
+
+#endif
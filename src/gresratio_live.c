@@ -0,0 +1,194 @@
+// gresratio_live.c
+
+/*
+ * Live config snapshot for libgresratio: lock-free reader pinning, pointer
+ * swap with deferred reclamation, and an inotify watcher thread that
+ * reloads the file off the evaluation path.
+ */
+
+#include <errno.h>
+#include <libgen.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "gresratio_internal.h"
+
+/*
+ * Current snapshot, NULL until gr_live_start() succeeds.
+ *
+ * Readers never lock: they bump the counter of the current reader phase,
+ * load the pointer, and drop the counter when done. After swapping the
+ * pointer the watcher thread flips the phase twice, waiting each time for
+ * the old phase to drain, and only then frees the previous snapshot.
+ */
+static _Atomic(struct gr_config *) config = NULL;
+
+struct reader_count {
+    atomic_long count;
+    char pad[64 - sizeof(atomic_long)]; // keep phases on separate cache lines
+};
+static struct reader_count readers[2];
+static atomic_uint reader_phase = 0;
+
+/* Config watcher thread state. */
+static pthread_t watch_thread;
+static bool watch_running = false;
+static int watch_stop[2] = { -1, -1 }; // pipe used to wake the thread on stop
+static char *config_file; // path being watched
+
+const gr_config_t *gr_live_acquire(unsigned *phase) {
+    *phase = atomic_load(&reader_phase) & 1;
+    atomic_fetch_add(&readers[*phase].count, 1);
+    return atomic_load(&config);
+}
+
+void gr_live_release(unsigned phase) {
+    atomic_fetch_sub(&readers[phase].count, 1);
+}
+
+/* Waits until no reader can still hold a snapshot swapped out before the call. */
+static void config_synchronize(void) {
+    for (int flip = 0; flip < 2; flip++) {
+        unsigned old = atomic_fetch_add(&reader_phase, 1) & 1;
+        while (atomic_load(&readers[old].count) != 0)
+            usleep(1000);
+    }
+}
+
+/* Swaps in cfg (may be NULL) and frees the snapshot it replaces. */
+static void config_publish(struct gr_config *cfg) {
+    struct gr_config *old = atomic_exchange(&config, cfg);
+    if (old == NULL)
+        return;
+    config_synchronize();
+    gr_config_free(old);
+}
+
+/* Reloads the config file, keeping the current snapshot if it is invalid. */
+static void reload_config(void) {
+    struct gr_config *cfg = gr_config_load(config_file);
+    if (cfg == NULL) {
+        gr_error("keeping previous config, %s is invalid",
+                 config_file);
+        return;
+    }
+    gr_stats_attach(cfg);
+    gr_trace_attach(cfg);
+    config_publish(cfg);
+    gr_info("reloaded %s", config_file);
+}
+
+/*
+ * Watches the directory holding the config file so that both in place
+ * writes and editors that rename a new file over it trigger a reload.
+ */
+static void *watch_config(void *arg) {
+    char *path = strdup(config_file);
+    char *dir_copy = strdup(config_file);
+    if (path == NULL || dir_copy == NULL) {
+        gr_error("cannot allocate watch path");
+        goto out;
+    }
+    const char *file = basename(path);
+    const char *dir = dirname(dir_copy);
+
+    int fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (fd < 0) {
+        gr_error("inotify_init1: %m");
+        goto out;
+    }
+    if (inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO |
+                          IN_CREATE) < 0) {
+        gr_error("cannot watch %s: %m", dir);
+        close(fd);
+        goto out;
+    }
+
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd fds[2] = {
+        { .fd = fd, .events = POLLIN },
+        { .fd = watch_stop[0], .events = POLLIN },
+    };
+
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            gr_error("poll: %m, config watcher stopped");
+            break;
+        }
+        if (fds[1].revents)
+            break;
+        if (!(fds[0].revents & POLLIN))
+            continue;
+
+        bool changed = false;
+        ssize_t len;
+        while ((len = read(fd, buf, sizeof(buf))) > 0) {
+            for (char *p = buf; p < buf + len;) {
+                struct inotify_event *ev = (struct inotify_event *) p;
+                if (ev->len && strcmp(ev->name, file) == 0)
+                    changed = true;
+                p += sizeof(*ev) + ev->len;
+            }
+        }
+        if (changed)
+            reload_config();
+    }
+    close(fd);
+
+out:
+    free(path);
+    free(dir_copy);
+    return arg;
+}
+
+int gr_live_start(const char *filename, bool watch) {
+    struct gr_config *cfg = gr_config_load(filename);
+    if (cfg == NULL)
+        return -1;
+    if ((config_file = strdup(filename)) == NULL) {
+        gr_config_free(cfg);
+        return -1;
+    }
+    gr_stats_attach(cfg);
+    gr_trace_attach(cfg);
+    config_publish(cfg);
+
+    if (!watch)
+        return 0;
+    if (pipe(watch_stop) != 0) {
+        gr_error("pipe: %m, config changes need a restart");
+        return 0;
+    }
+    if (pthread_create(&watch_thread, NULL, watch_config, NULL) != 0) {
+        gr_error("cannot start config watcher, config changes need a restart");
+        return 0;
+    }
+    watch_running = true;
+    return 0;
+}
+
+void gr_live_stop(void) {
+    if (watch_running) {
+        if (write(watch_stop[1], "", 1) != 1)
+            gr_error("cannot stop config watcher: %m");
+        pthread_join(watch_thread, NULL);
+        watch_running = false;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (watch_stop[i] >= 0)
+            close(watch_stop[i]);
+        watch_stop[i] = -1;
+    }
+    config_publish(NULL);
+    gr_stats_close();
+    gr_trace_close();
+    free(config_file);
+    config_file = NULL;
+}
@@ -0,0 +1,199 @@
+// gresratio_stats.c
+
+/*
+ * Shared memory statistics for libgresratio, see gresratio_stats.h for the
+ * segment layout. The segment is created when the first config naming a
+ * stats_segment is loaded; every later config only renames slots. Nothing
+ * here locks: evaluators do relaxed atomic adds on their own stripe.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "gresratio_internal.h"
+#include "gresratio_stats.h"
+
+static _Atomic(struct gr_stats_segment *) segment = NULL;
+static char *segment_name; // as given by the config that created it
+static atomic_uint next_stripe;
+static _Thread_local int my_stripe = -1;
+
+static struct gr_stats_stripe *stripe(struct gr_stats_segment *seg) {
+    if (my_stripe < 0)
+        my_stripe = atomic_fetch_add(&next_stripe, 1) % GR_STATS_STRIPES;
+    return &seg->stripes[my_stripe];
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline void bump(atomic_uint_fast64_t *counter) {
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+/*
+ * Creates a fresh segment. An old one of the same name is unlinked first
+ * rather than reused, so a ratiostat that still has it mapped keeps
+ * reading stale but valid memory instead of counters being reset under it.
+ */
+static struct gr_stats_segment *create_segment(const char *name) {
+    struct gr_stats_segment *seg;
+    int fd;
+
+    shm_unlink(name);
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        gr_error("cannot create stats segment %s: %m", name);
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(*seg)) != 0) {
+        gr_error("cannot size stats segment %s: %m", name);
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    seg = mmap(NULL, sizeof(*seg), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED) {
+        gr_error("cannot map stats segment %s: %m", name);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    seg->version = GR_STATS_VERSION;
+    seg->size = sizeof(*seg);
+    seg->started = time(NULL);
+    strcpy(seg->parts[0], "-");
+    strcpy(seg->cards[0], "-");
+    seg->num_parts = 1;
+    seg->num_cards = 1;
+    atomic_thread_fence(memory_order_release);
+    seg->magic = GR_STATS_MAGIC;
+    return seg;
+}
+
+/* Slot of name, appending it if there is room, else slot 0. */
+static uint8_t slot_of(char (*names)[GR_STATS_NAME], uint32_t *num,
+                       const char *name, int max) {
+    for (uint32_t i = 1; i < *num; i++)
+        if (strncmp(names[i], name, GR_STATS_NAME - 1) == 0)
+            return i;
+    if (*num == (uint32_t) max)
+        return 0;
+    strncpy(names[*num], name, GR_STATS_NAME - 1);
+    return (*num)++;
+}
+
+int gr_stats_attach(struct gr_config *cfg) {
+    struct gr_stats_segment *seg = atomic_load(&segment);
+
+    if (seg == NULL && cfg->stats_segment) {
+        if ((seg = create_segment(cfg->stats_segment)) == NULL)
+            return -1;
+        if ((segment_name = strdup(cfg->stats_segment)) == NULL) {
+            munmap(seg, sizeof(*seg));
+            return -1;
+        }
+        gr_info("publishing stats in shared memory %s", segment_name);
+        atomic_store(&segment, seg);
+    } else if (seg && (cfg->stats_segment == NULL ||
+                       strcmp(cfg->stats_segment, segment_name) != 0)) {
+        gr_info("stats stay in %s until slurmctld restarts", segment_name);
+    }
+    if (seg == NULL)
+        return 0;
+
+    cfg->stats_parts = calloc(cfg->num_parts ? cfg->num_parts : 1, 1);
+    cfg->stats_cards = calloc(cfg->num_entries ? cfg->num_entries : 1, 1);
+    if (cfg->stats_parts == NULL || cfg->stats_cards == NULL)
+        return -1;
+
+    unsigned seq = atomic_load_explicit(&seg->seq, memory_order_relaxed);
+    atomic_store_explicit(&seg->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (int i = 0; i < cfg->num_parts; i++)
+        cfg->stats_parts[i] = slot_of(seg->parts, &seg->num_parts,
+                                      cfg->parts[i].name, GR_STATS_PARTS);
+    for (int id = 0; id < cfg->num_entries; id++)
+        cfg->stats_cards[id] = slot_of(seg->cards, &seg->num_cards,
+                                       cfg->entries[id].name, GR_STATS_CARDS);
+    seg->generation = cfg->generation;
+    atomic_store_explicit(&seg->seq, seq + 2, memory_order_release);
+    return 0;
+}
+
+void gr_stats_close(void) {
+    struct gr_stats_segment *seg = atomic_exchange(&segment, NULL);
+
+    if (seg)
+        munmap(seg, sizeof(*seg));
+    free(segment_name);
+    segment_name = NULL;
+}
+
+/*
+ * Reading the clock twice costs about as much as a cached decision, so only
+ * every GR_STATS_SAMPLE-th call of a thread is timed; the others start at
+ * 1, which counts them without a latency.
+ */
+uint64_t gr_stats_start(void) {
+    static _Thread_local unsigned calls;
+
+    if (atomic_load_explicit(&segment, memory_order_relaxed) == NULL)
+        return 0;
+    return calls++ % GR_STATS_SAMPLE ? 1 : now_ns();
+}
+
+/* Counts a call that started at start in the latency histogram. */
+static void record_latency(struct gr_stats_stripe *st, uint64_t start) {
+    if (start == 1)
+        return;
+    uint64_t ns = now_ns() - start;
+    int b = ns ? 64 - __builtin_clzll(ns) : 0;
+    bump(&st->latency[b < GR_STATS_BUCKETS ? b : GR_STATS_BUCKETS - 1]);
+}
+
+void gr_stats_record(const gr_config_t *cfg, const gr_result_t *res,
+                     bool adjusted, uint64_t start) {
+    struct gr_stats_segment *seg =
+        atomic_load_explicit(&segment, memory_order_relaxed);
+    if (seg == NULL || start == 0)
+        return;
+
+    struct gr_stats_stripe *st = stripe(seg);
+    int p = cfg && cfg->stats_parts && res->policy_id >= 0 ?
+            cfg->stats_parts[res->policy_id] : 0;
+    int c = cfg && cfg->stats_cards && res->card_id >= 0 ?
+            cfg->stats_cards[res->card_id] : 0;
+
+    bump(res->decision == GR_ACCEPT ? &st->accepts[p][c] : &st->rejects[p][c]);
+    bump(&st->reasons[res->decision]);
+    if (adjusted)
+        bump(&st->adjusted);
+    record_latency(st, start);
+}
+
+void gr_stats_exempt(uint64_t start) {
+    struct gr_stats_segment *seg =
+        atomic_load_explicit(&segment, memory_order_relaxed);
+    if (seg == NULL || start == 0)
+        return;
+
+    struct gr_stats_stripe *st = stripe(seg);
+    bump(&st->exempt);
+    record_latency(st, start);
+}
+
+void gr_stats_cache(bool hit) {
+    struct gr_stats_segment *seg =
+        atomic_load_explicit(&segment, memory_order_relaxed);
+    if (seg)
+        bump(hit ? &stripe(seg)->cache_hits : &stripe(seg)->cache_misses);
+}
@@ -0,0 +1,61 @@
+// gresratio_stats.h
+
+/*
+ * Layout of the POSIX shared memory segment the plugin publishes its
+ * counters in when stats_segment is set, read by ratiostat. Only depends on
+ * the C library so other tools can map it too.
+ *
+ * Counters only ever grow and are updated with relaxed atomic adds, spread
+ * over GR_STATS_STRIPES cache line aligned stripes by thread; a reader sums
+ * the stripes. The slot names and the config generation are guarded by seq:
+ * it is odd while the plugin renames slots on a config load, and a reader
+ * that sees it change while copying retries, so a count is never paired
+ * with the wrong partition or card name.
+ *
+ * Slot names are only ever appended; a partition or card keeps its slot
+ * over reloads so its counters stay monotonic. Slot 0 counts jobs no
+ * partition policy (or no card) applied to, and slots past the last one.
+ */
+
+#ifndef GRESRATIO_STATS_H
+#define GRESRATIO_STATS_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define GR_STATS_MAGIC 0x54535247u // "GRST"
+#define GR_STATS_VERSION 1
+#define GR_STATS_PARTS 32
+#define GR_STATS_CARDS 32
+#define GR_STATS_NAME 32 // slot name size, including the NUL
+#define GR_STATS_REASONS 4 // by gr_decision_t, 0 is accept
+#define GR_STATS_BUCKETS 24 // bucket b counts calls taking < 2^b ns
+#define GR_STATS_SAMPLE 16 // one call in this many per thread is timed
+#define GR_STATS_STRIPES 16
+
+struct gr_stats_stripe {
+    atomic_uint_fast64_t accepts[GR_STATS_PARTS][GR_STATS_CARDS];
+    atomic_uint_fast64_t rejects[GR_STATS_PARTS][GR_STATS_CARDS];
+    atomic_uint_fast64_t reasons[GR_STATS_REASONS];
+    atomic_uint_fast64_t exempt;   // let through by an exempt_* setting
+    atomic_uint_fast64_t adjusted; // accepted after mode = adjust changed them
+    atomic_uint_fast64_t cache_hits;
+    atomic_uint_fast64_t cache_misses;
+    atomic_uint_fast64_t latency[GR_STATS_BUCKETS];
+} __attribute__((aligned(64)));
+
+struct gr_stats_segment {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size; // of the whole segment
+    uint64_t started; // unix time the plugin created the segment
+    atomic_uint seq;
+    uint32_t num_parts; // slots named so far
+    uint32_t num_cards;
+    uint64_t generation; // of the config the plugin loaded last
+    char parts[GR_STATS_PARTS][GR_STATS_NAME];
+    char cards[GR_STATS_CARDS][GR_STATS_NAME];
+    struct gr_stats_stripe stripes[GR_STATS_STRIPES];
+};
+
+#endif
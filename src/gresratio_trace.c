@@ -0,0 +1,429 @@
+// gresratio_trace.c
+
+/*
+ * Trace capture and reading for libgresratio, see gresratio_trace.h for
+ * the file layout. The writer is opened when the first config naming a
+ * trace_file is loaded. Appending a record takes one atomic add on the
+ * head and one release store of its header word; nothing ever locks or
+ * waits, so a slow disk only shows up as page cache writeback.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "gresratio_internal.h"
+#include "gresratio_trace.h"
+
+#define WORD_SIZE 8 // the header word in front of every body
+#define NUM_STRINGS 7
+
+struct trace_writer {
+    struct gr_trace_header *hdr;
+    unsigned char *ring;
+    uint64_t mask;
+    size_t map_size;
+    uint64_t salt;
+    char *path;
+};
+
+struct gr_trace {
+    const struct gr_trace_header *hdr;
+    const unsigned char *ring;
+    uint64_t mask;
+    size_t map_size;
+};
+
+static _Atomic(struct trace_writer *) writer = NULL;
+
+/* Check of a body stored in the top 16 bits of its header word. */
+static uint16_t body_check(const unsigned char *p, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+        h = (h ^ p[i]) * 16777619u;
+    return h ^ (h >> 16);
+}
+
+static uint32_t hash_user(uint32_t uid, uint64_t salt) {
+    uint64_t x = uid ^ salt;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return (x ^ (x >> 31)) >> 32;
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+
+static unsigned char *put_varint(unsigned char *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = v | 0x80;
+        v >>= 7;
+    }
+    *p++ = v;
+    return p;
+}
+
+/* Counts are stored + 1 so that 0 can mean not set. */
+static unsigned char *put_count(unsigned char *p, uint32_t v, uint32_t no_val) {
+    return put_varint(p, v == 0 || v == no_val ? 0 : (uint64_t) v + 1);
+}
+
+static unsigned char *put_string(unsigned char *p, const char *s) {
+    if (s == NULL)
+        return put_varint(p, 0);
+    size_t len = strnlen(s, GR_TRACE_MAX_STRING);
+    p = put_varint(p, len + 1);
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p + len + 1;
+}
+
+/* Writes the body of rec after the header word, returns the record size. */
+static size_t encode(unsigned char *buf, const gr_trace_rec_t *rec,
+                     uint64_t epoch_ms) {
+    const gr_job_t *job = &rec->job;
+    unsigned char *p = buf + WORD_SIZE;
+
+    *p++ = (rec->call & 3) | (rec->flags & 3) << 2 | rec->decision << 4;
+    p = put_varint(p, rec->time_ms > epoch_ms ? rec->time_ms - epoch_ms : 0);
+    memcpy(p, &rec->user, 4);
+    p += 4;
+    p = put_count(p, job->min_cpus, GR_NO_VAL);
+    p = put_count(p, job->min_nodes, GR_NO_VAL);
+    p = put_count(p, job->num_tasks, GR_NO_VAL);
+    p = put_count(p, job->cpus_per_task, GR_NO_VAL16);
+    p = put_count(p, job->ntasks_per_node, GR_NO_VAL16);
+    p = put_count(p, job->sockets_per_node, GR_NO_VAL16);
+    p = put_count(p, job->pn_min_cpus, GR_NO_VAL16);
+    p = put_string(p, rec->partition);
+    p = put_string(p, rec->account);
+    p = put_string(p, job->tres_per_node);
+    p = put_string(p, job->tres_per_job);
+    p = put_string(p, job->tres_per_task);
+    p = put_string(p, job->tres_per_socket);
+    p = put_string(p, job->cpus_per_tres);
+    return p - buf;
+}
+
+static void ring_write(struct trace_writer *w, uint64_t pos, const void *src,
+                       size_t n) {
+    size_t off = pos & w->mask, room = w->mask + 1 - off;
+    if (n <= room) {
+        memcpy(w->ring + off, src, n);
+    } else {
+        memcpy(w->ring + off, src, room);
+        memcpy(w->ring, (const char *) src + room, n - room);
+    }
+}
+
+bool gr_trace_active(void) {
+    return atomic_load_explicit(&writer, memory_order_relaxed) != NULL;
+}
+
+void gr_trace_record(uint32_t uid, const gr_trace_rec_t *rec) {
+    struct trace_writer *w = atomic_load_explicit(&writer,
+                                                  memory_order_acquire);
+    unsigned char buf[GR_TRACE_MAX_RECORD];
+    gr_trace_rec_t stamped;
+
+    if (w == NULL)
+        return;
+    stamped = *rec;
+    stamped.time_ms = now_ms();
+    stamped.user = hash_user(uid, w->salt);
+
+    size_t len = encode(buf, &stamped, w->hdr->epoch_ms);
+    uint64_t size = (len + GR_TRACE_GRANULE - 1) & ~(uint64_t) (GR_TRACE_GRANULE - 1);
+    uint64_t pos = atomic_fetch_add_explicit(&w->hdr->head, size,
+                                             memory_order_relaxed);
+    ring_write(w, pos + WORD_SIZE, buf + WORD_SIZE, len - WORD_SIZE);
+
+    uint64_t word = (uint32_t) (pos / GR_TRACE_GRANULE) |
+                    (uint64_t) len << 32 |
+                    (uint64_t) body_check(buf + WORD_SIZE, len - WORD_SIZE) << 48;
+    atomic_store_explicit((atomic_uint_fast64_t *) (w->ring + (pos & w->mask)),
+                          word, memory_order_release);
+}
+
+/*
+ * Maps the trace file, continuing an existing trace of the same ring size
+ * and starting over (zeroed, so no stale record can pass for a new one)
+ * otherwise.
+ */
+static struct trace_writer *open_writer(const char *path, uint64_t size,
+                                        uint64_t salt) {
+    struct trace_writer *w = calloc(1, sizeof(*w));
+    struct stat st;
+    int fd = -1;
+
+    if (w == NULL || (w->path = strdup(path)) == NULL)
+        goto fail;
+    w->map_size = GR_TRACE_HEADER + size;
+    w->mask = size - 1;
+    w->salt = salt;
+
+    if ((fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0 ||
+        fstat(fd, &st) != 0) {
+        gr_error("cannot open trace file %s: %m", path);
+        goto fail;
+    }
+    bool keep = (uint64_t) st.st_size == w->map_size;
+    if (!keep && (ftruncate(fd, 0) != 0 || ftruncate(fd, w->map_size) != 0)) {
+        gr_error("cannot size trace file %s: %m", path);
+        goto fail;
+    }
+    w->hdr = mmap(NULL, w->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (w->hdr == MAP_FAILED) {
+        gr_error("cannot map trace file %s: %m", path);
+        w->hdr = NULL;
+        goto fail;
+    }
+    close(fd);
+    fd = -1;
+    w->ring = (unsigned char *) w->hdr + GR_TRACE_HEADER;
+
+    if (keep && memcmp(w->hdr->magic, GR_TRACE_MAGIC, 8) == 0 &&
+        w->hdr->version == GR_TRACE_VERSION &&
+        w->hdr->header_size == GR_TRACE_HEADER && w->hdr->ring_size == size)
+        return w;
+    if (keep)
+        memset(w->hdr, 0, w->map_size);
+    w->hdr->version = GR_TRACE_VERSION;
+    w->hdr->header_size = GR_TRACE_HEADER;
+    w->hdr->ring_size = size;
+    w->hdr->epoch_ms = now_ms();
+    atomic_store(&w->hdr->head, 0);
+    atomic_thread_fence(memory_order_release);
+    memcpy(w->hdr->magic, GR_TRACE_MAGIC, 8);
+    return w;
+
+fail:
+    if (fd >= 0)
+        close(fd);
+    if (w)
+        free(w->path);
+    free(w);
+    return NULL;
+}
+
+int gr_trace_attach(const struct gr_config *cfg) {
+    struct trace_writer *w = atomic_load(&writer);
+
+    if (w && (cfg->trace_file == NULL || strcmp(cfg->trace_file, w->path) ||
+              cfg->trace_size != w->mask + 1 || cfg->trace_salt != w->salt)) {
+        gr_info("tracing stays on %s as it was until slurmctld restarts",
+                w->path);
+        return 0;
+    }
+    if (w || cfg->trace_file == NULL)
+        return 0;
+    if ((w = open_writer(cfg->trace_file, cfg->trace_size,
+                         cfg->trace_salt)) == NULL)
+        return -1;
+    gr_info("tracing jobs to %s, %llu MB ring", w->path,
+            (unsigned long long) (cfg->trace_size >> 20));
+    atomic_store_explicit(&writer, w, memory_order_release);
+    return 0;
+}
+
+/* Only called once no job can be in gr_trace_record(). */
+void gr_trace_close(void) {
+    struct trace_writer *w = atomic_exchange(&writer, NULL);
+    if (w == NULL)
+        return;
+    munmap(w->hdr, w->map_size);
+    free(w->path);
+    free(w);
+}
+
+gr_trace_t *gr_trace_map(const char *path) {
+    gr_trace_t *trace = calloc(1, sizeof(*trace));
+    struct stat st;
+    void *map;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (trace == NULL || fd < 0 || fstat(fd, &st) != 0) {
+        gr_error("cannot open trace %s: %m", path);
+        goto fail;
+    }
+    if ((size_t) st.st_size < GR_TRACE_HEADER) {
+        gr_error("%s is not a trace file", path);
+        goto fail;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        gr_error("cannot map trace %s: %m", path);
+        goto fail;
+    }
+    close(fd);
+    trace->hdr = map;
+    trace->map_size = st.st_size;
+
+    uint64_t size = trace->hdr->ring_size;
+    if (memcmp(trace->hdr->magic, GR_TRACE_MAGIC, 8) != 0 ||
+        trace->hdr->version != GR_TRACE_VERSION ||
+        trace->hdr->header_size != GR_TRACE_HEADER ||
+        size < GR_TRACE_MAX_RECORD || (size & (size - 1)) ||
+        (uint64_t) st.st_size < GR_TRACE_HEADER + size) {
+        gr_error("%s is not a trace file of this version", path);
+        munmap(map, st.st_size);
+        free(trace);
+        return NULL;
+    }
+    trace->ring = (const unsigned char *) map + GR_TRACE_HEADER;
+    trace->mask = size - 1;
+    return trace;
+
+fail:
+    if (fd >= 0)
+        close(fd);
+    free(trace);
+    return NULL;
+}
+
+void gr_trace_unmap(gr_trace_t *trace) {
+    if (trace == NULL)
+        return;
+    munmap((void *) trace->hdr, trace->map_size);
+    free(trace);
+}
+
+static uint64_t head_of(const gr_trace_t *trace) {
+    return atomic_load_explicit((atomic_uint_fast64_t *) &trace->hdr->head,
+                                memory_order_acquire);
+}
+
+void gr_trace_window(const gr_trace_t *trace, uint64_t *first,
+                     uint64_t *end) {
+    uint64_t head = head_of(trace), size = trace->mask + 1;
+    *end = head / GR_TRACE_GRANULE;
+    *first = head > size ?
+        (head - size + GR_TRACE_GRANULE - 1) / GR_TRACE_GRANULE : 0;
+}
+
+static const unsigned char *get_varint(const unsigned char *p,
+                                       const unsigned char *end,
+                                       uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        *v |= (uint64_t) (*p & 0x7f) << shift;
+        if (!(*p++ & 0x80))
+            return p;
+    }
+    return NULL;
+}
+
+static const unsigned char *get_count(const unsigned char *p,
+                                      const unsigned char *end, uint32_t *v,
+                                      uint32_t no_val) {
+    uint64_t n;
+    if ((p = get_varint(p, end, &n)) == NULL || n > (uint64_t) no_val + 1)
+        return NULL;
+    *v = n ? n - 1 : no_val;
+    return p;
+}
+
+static const unsigned char *get_count16(const unsigned char *p,
+                                        const unsigned char *end,
+                                        uint16_t *v) {
+    uint32_t n;
+    if ((p = get_count(p, end, &n, GR_NO_VAL16)) != NULL)
+        *v = n;
+    return p;
+}
+
+static const unsigned char *get_string(const unsigned char *p,
+                                       const unsigned char *end,
+                                       const char **s) {
+    uint64_t n;
+    if ((p = get_varint(p, end, &n)) == NULL)
+        return NULL;
+    if (n == 0) {
+        *s = NULL;
+        return p;
+    }
+    if (n - 1 > GR_TRACE_MAX_STRING || (uint64_t) (end - p) < n ||
+        p[n - 1] != '\0')
+        return NULL;
+    *s = (const char *) p;
+    return p + n;
+}
+
+static bool decode(const unsigned char *p, const unsigned char *end,
+                   uint64_t epoch_ms, gr_trace_rec_t *rec) {
+    gr_job_t *job = &rec->job;
+    const char **strings[NUM_STRINGS] = {
+        &rec->partition, &rec->account, &job->tres_per_node,
+        &job->tres_per_job, &job->tres_per_task, &job->tres_per_socket,
+        &job->cpus_per_tres,
+    };
+    uint64_t delta;
+
+    if (end - p < 6)
+        return false;
+    rec->call = *p & 3;
+    rec->flags = *p >> 2 & 3;
+    rec->decision = *p++ >> 4;
+    if (rec->call == 0 || rec->decision > GR_REJECT_RATIO ||
+        (p = get_varint(p, end, &delta)) == NULL || end - p < 4)
+        return false;
+    rec->time_ms = epoch_ms + delta;
+    memcpy(&rec->user, p, 4);
+    p += 4;
+    if ((p = get_count(p, end, &job->min_cpus, GR_NO_VAL)) == NULL ||
+        (p = get_count(p, end, &job->min_nodes, GR_NO_VAL)) == NULL ||
+        (p = get_count(p, end, &job->num_tasks, GR_NO_VAL)) == NULL ||
+        (p = get_count16(p, end, &job->cpus_per_task)) == NULL ||
+        (p = get_count16(p, end, &job->ntasks_per_node)) == NULL ||
+        (p = get_count16(p, end, &job->sockets_per_node)) == NULL ||
+        (p = get_count16(p, end, &job->pn_min_cpus)) == NULL)
+        return false;
+    for (int i = 0; i < NUM_STRINGS; i++)
+        if ((p = get_string(p, end, strings[i])) == NULL)
+            return false;
+    return p == end;
+}
+
+int gr_trace_next(const gr_trace_t *trace, uint64_t *pos, uint64_t end,
+                  gr_trace_rec_t *rec, char *buf) {
+    uint64_t size = trace->mask + 1;
+
+    for (uint64_t g = *pos; g < end; g++) {
+        uint64_t off = g * GR_TRACE_GRANULE & trace->mask;
+        uint64_t word = atomic_load_explicit(
+            (atomic_uint_fast64_t *) (trace->ring + off), memory_order_acquire);
+        size_t len = word >> 32 & 0xffff;
+
+        if ((uint32_t) word != (uint32_t) g || len <= WORD_SIZE ||
+            len > GR_TRACE_MAX_RECORD)
+            continue;
+
+        /* A body that wraps around the ring is put back together in buf. */
+        const unsigned char *body = trace->ring + off + WORD_SIZE;
+        size_t n = len - WORD_SIZE;
+        if (off + len > size) {
+            size_t room = size - off - WORD_SIZE;
+            memcpy(buf, body, room);
+            memcpy(buf + room, trace->ring, n - room);
+            body = (const unsigned char *) buf;
+        }
+        if (body_check(body, n) != word >> 48 ||
+            !decode(body, body + n, trace->hdr->epoch_ms, rec))
+            continue;
+        /* Skip a record a live writer lapped while it was read. */
+        if (head_of(trace) > g * GR_TRACE_GRANULE + size)
+            continue;
+        rec->granule = g;
+        *pos = g + (len + GR_TRACE_GRANULE - 1) / GR_TRACE_GRANULE;
+        return 1;
+    }
+    *pos = end;
+    return 0;
+}
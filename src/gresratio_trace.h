@@ -0,0 +1,106 @@
+// gresratio_trace.h
+
+/*
+ * Submission traces: with trace_file set the plugin appends every job it
+ * checks to a fixed size, memory mapped ring file, which the replay and
+ * diff tools read back offline.
+ *
+ * The file is a GR_TRACE_HEADER byte header followed by the ring. Writers
+ * reserve space with one atomic add on head, a count of bytes ever
+ * reserved, so a record at absolute position p lives at ring offset
+ * p % ring_size and the ring holds the last ring_size bytes. Records start
+ * on GR_TRACE_GRANULE byte boundaries with an 8 byte header word, stored
+ * last: the low 32 bits of the record's absolute granule, its length and a
+ * check of its body. A reader can start at any granule and skip to the
+ * next one whose header names it, which finds record boundaries again
+ * after the ring wrapped, past records still being written, and at the
+ * start of any shard of the file.
+ *
+ * Bodies are a flags byte, the time as a varint delta from epoch_ms, a
+ * keyed hash of the uid, varint counts (value + 1, 0 for not set) and
+ * length prefixed, NUL terminated strings, so a typical job takes 48 bytes
+ * and decoded strings point straight into the mapping.
+ */
+
+#ifndef GRESRATIO_TRACE_H
+#define GRESRATIO_TRACE_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gresratio.h"
+
+#define GR_TRACE_MAGIC "GRTRACE1"
+#define GR_TRACE_VERSION 1
+#define GR_TRACE_HEADER 4096
+#define GR_TRACE_GRANULE 16
+#define GR_TRACE_MAX_RECORD 2048
+#define GR_TRACE_MAX_STRING 255 // longer strings are cut
+
+struct gr_trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t ring_size; // power of two
+    uint64_t epoch_ms; // record times are deltas from this
+    atomic_uint_fast64_t head;
+};
+
+enum {
+    GR_TRACE_SUBMIT = 1,
+    GR_TRACE_MODIFY = 2,
+};
+
+/* flags of a record */
+#define GR_TRACE_EXEMPT   0x1 // let through by exempt_*, not evaluated
+#define GR_TRACE_ADJUSTED 0x2 // mode = adjust changed its CPU count
+
+/* One traced call. Strings are NULL when the job did not set them. */
+typedef struct {
+    uint64_t time_ms;   // since the Unix epoch
+    uint32_t user;      // keyed hash of the uid, see trace_salt
+    uint8_t call;       // GR_TRACE_SUBMIT or GR_TRACE_MODIFY
+    uint8_t flags;
+    gr_decision_t decision; // as the plugin decided, before any adjustment
+    const char *partition;
+    const char *account;
+    gr_job_t job;       // the request as the job described it
+    uint64_t granule;   // where the record starts, set by gr_trace_next()
+} gr_trace_rec_t;
+
+/* True if a trace file is open, so the plugin can skip building records. */
+bool gr_trace_active(void);
+
+/*
+ * Appends a call to the trace. The time and the user hash are filled in
+ * here from the clock and uid; rec->time_ms, rec->user and rec->granule
+ * are ignored.
+ * Lock-free and never allocates; a no-op without a trace file.
+ */
+void gr_trace_record(uint32_t uid, const gr_trace_rec_t *rec);
+
+/* A trace file mapped read only. */
+typedef struct gr_trace gr_trace_t;
+
+gr_trace_t *gr_trace_map(const char *path);
+void gr_trace_unmap(gr_trace_t *trace);
+
+/*
+ * Absolute granules [*first, *end) that may hold records, oldest first.
+ * Any split of that range can be scanned independently.
+ */
+void gr_trace_window(const gr_trace_t *trace, uint64_t *first, uint64_t *end);
+
+/*
+ * Decodes the first record starting at or after granule *pos and before
+ * end, and moves *pos past it. Strings point into the mapping, or into buf
+ * (at least GR_TRACE_MAX_RECORD bytes) for a record that wraps around the
+ * ring. Returns 1, or 0 when no record is left before end. Scanning from
+ * rec->granule to rec->granule + 1 later decodes the same record again.
+ */
+int gr_trace_next(const gr_trace_t *trace, uint64_t *pos, uint64_t end,
+                  gr_trace_rec_t *rec, char *buf);
+
+#endif
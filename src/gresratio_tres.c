@@ -0,0 +1,127 @@
+// gresratio_tres.c
+
+/*
+ * TRES string tokenizer, see gresratio_tres.h. Runs on every submission, so
+ * it walks the string once and keeps only pointers into it.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "gresratio_tres.h"
+
+/* Characters that end a name or type field. */
+static const bool field_end[256] = {
+    [':'] = true, ['='] = true, [','] = true, [';'] = true, ['('] = true,
+    [')'] = true,
+};
+
+static inline bool is_field_end(char c) {
+    return field_end[(unsigned char) c];
+}
+
+void gr_tres_init(gr_tres_iter_t *it, const char *s) {
+    it->cur = s;
+    it->end = s ? s + strlen(s) : NULL;
+}
+
+static gr_slice_t take_field(const char **p, const char *end) {
+    const char *start = *p;
+    while (*p < end && !is_field_end(**p))
+        (*p)++;
+    return (gr_slice_t) { start, *p - start };
+}
+
+/* Parses a count with an optional k/m/g suffix. Returns -1 if s is not one. */
+static int slice_to_count(gr_slice_t s, uint64_t *out) {
+    uint64_t n = 0;
+    size_t i = 0;
+
+    for (; i < s.len && s.ptr[i] >= '0' && s.ptr[i] <= '9'; i++) {
+        n = n * 10 + (s.ptr[i] - '0');
+        if (n > UINT32_MAX)
+            return -1;
+    }
+    if (i == 0)
+        return -1;
+    if (i + 1 == s.len) {
+        switch (s.ptr[i] | 0x20) {
+        case 'k': n <<= 10; break;
+        case 'm': n <<= 20; break;
+        case 'g': n <<= 30; break;
+        default: return -1;
+        }
+    } else if (i != s.len) {
+        return -1;
+    }
+    *out = n;
+    return 0;
+}
+
+int gr_tres_next(gr_tres_iter_t *it, gr_tres_t *tres) {
+    const char *p = it->cur, *end = it->end;
+
+    /* Empty entries (",," or a trailing separator) are skipped. */
+    while (p < end && (*p == ',' || *p == ';'))
+        p++;
+    it->cur = p;
+    if (p >= end)
+        return 0;
+
+    /* gres/gpu... or gres:gpu... */
+    if (end - p > 5 && memcmp(p, "gres", 4) == 0 &&
+        (p[4] == '/' || p[4] == ':'))
+        p += 5;
+    tres->name = take_field(&p, end);
+    tres->type = (gr_slice_t) { p, 0 };
+    tres->count = 1;
+    if (tres->name.len == 0)
+        return -1;
+
+    /* Only GPU values are used, others (mem=187.50G) may be anything. */
+    if (tres->name.len != 3 || memcmp(tres->name.ptr, "gpu", 3) != 0) {
+        int depth = 0;
+        for (; p < end && (depth || (*p != ',' && *p != ';')); p++)
+            depth += (*p == '(') - (*p == ')');
+        tres->count = 0;
+        it->cur = p;
+        return 1;
+    }
+
+    /* gpu:N, gpu:type, gpu:type:N */
+    if (p < end && *p == ':') {
+        p++;
+        gr_slice_t field = take_field(&p, end);
+        if (field.len == 0)
+            return -1;
+        if ((p < end && (*p == ':' || *p == '=')) ||
+            slice_to_count(field, &tres->count) != 0) {
+            tres->type = field;
+            if (p < end && *p == ':') {
+                p++;
+                if (slice_to_count(take_field(&p, end), &tres->count))
+                    return -1;
+            }
+        }
+    }
+
+    /* gres/gpu=N, gres/gpu:type=N */
+    if (p < end && *p == '=') {
+        p++;
+        if (slice_to_count(take_field(&p, end), &tres->count))
+            return -1;
+    }
+
+    /* (S:0-1) socket annotation */
+    if (p < end && *p == '(') {
+        const char *close = memchr(p, ')', end - p);
+        if (close == NULL)
+            return -1;
+        p = close + 1;
+    }
+
+    if (p < end && *p != ',' && *p != ';')
+        return -1;
+    it->cur = p;
+    return 1;
+}
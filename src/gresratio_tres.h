@@ -0,0 +1,46 @@
+// gresratio_tres.h
+
+/*
+ * Single pass tokenizer for Slurm TRES request strings, as found in a job's
+ * tres_per_node, tres_per_job, tres_per_socket and tres_per_task:
+ *
+ *   gpu  gpu:2  gpu:a100  gpu:a100:2  gpu:a100:2(S:0-1)
+ *   gres/gpu=2  gres/gpu:a100=2  gres:gpu:a100:2
+ *   gres/gpu:a100=2,gres/shard=4;license/matlab=1
+ *
+ * Each entry comes back as (resource, type, count) slices into the caller's
+ * string; nothing is copied or allocated and type names are never truncated.
+ * Only gpu entries have their type and count parsed, the value of any other
+ * resource is skipped up to the next separator.
+ */
+
+#ifndef GRESRATIO_TRES_H
+#define GRESRATIO_TRES_H
+
+#include <stdint.h>
+
+#include "gresratio_lexer.h"
+
+/* One entry of a TRES list. */
+typedef struct {
+    gr_slice_t name;  // resource, "gres/" or "gres:" stripped (gpu, shard, ...)
+    gr_slice_t type;  // len 0 when no type was given or name is not gpu
+    uint64_t count;   // 1 when no count was given, k/m/g suffixes applied,
+                      // 0 when name is not gpu
+} gr_tres_t;
+
+typedef struct {
+    const char *cur;
+    const char *end;
+} gr_tres_iter_t;
+
+/* s may be NULL, which yields no entries. */
+void gr_tres_init(gr_tres_iter_t *it, const char *s);
+
+/*
+ * Advances to the next entry. Returns 1 and fills tres, 0 at the end of the
+ * string, or -1 on a malformed gpu entry (it->cur points at it).
+ */
+int gr_tres_next(gr_tres_iter_t *it, gr_tres_t *tres);
+
+#endif
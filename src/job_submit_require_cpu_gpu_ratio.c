@@ -13,33 +13,26 @@
  * Note you will need to change several things in the configuration file to
  * specify the ratio to meet your own requirement.
  *
- * gcc -shared -fPIC -pthread -I${SLURM_SRC_DIR}
- *     job_submit_require_cpu_gpu_ratio.c -o job_submit_require_cpu_gpu_ratio.so
+ * The ratio policy itself lives in libgresratio (gresratio.h), this file
+ * only adapts it to the job_submit plugin interface. Build with make -C src.
  *
  */
 
-#include <limits.h>
-#include <regex.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
-#include <stdbool.h>
 
 #include <slurm/slurm_errno.h>
+#include "src/common/xstring.h"
 #include "src/slurmctld/slurmctld.h"
 
-#define BUFFER_SIZE 2048
-#define MAX_LINE_LENGTH 256
-#define MAX_ENTRIES 20
-#define SWITCH "enable_gres_ratio_plugin"
-#define SECTION "[gresratio]"
-#define ENABLED_PATTERN "=[ \t]*(true)"
-// #define DISABLED_PATTERN "=\\s*false\\b"
-#define EQUALS_PATTERN "=[ \t]*([a-zA-Z0-9.]+)"
-#define NAME_PATTERN "card\\.([a-zA-Z0-9]+)"
-#define EPSILON 1e-6
+#include "gresratio.h"
+#include "gresratio_trace.h"
+
+#define MSG_SIZE 512
+#define STRIPES 16
 
 /* Required by Slurm job_submit plugin interface. */
 const char plugin_name[] = "Require CPU/GPU ratio";
@@ -48,290 +41,348 @@ const uint32_t plugin_version = SLURM_VERSION_NUMBER;
 
 /* Global variables. */
 const char *myname = "job_submit_require_cpu_gpu_ratio";      // slurm requires?
-int disabled = 0; // defaults to false or 0 or enabled
-char default_card[MAX_LINE_LENGTH] = "V100";
-char partition[MAX_LINE_LENGTH] = "es1";
-const int npart = 1; // number of partitions to check
 const char *config_file = "job_submit_ratio_config.toml"; // name of config file
-char *usrmsg = NULL; //err message to user
-char *prefix; // For no gpu msg
-
-/* Card data structure */
-struct card {
-  char name[MAX_LINE_LENGTH];
-  float ratio;
-};
 
-/* Card information array */
-struct card entries[MAX_ENTRIES];
-int num_entries = 0;
-
-/* Parses a line for a boolean value after an equals sign. ex: example = false -> 0 */
-int parse_boolean(const char *line) {
-    regex_t regex;
-    int ret = regcomp(&regex, ENABLED_PATTERN, REG_EXTENDED | REG_ICASE);
-
-    if (ret) {
-        fprintf(stderr, "Could not compile regex\n");
-        regfree(&regex);
-        return EXIT_FAILURE; // ESLURM_INTERNAL
-    }
+/* job_modify() calls by outcome, striped over cache lines per thread. */
+struct modify_counter {
+    atomic_uint_fast64_t unset;     // update sets no ratio field
+    atomic_uint_fast64_t unchanged; // sets them to the job's own values
+    atomic_uint_fast64_t checked;
+} __attribute__((aligned(64)));
+
+static struct modify_counter modify_counters[STRIPES];
+static atomic_uint next_stripe;
+static _Thread_local struct modify_counter *my_counter;
+
+static struct modify_counter *modify_counter(void) {
+    if (my_counter == NULL)
+        my_counter = &modify_counters[atomic_fetch_add(&next_stripe, 1) %
+                                      STRIPES];
+    return my_counter;
+}
 
-    ret = regexec(&regex, line, 0, NULL, 0);
-    if (!ret) {
-        //printf("true\n"); // Match found
-        regfree(&regex);
-        return 0; // False
-    } else if (ret == REG_NOMATCH) {
-        //printf("asdf : False\n"); // No match
-        regfree(&regex);
-        return 1; // True
-    } else {
-        char msgbuf[100];
-        regerror(ret, &regex, msgbuf, sizeof(msgbuf));
-        fprintf(stderr, "Regex match failed: %s\n", msgbuf);
-        regfree(&regex);
-        return EXIT_FAILURE; // ESLURM_INTERNAL
+/* Sums the job_modify() counters, also read by tests/mock_slurmctld. */
+void _modify_stats(uint64_t *unset, uint64_t *unchanged, uint64_t *checked) {
+    *unset = *unchanged = *checked = 0;
+    for (int i = 0; i < STRIPES; i++) {
+        *unset += atomic_load_explicit(&modify_counters[i].unset,
+                                       memory_order_relaxed);
+        *unchanged += atomic_load_explicit(&modify_counters[i].unchanged,
+                                           memory_order_relaxed);
+        *checked += atomic_load_explicit(&modify_counters[i].checked,
+                                         memory_order_relaxed);
     }
-    regfree(&regex);
 }
 
-bool are_floats_equal(float var1, float var2, float epsilon) {
-    return fabs(var1 - var2) < epsilon;
+/*
+ * Main function. The message is only rendered when err_msg is given, into a
+ * stack buffer, and appended with xstrcat() to whatever an earlier plugin
+ * left there; Slurm xfree()s the result. res gets the decision for the
+ * stats.
+ */
+int _check_ratio(const gr_config_t *cfg, const char *part, const char *gres,
+                 uint32_t ncpu, gr_result_t *res, char **err_msg) {
+    char msg[MSG_SIZE];
+
+    if (gr_evaluate_cached(cfg, part, gres, ncpu, res, err_msg ? msg : NULL,
+                           sizeof(msg)) == GR_ACCEPT)
+        return SLURM_SUCCESS;
+
+    if (err_msg)
+        xstrcat(*err_msg, msg);
+    return ESLURM_INVALID_GRES;
 }
 
-/* Parses a string after an equals sign. Ex partition = es1 -> es1*/
-char* parse_string(const char *line, const char *pattern) {
-    // const char *pattern = "=\\ *([^\\ ]+)";
-    regex_t regex;
-    regmatch_t match[2]; // Array to hold match positions
-
-    // Compile the regex
-    int reti = regcomp(&regex, pattern, REG_EXTENDED);
-    if (reti) {
-        fprintf(stderr, "Could not compile regex\n");
-        regfree(&regex);
-        return NULL;
+/*
+ * mode = adjust: a job off the ratio gets the CPU count its GPUs need, in
+ * min_cpus and, for --cpus-per-gpu jobs, cpus_per_tres, plus a notice in
+ * err_msg. Jobs that cannot be fixed that way are rejected as usual. res
+ * gets the original decision, *adjusted whether the job was changed.
+ */
+int _adjust_ratio(const gr_config_t *cfg, struct job_descriptor *job_desc,
+                  const gr_job_t *job, const gr_shape_t *shape,
+                  gr_result_t *res, bool *adjusted, char **err_msg) {
+    gr_job_cpus_t fix;
+    uint32_t cpus;
+    char notice[MSG_SIZE];
+
+    *adjusted = false;
+    if (gr_evaluate_cached(cfg, job_desc->partition, shape->tres, shape->cpus,
+                           res, NULL, 0) == GR_ACCEPT)
+        return SLURM_SUCCESS;
+    if (res->decision != GR_REJECT_RATIO ||
+        (cpus = gr_adjust_cpus(cfg, job_desc->partition, shape->tres,
+                               shape->cpus, res)) == 0 ||
+        gr_job_adjust(job, shape, cpus, &fix) != 0)
+        return _check_ratio(cfg, job_desc->partition, shape->tres,
+                            shape->cpus, res, err_msg);
+
+    snprintf(notice, sizeof(notice),
+             "Note: CPU count changed from %u to %u to match the %s CPU/GPU "
+             "ratio of partition %s.\n",
+             shape->cpus, cpus,
+             res->mixed ? "weighted" : gr_card_name(cfg, res->card_id),
+             res->partition);
+    info("%s: adjusted CPUs of a job on %s from %u to %u per node", myname,
+         res->partition, shape->cpus, cpus);
+
+    job_desc->min_cpus = fix.min_cpus;
+    if (fix.cpus_per_gpu) {
+        char per_gpu[32];
+        snprintf(per_gpu, sizeof(per_gpu), "gres/gpu:%u", fix.cpus_per_gpu);
+        xfree(job_desc->cpus_per_tres);
+        job_desc->cpus_per_tres = xstrdup(per_gpu);
     }
+    if (err_msg)
+        xstrcat(*err_msg, notice);
+    *adjusted = true;
+    return SLURM_SUCCESS;
+}
 
-    // Execute the regex
-    reti = regexec(&regex, line, 2, match, 0);
-    if (!reti) {
-        // Extract matched substring
-        int start = match[1].rm_so;
-        int end = match[1].rm_eo;
-        int length = end - start;
-
-        // memory for the captured value
-        char *value = malloc(length + 1);
-        if (value == NULL) {
-            fprintf(stderr, "Memory allocation failed\n");
-            regfree(&regex);
-            return NULL;
-        }
+/* The fields of a job_descriptor the ratio depends on. */
+static gr_job_t _job_fields(const struct job_descriptor *job_desc) {
+    gr_job_t job = {
+        .tres_per_node = job_desc->tres_per_node,
+        .tres_per_job = job_desc->tres_per_job,
+        .tres_per_task = job_desc->tres_per_task,
+        .tres_per_socket = job_desc->tres_per_socket,
+        .cpus_per_tres = job_desc->cpus_per_tres,
+        .min_cpus = job_desc->min_cpus,
+        .min_nodes = job_desc->min_nodes,
+        .num_tasks = job_desc->num_tasks,
+        .cpus_per_task = job_desc->cpus_per_task,
+        .ntasks_per_node = job_desc->ntasks_per_node,
+        .sockets_per_node = job_desc->sockets_per_node,
+        .pn_min_cpus = job_desc->pn_min_cpus,
+    };
+    return job;
+}
 
-        strncpy(value, &line[start], length);
-        value[length] = '\0'; // Null-terminate the string
-
-        //  memory allocated to the pattern buffer by regcomp()
-        regfree(&regex);
-
-        return value;
-    } else if (reti == REG_NOMATCH) {
-        regfree(&regex);
-        return NULL; // No match found
-    } else {
-        char errbuf[100];
-        regerror(reti, &regex, errbuf, sizeof(errbuf));
-        fprintf(stderr, "Regex match failed: %s\n", errbuf);
-        regfree(&regex);
-        return NULL;
-    }
+/* The same fields of a job slurmctld already has, whole job CPUs included. */
+static gr_job_t _record_fields(const struct job_record *job_ptr) {
+    const struct job_details *details = job_ptr->details;
+    gr_job_t job = {
+        .tres_per_node = job_ptr->tres_per_node,
+        .tres_per_job = job_ptr->tres_per_job,
+        .tres_per_task = job_ptr->tres_per_task,
+        .tres_per_socket = job_ptr->tres_per_socket,
+        .cpus_per_tres = job_ptr->cpus_per_tres,
+        .min_cpus = job_ptr->total_cpus,
+        .min_nodes = details ? details->min_nodes : NO_VAL,
+        .num_tasks = details ? details->num_tasks : NO_VAL,
+        .cpus_per_task = details ? details->cpus_per_task : NO_VAL16,
+        .ntasks_per_node = details ? details->ntasks_per_node : NO_VAL16,
+        .sockets_per_node = details && details->mc_ptr ?
+                            details->mc_ptr->sockets_per_node : NO_VAL16,
+        .pn_min_cpus = details ? details->pn_min_cpus : NO_VAL16,
+    };
+    return job;
 }
 
+/* What an update does to the ratio fields, see _merge_*(). */
+struct merge {
+    bool set;     // the update carries at least one of them
+    bool changed; // and one differs from the job's own
+};
 
-void read_config(const char *filename) {
-    FILE *file = fopen(filename, "r");
-    if (file == NULL) {
-        perror("Error opening file");
-        exit(0); 
+static void _merge_str(const char **field, const char *update,
+                       struct merge *m) {
+    if (update == NULL)
+        return;
+    m->set = true;
+    if (*field == NULL || strcmp(*field, update) != 0) {
+        m->changed = true;
+        *field = update;
     }
+}
 
-    char *buffer = malloc(BUFFER_SIZE);
-    if (buffer == NULL) {
-        perror("Error allocating memory");
-        fclose(file);
-        exit(0);
+static void _merge_32(uint32_t *field, uint32_t update, struct merge *m) {
+    if (update == NO_VAL)
+        return;
+    m->set = true;
+    if (*field != update) {
+        m->changed = true;
+        *field = update;
     }
+}
 
-    while (fgets(buffer, BUFFER_SIZE, file) != NULL) {
-        if (strncmp(buffer, SWITCH, strlen(SWITCH)) == 0) {
-            /* If enableGresRatioPlugin is False then accept job*/
-            if(parse_boolean(buffer) == 1) {
-                //printf("Accepting Job\n");
-                disabled = 1;
-                break;
-                }
-            }
-
-        if (strncmp(buffer, "default_card", strlen("default_card")) == 0) {
-            // default_card = parse_string(buffer);
-            char *result = parse_string(buffer, EQUALS_PATTERN);
-
-            if (result) {
-                // Ensure the result fits in the global array
-                strncpy(default_card, result, MAX_LINE_LENGTH - 1);
-                default_card[MAX_LINE_LENGTH] = '\0'; // Ensure null-termination
-
-                //printf("Captured value: %s\n", default_card);
-                free(result); // Free the dynamically allocated memory
-            } else {
-                printf("No match found for default card \n"); // error no default card provided in config
-                // default_card[0] = '\0'; // Clear the global array if no match is found
-                free(result);
-                }
-            }
-
-        if (strncmp(buffer, "partition", strlen("partition")) == 0) {
-            char *result = parse_string(buffer, EQUALS_PATTERN);
-
-            if (result) {
-                // Ensure the result fits in the global array
-                strncpy(partition, result, MAX_LINE_LENGTH - 1);
-                partition[MAX_LINE_LENGTH] = '\0'; // null term
-
-                //printf("Captured value: %s\n", default_card);
-                free(result); 
-            } else {
-                printf("No match found for partition\n");
-                // default_card[0] = '\0'; // Clear the glob array if no match is found
-                free(result);
-                }
-            }
-
-        if (strncmp(buffer, "card.", strlen("card.")) == 0) {
-            char *result = parse_string(buffer, EQUALS_PATTERN);
-            char *name = parse_string(buffer, NAME_PATTERN);
-
-            if (result && name) {
-                // Ensure the result fits in the global array
-                float dub_ratio = strtof(result, NULL);
-                entries[num_entries].ratio = dub_ratio; 
-                strcpy(entries[num_entries].name, name);
-                free(result);
-                free(name);
-                num_entries += 1;
-            } else {
-                printf("No match found for %s \n", buffer);
-                free(result);
-                free(name);
-                }
-            }
-        }
-        free(buffer);
+static void _merge_16(uint16_t *field, uint16_t update, struct merge *m) {
+    if (update == NO_VAL16)
+        return;
+    m->set = true;
+    if (*field != update) {
+        m->changed = true;
+        *field = update;
     }
+}
 
-/* Function to find the index of a card by name in entries */
-int find_card_index(const char *card_name) {
-    for (int i = 0; i < num_entries; i++) {
-        if (strcasecmp(entries[i].name, card_name) == 0) {
-            return i;
-        }
-    }
-    return -1; // Card not found
+/* Appends a call to the trace file, callers check gr_trace_active() first. */
+static void _trace(uint32_t uid, uint8_t call, uint8_t flags,
+                   gr_decision_t decision, const char *part,
+                   const char *account, const gr_job_t *job) {
+    gr_trace_rec_t rec = {
+        .call = call,
+        .flags = flags,
+        .decision = decision,
+        .partition = part,
+        .account = account,
+        .job = *job,
+    };
+    gr_trace_record(uid, &rec);
 }
 
-/* Main function */
-int _check_ratio(char *part, char *gres, uint32_t ncpu, char **err_msg) {
+/* Loads the config and starts the watcher when slurmctld loads the plugin. */
+extern int init(void) {
+    gr_log_name = myname;
+    gr_set_log(info, error);
+    gr_set_debug(debug);
 
-    read_config(config_file);
+    if (gr_live_start(config_file, true) != 0)
+        return SLURM_ERROR;
 
-    if (disabled == 1) {
+    unsigned token;
+    const gr_config_t *cfg = gr_live_acquire(&token);
+    if (!gr_config_enabled(cfg))
         info("%s: Gres_Ratio plugin disabled", myname);
-        return SLURM_SUCCESS;
-    }
-
-    if (part == NULL) {
-        info("%s: missed partition info", myname);
-        return SLURM_SUCCESS;
-    }
-
-    const int npart = 1; // this was in the original, I assume since in the future there may be multiple partitions to check
-
-    /* Loop through all partitions that need to be checked. */
-    int i;
-    for (i = 0; i < npart; i++) {
-        if (strcmp(part, &partition[i * sizeof(partition)]) == 0) {
-            /* Require GRES on a GRES partition. */
-            if (gres == NULL) {
-                info("%s: missed GRES on partition %s", myname, &partition[i]);
-                return ESLURM_INVALID_GRES;
-            } else {
-                char card_name[MAX_LINE_LENGTH];
-                int gpu_count;
-                /* Check char *gres to see if it has gpu:NUMBER or if it has gpu:NAME:NUMBER by counting ":" 
-                        if it has gpu:NUMBER then set 
-                
-                */
-                // Check if gres has a card name (format "gpu:name:x")
-                if (sscanf(gres, "gpu:%39[^:]:%d", card_name, &gpu_count) == 2) {
-                    // Format with card name found
-                    prefix = " "; // this sucks but eh
-                } else if (sscanf(gres, "gpu:%d", &gpu_count) == 1) {
-                    // No card name, use default
-                    info("%s: User did not specify gpu, assuming default gpu", myname);
-                    prefix = "No GPU Specified, please specifiy which gpu when submitting jobs. (ex, V100) \n";
-                    strncpy(card_name, default_card, MAX_LINE_LENGTH);
-                } else {
-                    info("%s: missed GRES of %s", myname, card_name);
-                    return ESLURM_INVALID_GRES;
-                }
-                
-                // casting eh
-                float ratio = (float)ncpu / gpu_count;
-                
-                // Find the card index in entries
-                int index = find_card_index(card_name);
-                if (index == -1) {
-                    // Card not found in entries
-                    info("%s: config does not contain values for card %s", myname, card_name);
-                    return SLURM_SUCCESS;
-                }
-                
-                // Compare ratios
-                if (are_floats_equal(ratio, entries[index].ratio, EPSILON)) {\
-                    // info("Calculated ratio %f is equal to stored ratio %f. Job Accepted.\n", ratio, entries[index].ratio);
-                    return SLURM_SUCCESS; // False, calculated ratio is greater
-                } else {
-                    asprintf(&usrmsg, "%s Error: GPU/CPU ratio %f is less than or more than required ratio %f.\n",prefix, ratio, entries[index].ratio);
-                    *err_msg = usrmsg;
-                    // info("Calculated ratio %f is less than or more than stored ratio %f. Returning False.\n", ratio, entries[index].ratio);
-                    return ESLURM_INVALID_GRES; // True, calculated ratio is less than or equal
-                }
-            }   
-        }
-    }
-  return SLURM_SUCCESS;
+    else
+        info("%s: loaded %d card ratios for %d partitions", myname,
+             gr_config_num_cards(cfg), gr_config_num_partitions(cfg));
+    gr_live_release(token);
+    return SLURM_SUCCESS;
 }
 
+extern int fini(void) {
+    gr_cache_stats_t stats;
+    uint64_t unset, unchanged, checked;
+    gr_cache_stats(&stats);
+    _modify_stats(&unset, &unchanged, &checked);
+    info("%s: decision cache %lu hits %lu misses over %u slots", myname,
+         (unsigned long) stats.hits, (unsigned long) stats.misses,
+         stats.slots);
+    info("%s: job_modify %lu without ratio fields, %lu unchanged, %lu checked",
+         myname, (unsigned long) unset, (unsigned long) unchanged,
+         (unsigned long) checked);
+    gr_live_stop();
+    return SLURM_SUCCESS;
+}
 
+/*
+ * Exempt users, accounts, QOS and reservations are let through before the
+ * request is even parsed. The ratio is per node, so the rest is checked in
+ * per node shape. Every call is counted in the stats segment, if any.
+ */
 extern int job_submit(struct job_descriptor *job_desc, uint32_t submit_uid,
         char **err_msg) {
-    return _check_ratio(job_desc->partition,
-                        job_desc->tres_per_node,
-                        job_desc->min_cpus,
-                        err_msg);
+    uint64_t start = gr_stats_start();
+    unsigned token;
+    const gr_config_t *cfg = gr_live_acquire(&token);
+    if (gr_exempt(cfg, submit_uid, job_desc->account, job_desc->qos,
+                  job_desc->reservation)) {
+        gr_live_release(token);
+        gr_stats_exempt(start);
+        if (gr_trace_active()) {
+            gr_job_t job = _job_fields(job_desc);
+            _trace(submit_uid, GR_TRACE_SUBMIT, GR_TRACE_EXEMPT, GR_ACCEPT,
+                   job_desc->partition, job_desc->account, &job);
+        }
+        return SLURM_SUCCESS;
+    }
+
+    gr_job_t job = _job_fields(job_desc);
+    gr_shape_t shape;
+    gr_job_shape(&job, &shape);
+
+    gr_result_t res;
+    bool adjusted = false;
+    /* Checked once: a reload may attach the ring while adjusting. */
+    bool tracing = gr_trace_active();
+    char per_gpu[GR_TRACE_MAX_STRING + 1];
+    int rc;
+    if (gr_config_mode(cfg) == GR_MODE_ADJUST) {
+        /* The trace keeps the request as submitted, adjusting frees this. */
+        if (tracing && job.cpus_per_tres) {
+            snprintf(per_gpu, sizeof(per_gpu), "%s", job.cpus_per_tres);
+            job.cpus_per_tres = per_gpu;
+        }
+        rc = _adjust_ratio(cfg, job_desc, &job, &shape, &res, &adjusted,
+                           err_msg);
+    } else
+        rc = _check_ratio(cfg,
+                          job_desc->partition,
+                          shape.tres,
+                          shape.cpus,
+                          &res,
+                          err_msg);
+    gr_stats_record(cfg, &res, adjusted, start);
+    gr_live_release(token);
+    if (tracing)
+        _trace(submit_uid, GR_TRACE_SUBMIT, adjusted ? GR_TRACE_ADJUSTED : 0,
+               res.decision, job_desc->partition, job_desc->account, &job);
+    return rc;
 }
 
+/*
+ * Most updates (time limits, priorities, holds) touch none of the fields the
+ * ratio depends on, and fields set to what the job already has change
+ * nothing either. Those return before the config is even looked at; the
+ * rest are merged into the job's own fields and checked in per node shape,
+ * as job_submit() does.
+ */
 extern int job_modify(struct job_descriptor *job_desc,
         struct job_record *job_ptr, uint32_t submit_uid) {
-    
-    char *err_msg = NULL; // ugly
-
-    return _check_ratio(
-        job_desc->partition == NULL ? job_ptr->partition : job_desc->partition,
-        job_desc->tres_per_node == NULL ? job_ptr->tres_per_node : job_desc->tres_per_node,
-        job_desc->min_cpus == (uint32_t) -2 ? job_ptr->total_cpus :
-             job_desc->min_cpus,
-             &err_msg);
+    const char *part = job_ptr->partition;
+    gr_job_t job = _record_fields(job_ptr);
+    struct merge m = { false, false };
+    struct modify_counter *c = modify_counter();
+
+    _merge_str(&part, job_desc->partition, &m);
+    _merge_str(&job.tres_per_node, job_desc->tres_per_node, &m);
+    _merge_str(&job.tres_per_job, job_desc->tres_per_job, &m);
+    _merge_str(&job.tres_per_task, job_desc->tres_per_task, &m);
+    _merge_str(&job.tres_per_socket, job_desc->tres_per_socket, &m);
+    _merge_str(&job.cpus_per_tres, job_desc->cpus_per_tres, &m);
+    _merge_32(&job.min_cpus, job_desc->min_cpus, &m);
+    _merge_32(&job.min_nodes, job_desc->min_nodes, &m);
+    _merge_32(&job.num_tasks, job_desc->num_tasks, &m);
+    _merge_16(&job.cpus_per_task, job_desc->cpus_per_task, &m);
+    _merge_16(&job.ntasks_per_node, job_desc->ntasks_per_node, &m);
+    _merge_16(&job.sockets_per_node, job_desc->sockets_per_node, &m);
+    _merge_16(&job.pn_min_cpus, job_desc->pn_min_cpus, &m);
+    if (!m.changed) {
+        atomic_fetch_add_explicit(m.set ? &c->unchanged : &c->unset, 1,
+                                  memory_order_relaxed);
+        return SLURM_SUCCESS;
+    }
+    atomic_fetch_add_explicit(&c->checked, 1, memory_order_relaxed);
+
+    /* job_modify has no err_msg to hand back, so none is rendered. */
+    uint64_t start = gr_stats_start();
+    /* An update only carries what it changes, the rest is the job's. */
+    const char *account = job_desc->account ? job_desc->account :
+                                              job_ptr->account;
+    const char *qos = job_desc->qos ? job_desc->qos :
+                      job_ptr->qos_ptr ? job_ptr->qos_ptr->name : NULL;
+    const char *resv = job_desc->reservation ? job_desc->reservation :
+                                               job_ptr->resv_name;
+
+    unsigned token;
+    const gr_config_t *cfg = gr_live_acquire(&token);
+    if (gr_exempt(cfg, job_ptr->user_id, account, qos, resv)) {
+        gr_live_release(token);
+        gr_stats_exempt(start);
+        if (gr_trace_active())
+            _trace(job_ptr->user_id, GR_TRACE_MODIFY, GR_TRACE_EXEMPT,
+                   GR_ACCEPT, part, account, &job);
+        return SLURM_SUCCESS;
+    }
+    gr_shape_t shape;
+    gr_job_shape(&job, &shape);
+    gr_result_t res;
+    int rc = _check_ratio(cfg, part, shape.tres, shape.cpus, &res, NULL);
+    gr_stats_record(cfg, &res, false, start);
+    gr_live_release(token);
+    if (gr_trace_active())
+        _trace(job_ptr->user_id, GR_TRACE_MODIFY, 0, res.decision, part,
+               account, &job);
+    return rc;
 }
@@ -0,0 +1,322 @@
+// ratio_columns.c
+
+/*
+ * ratio-columns: converts squeue or sacct output into a column file (see
+ * gresratio_columns.h) for ratio-replay, so a year of job records is parsed
+ * once instead of on every question asked of it.
+ *
+ * ratio-columns [-o file] [input...]
+ *   -o  column file to write (default jobs.cols)
+ *
+ * Inputs are pipe delimited with a header line, "-" or none for stdin:
+ *
+ *   squeue -a -t all -o "%i|%u|%a|%P|%b|%C|%D"
+ *   sacct -a -X -P -o JobIDRaw,User,Account,Partition,ReqTRES,ReqCPUS,ReqNodes
+ *
+ * Columns are found by their header, case, '_' and '-' aside, in any order;
+ * ones not listed in fields[] are ignored. Step rows of sacct (a '.' in the
+ * job id) are skipped, and empty, "N/A" and "(null)" values count as not
+ * set. Each input may have its own header. sacct lists the untyped GPU
+ * total next to the typed entries that make it up, the total is dropped.
+ */
+
+#include <ctype.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gresratio.h"
+#include "gresratio_columns.h"
+#include "gresratio_tres.h"
+
+#define DEFAULT_OUTPUT "jobs.cols"
+#define MAX_FIELDS 128
+
+/* What a column of the input is used for. */
+enum field {
+    F_IGNORED,
+    F_JOBID,
+    F_USER,
+    F_ACCOUNT,
+    F_PARTITION,
+    F_TRES_PER_NODE,
+    F_TRES_PER_JOB,
+    F_TRES_PER_TASK,
+    F_CPUS_PER_TRES,
+    F_MIN_CPUS,
+    F_PN_MIN_CPUS,
+    F_MIN_NODES,
+    F_NUM_TASKS,
+};
+
+/* Header names, lower case without '_', '-' or blanks. */
+static const struct {
+    const char *name;
+    enum field field;
+} fields[] = {
+    { "jobid", F_JOBID },           { "jobidraw", F_JOBID },
+    { "user", F_USER },             { "username", F_USER },
+    { "uid", F_USER },              { "account", F_ACCOUNT },
+    { "partition", F_PARTITION },   { "trespernode", F_TRES_PER_NODE },
+    { "gres", F_TRES_PER_NODE },    { "tresperjob", F_TRES_PER_JOB },
+    { "reqtres", F_TRES_PER_JOB },  { "alloctres", F_TRES_PER_JOB },
+    { "trespertask", F_TRES_PER_TASK },
+    { "cpuspertres", F_CPUS_PER_TRES },
+    { "cpus", F_MIN_CPUS },         { "reqcpus", F_MIN_CPUS },
+    { "alloccpus", F_MIN_CPUS },    { "ncpus", F_MIN_CPUS },
+    { "mincpus", F_PN_MIN_CPUS },   { "nodes", F_MIN_NODES },
+    { "nnodes", F_MIN_NODES },      { "reqnodes", F_MIN_NODES },
+    { "allocnodes", F_MIN_NODES },  { "tasks", F_NUM_TASKS },
+    { "ntasks", F_NUM_TASKS },
+};
+
+struct input {
+    const char *name;
+    uint64_t line;
+    int num_fields;
+    enum field roles[MAX_FIELDS];
+};
+
+static enum field field_of(const char *header) {
+    char name[64];
+    size_t len = 0;
+
+    for (; *header && len + 1 < sizeof(name); header++)
+        if (*header != '_' && *header != '-' && !isspace((unsigned char) *header))
+            name[len++] = tolower((unsigned char) *header);
+    name[len] = '\0';
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+        if (strcmp(fields[i].name, name) == 0)
+            return fields[i].field;
+    return F_IGNORED;
+}
+
+/* Cuts line at every '|' into at most MAX_FIELDS values. */
+static int split(char *line, char **values) {
+    int n = 0;
+
+    line[strcspn(line, "\r\n")] = '\0';
+    for (;;) {
+        char *bar = strchr(line, '|');
+        if (n < MAX_FIELDS)
+            values[n++] = line;
+        if (bar == NULL)
+            return n;
+        *bar = '\0';
+        line = bar + 1;
+    }
+}
+
+static int read_header(struct input *in, char *line) {
+    char *values[MAX_FIELDS];
+    bool tres = false;
+
+    in->num_fields = split(line, values);
+    for (int i = 0; i < in->num_fields; i++) {
+        in->roles[i] = field_of(values[i]);
+        tres |= in->roles[i] >= F_TRES_PER_NODE &&
+                in->roles[i] <= F_TRES_PER_TASK;
+    }
+    if (!tres) {
+        fprintf(stderr, "ratio-columns: %s: no TRES column in the header\n",
+                in->name);
+        return -1;
+    }
+    return 0;
+}
+
+static const char *value_of(const char *s) {
+    if (*s == '\0' || strcmp(s, "N/A") == 0 || strcmp(s, "(null)") == 0)
+        return NULL;
+    return s;
+}
+
+/* Leading decimal count of s, 0 for none, clamped to max. */
+static uint32_t count_of(const char *s, uint32_t max) {
+    unsigned long long n = s ? strtoull(s, NULL, 10) : 0;
+    return n > max ? max : n;
+}
+
+/*
+ * Drops the untyped gpu entries of a TRES list in place when it has typed
+ * ones: "gres/gpu=2,gres/gpu:a100=2" is two A100s, not two plus two of
+ * mixed cards.
+ */
+static void drop_gpu_total(char *tres) {
+    gr_tres_iter_t it;
+    gr_tres_t t;
+    bool typed = false;
+    int rc;
+
+    gr_tres_init(&it, tres);
+    while ((rc = gr_tres_next(&it, &t)) > 0)
+        typed |= t.type.len && gr_slice_eq(t.name, "gpu");
+    if (rc < 0 || !typed)
+        return;
+
+    char *out = tres;
+    gr_tres_init(&it, tres);
+    for (const char *start = it.cur; gr_tres_next(&it, &t) > 0;
+         start = it.cur) {
+        start += strspn(start, ",;");
+        if (gr_slice_eq(t.name, "gpu") && t.type.len == 0)
+            continue;
+        if (out > tres)
+            *out++ = ',';
+        memmove(out, start, it.cur - start);
+        out += it.cur - start;
+    }
+    *out = '\0';
+}
+
+/* Fills row from one line. Returns false for sacct step rows. */
+static bool read_row(const struct input *in, char **values, int num,
+                     gr_columns_row_t *row) {
+    gr_job_t *job = &row->job;
+
+    memset(row, 0, sizeof(*row));
+    for (int i = 0; i < num && i < in->num_fields; i++) {
+        const char *v = value_of(values[i]);
+        char *end;
+
+        switch (in->roles[i]) {
+        case F_JOBID:
+            if (v && strchr(v, '.'))
+                return false;
+            row->jobid = v ? strtoull(v, &end, 10) : 0;
+            if (v && *end != '\0')
+                row->jobid = 0;
+            break;
+        case F_USER:
+            row->user = v;
+            break;
+        case F_ACCOUNT:
+            row->account = v;
+            break;
+        case F_PARTITION:
+            row->partition = v;
+            break;
+        case F_TRES_PER_NODE:
+            job->tres_per_node = v;
+            break;
+        case F_TRES_PER_JOB:
+            if (v)
+                drop_gpu_total(values[i]);
+            job->tres_per_job = v;
+            break;
+        case F_TRES_PER_TASK:
+            job->tres_per_task = v;
+            break;
+        case F_CPUS_PER_TRES:
+            job->cpus_per_tres = v;
+            break;
+        case F_MIN_CPUS:
+            job->min_cpus = count_of(v, UINT32_MAX - 2);
+            break;
+        case F_PN_MIN_CPUS:
+            job->pn_min_cpus = count_of(v, UINT16_MAX - 2);
+            break;
+        case F_MIN_NODES:
+            job->min_nodes = count_of(v, UINT32_MAX - 2);
+            break;
+        case F_NUM_TASKS:
+            job->num_tasks = count_of(v, UINT32_MAX - 2);
+            break;
+        case F_IGNORED:
+            break;
+        }
+    }
+    return true;
+}
+
+static int convert(gr_columns_writer_t *w, struct input *in, FILE *file,
+                   uint64_t *jobs, uint64_t *steps) {
+    char *line = NULL, *values[MAX_FIELDS];
+    size_t size = 0;
+    int rc = 0;
+
+    while (getline(&line, &size, file) >= 0) {
+        gr_columns_row_t row;
+
+        if (in->line++ == 0) {
+            if ((rc = read_header(in, line)) != 0)
+                break;
+            continue;
+        }
+        if (line[strspn(line, " \t\r\n")] == '\0')
+            continue;
+        int num = split(line, values);
+        if (!read_row(in, values, num, &row)) {
+            (*steps)++;
+            continue;
+        }
+        if (gr_columns_add(w, &row) != 0) {
+            fprintf(stderr, "ratio-columns: %s:%llu: cannot add the job\n",
+                    in->name, (unsigned long long) in->line);
+            rc = -1;
+            break;
+        }
+        (*jobs)++;
+    }
+    if (rc == 0 && ferror(file)) {
+        fprintf(stderr, "ratio-columns: cannot read %s\n", in->name);
+        rc = -1;
+    }
+    free(line);
+    return rc;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-o file] [input...]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    const char *output = DEFAULT_OUTPUT;
+    uint64_t jobs = 0, steps = 0;
+    int opt, rc = 1;
+
+    while ((opt = getopt(argc, argv, "o:h")) != -1) {
+        switch (opt) {
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+
+    gr_log_name = "ratio-columns";
+    gr_columns_writer_t *w = gr_columns_writer();
+    if (w == NULL) {
+        fprintf(stderr, "ratio-columns: out of memory\n");
+        return 1;
+    }
+    for (int i = optind; i < argc || i == optind; i++) {
+        bool stdin_ = i == argc || strcmp(argv[i], "-") == 0;
+        struct input in = { .name = stdin_ ? "stdin" : argv[i] };
+        FILE *file = stdin_ ? stdin : fopen(argv[i], "r");
+
+        if (file == NULL) {
+            fprintf(stderr, "ratio-columns: cannot open %s: %m\n", argv[i]);
+            goto out;
+        }
+        int failed = convert(w, &in, file, &jobs, &steps);
+        if (!stdin_)
+            fclose(file);
+        if (failed)
+            goto out;
+    }
+    if (gr_columns_write(w, output) != 0)
+        goto out;
+    fprintf(stderr, "ratio-columns: %llu jobs to %s, %llu step rows "
+            "skipped\n", (unsigned long long) jobs, output,
+            (unsigned long long) steps);
+    rc = 0;
+
+out:
+    gr_columns_writer_free(w);
+    return rc;
+}
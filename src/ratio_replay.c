@@ -0,0 +1,1048 @@
+// ratio_replay.c
+
+/*
+ * ratio-replay: checks every job of a trace file (see gresratio_trace.h)
+ * or column file (see gresratio_columns.h) against one or more configs the
+ * way the plugin would, to see what a config change would have done to the
+ * jobs actually submitted.
+ *
+ * ratio-replay [-t threads] [-p] [-d] [-n groups] trace|columns config...
+ *   -t  worker threads (default: one per online CPU)
+ *   -p  also break decisions down by partition policy
+ *   -d  diff two configs, old then new: list the jobs one accepts and the
+ *       other rejects by partition, card, account and user
+ *   -n  groups listed per breakdown of -d (default 10)
+ *
+ * The trace is mapped read only and cut into chunks of CHUNK granules.
+ * Each worker starts with an equal run of chunks and takes them from the
+ * front; one that runs dry steals the back half of the largest run left.
+ * Every record is shaped and evaluated through the decision cache against
+ * each config in turn, as _check_ratio() does in the plugin.
+ *
+ * A column file is cut into chunks of ROWS_CHUNK rows within one partition
+ * instead. Its rows are already shaped, and the plain single card ones go
+ * through gr_evaluate_batch() straight from the mapped CPU and GPU columns;
+ * only the card codes are translated to each config's card ids per chunk.
+ * Rows with any other TRES, exempt rows and partition lists are evaluated
+ * one by one as above.
+ *
+ * Workers only count, and counts are merged by adding them up, so what is
+ * printed on stdout is the same for any number of threads; the timing goes
+ * to stderr. With -d both configs are evaluated in the same pass over a
+ * record, and each group keeps the first flipped job in trace (or file)
+ * order as its example, which the merge keeps deterministic as well.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gresratio.h"
+#include "gresratio_columns.h"
+#include "gresratio_trace.h"
+
+#define CHUNK 4096 // granules, 64 KiB of trace
+#define ROWS_CHUNK 8192 // rows of a column file
+#define ROW_WORDS (ROWS_CHUNK / 64)
+#define POLICY_ROWS (-2) // a partition list, evaluated row by row
+#define MAX_THREADS 256
+#define REASONS (GR_REJECT_RATIO + 1)
+#define DEFAULT_GROUPS 10
+
+static const char *const reason_names[REASONS] = {
+    "accepted", "no GRES", "not a GPU", "ratio",
+};
+
+/* What one config made of the records a worker saw. */
+struct tally {
+    uint64_t exempt;
+    uint64_t decisions[REASONS];
+    uint64_t changed; // decided otherwise than the trace says
+    uint64_t (*parts)[2]; // accepted, rejected by policy_id + 1, 0 for none
+};
+
+/* Breakdowns of -d. */
+enum { BY_PARTITION, BY_CARD, BY_ACCOUNT, BY_USER, NUM_BY };
+
+static const char *const by_names[NUM_BY] = {
+    "partition", "card", "account", "user",
+};
+
+/* Jobs that flipped between the two configs of -d, for one key. */
+struct group {
+    char *key;
+    uint64_t flips[2]; // newly rejected, newly accepted
+    uint64_t example;  // granule of the first of them in the trace, or row
+};
+
+/* Open addressing on the key; groups are few, jobs that flip rare. */
+struct group_map {
+    struct group *slots;
+    uint32_t num;
+    uint32_t size; // power of two
+};
+
+/*
+ * A worker's run of chunks [begin, end), packed in one word so the owner
+ * taking from the front and thieves cutting off the back agree with a
+ * single compare and swap.
+ */
+struct worker {
+    _Atomic uint64_t run;
+    pthread_t thread;
+    struct replay *replay;
+    uint64_t records;
+    uint64_t calls[GR_TRACE_MODIFY + 1];
+    uint64_t first_ms;
+    uint64_t last_ms;
+    struct tally *tallies; // one per config
+    uint64_t flips[2]; // -d: newly rejected, newly accepted
+    uint64_t other_reason; // -d: rejected by both, for different reasons
+    struct group_map groups[NUM_BY];
+    int32_t *card_ids; // columns: of the rows of a chunk
+    uint64_t *masks;   // columns: special rows, skipped rows, accepted per config
+} __attribute__((aligned(64)));
+
+/*
+ * What a config makes of the dictionaries of a column file, worked out once
+ * so that rows are checked by their codes.
+ */
+struct plan {
+    int *policy;              // by partition code, -1 for none
+    int32_t *cards;           // by card code
+    uint8_t *exempt_users;    // by user code
+    uint8_t *exempt_accounts; // by account code
+    bool any_exempt;
+};
+
+struct replay {
+    const gr_trace_t *trace;
+    uint64_t first; // granules
+    uint64_t end;
+    const gr_columns_t *cols; // instead of trace
+    uint64_t *chunks; // columns: first row of each chunk, then rows
+    uint32_t *uids;   // columns: by user code, GR_NO_VAL if unknown here
+    struct plan *plans; // columns: one per config
+    uint32_t num_chunks;
+    int num_configs;
+    gr_config_t **configs;
+    bool diff; // -d, num_configs is 2
+    int num_workers;
+    struct worker *workers;
+};
+
+static uint64_t pack(uint32_t begin, uint32_t end) {
+    return begin | (uint64_t) end << 32;
+}
+
+/* Takes the next chunk of w's own run. */
+static bool take(struct worker *w, uint32_t *chunk) {
+    uint64_t run = atomic_load_explicit(&w->run, memory_order_relaxed);
+    uint32_t begin, end;
+
+    do {
+        begin = (uint32_t) run;
+        end = run >> 32;
+        if (begin >= end)
+            return false;
+    } while (!atomic_compare_exchange_weak(&w->run, &run,
+                                           pack(begin + 1, end)));
+    *chunk = begin;
+    return true;
+}
+
+/*
+ * Moves the back half of the largest run of the other workers into w's own,
+ * which is empty. Returns false once no work is left anywhere.
+ */
+static bool steal(struct worker *w) {
+    struct replay *r = w->replay;
+
+    for (;;) {
+        struct worker *victim = NULL;
+        uint64_t run = 0;
+        uint32_t most = 0;
+
+        for (int i = 0; i < r->num_workers; i++) {
+            uint64_t v = atomic_load_explicit(&r->workers[i].run,
+                                              memory_order_relaxed);
+            uint32_t left = (uint32_t) (v >> 32) - (uint32_t) v;
+            if ((uint32_t) v < v >> 32 && left > most) {
+                victim = &r->workers[i];
+                run = v;
+                most = left;
+            }
+        }
+        if (victim == NULL)
+            return false;
+
+        uint32_t begin = (uint32_t) run, end = run >> 32;
+        uint32_t mid = begin + most / 2;
+        if (atomic_compare_exchange_strong(&victim->run, &run,
+                                           pack(begin, mid))) {
+            atomic_store(&w->run, pack(mid, end));
+            return true;
+        }
+    }
+}
+
+/*
+ * The plugin's decision for rec, in per node shape, under cfg. The trace
+ * only has a hash of the uid and no QOS or reservation, so a job that was
+ * let through as exempt stays exempt; exempt_accounts of cfg applies on top.
+ */
+static gr_decision_t replay_one(const gr_config_t *cfg,
+                                const gr_trace_rec_t *rec,
+                                const gr_shape_t *shape, bool *exempt,
+                                gr_result_t *res) {
+    *exempt = (rec->flags & GR_TRACE_EXEMPT) ||
+              gr_exempt(cfg, GR_NO_VAL, rec->account, NULL, NULL);
+    if (*exempt)
+        return GR_ACCEPT;
+    return gr_evaluate_cached(cfg, rec->partition, shape->tres, shape->cpus,
+                              res, NULL, 0);
+}
+
+static uint64_t key_hash(const char *s) {
+    uint64_t h = 14695981039346656037ULL;
+    while (*s)
+        h = (h ^ (unsigned char) *s++) * 1099511628211ULL;
+    return h ^ h >> 32;
+}
+
+static int grow(struct group_map *m) {
+    uint32_t size = m->size ? m->size * 2 : 64;
+    struct group *slots = calloc(size, sizeof(*slots));
+
+    if (slots == NULL)
+        return -1;
+    for (uint32_t i = 0; i < m->size; i++) {
+        if (m->slots[i].key == NULL)
+            continue;
+        uint32_t j = key_hash(m->slots[i].key) & (size - 1);
+        while (slots[j].key)
+            j = (j + 1) & (size - 1);
+        slots[j] = m->slots[i];
+    }
+    free(m->slots);
+    m->slots = slots;
+    m->size = size;
+    return 0;
+}
+
+/* The group of key, added if new. NULL when out of memory. */
+static struct group *group_of(struct group_map *m, const char *key) {
+    if (2 * (m->num + 1) > m->size && grow(m) != 0)
+        return NULL;
+
+    uint32_t mask = m->size - 1;
+    for (uint32_t i = key_hash(key) & mask;; i = (i + 1) & mask) {
+        struct group *g = &m->slots[i];
+        if (g->key == NULL) {
+            if ((g->key = strdup(key)) == NULL)
+                return NULL;
+            g->example = UINT64_MAX;
+            m->num++;
+            return g;
+        }
+        if (strcmp(g->key, key) == 0)
+            return g;
+    }
+}
+
+static void free_groups(struct group_map *m) {
+    for (uint32_t i = 0; i < m->size; i++)
+        free(m->slots[i].key);
+    free(m->slots);
+}
+
+static void add_flips(struct group *g, const uint64_t flips[2],
+                      uint64_t example) {
+    if (g == NULL) {
+        fprintf(stderr, "ratio-replay: out of memory\n");
+        exit(1);
+    }
+    g->flips[0] += flips[0];
+    g->flips[1] += flips[1];
+    if (example < g->example)
+        g->example = example;
+}
+
+/* -d: true if one config accepts the job and the other rejects it. */
+static bool flipped(struct worker *w, const gr_decision_t d[2]) {
+    if ((d[0] == GR_ACCEPT) == (d[1] == GR_ACCEPT)) {
+        if (d[0] != d[1])
+            w->other_reason++;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * -d: files a flipped job under the partition and card of the rejection,
+ * its account and its user.
+ */
+static void file_flip(struct worker *w, const gr_decision_t d[2],
+                      const gr_result_t res[2], const char *account,
+                      const char *user, uint64_t example) {
+    int accepted = d[1] == GR_ACCEPT;
+    const gr_config_t *cfg = w->replay->configs[accepted ? 0 : 1];
+    const gr_result_t *why = &res[accepted ? 0 : 1];
+    const char *card = why->mixed ? "mixed" : gr_card_name(cfg, why->card_id);
+    uint64_t flip[2] = { !accepted, accepted };
+    const char *keys[NUM_BY] = {
+        why->partition ? why->partition : "-",
+        card ? card : "-",
+        account ? account : "-",
+        user ? user : "-",
+    };
+
+    w->flips[accepted]++;
+    for (int b = 0; b < NUM_BY; b++)
+        add_flips(group_of(&w->groups[b], keys[b]), flip, example);
+}
+
+static void tally(struct tally *t, gr_decision_t d, bool exempt,
+                  const gr_result_t *res) {
+    if (exempt) {
+        t->exempt++;
+        return;
+    }
+    t->decisions[d]++;
+    t->parts[res->policy_id + 1][d != GR_ACCEPT]++;
+}
+
+/* The shape does not depend on the config, so it is worked out once. */
+static void count(struct worker *w, const gr_trace_rec_t *rec) {
+    struct replay *r = w->replay;
+    gr_shape_t shape;
+
+    w->records++;
+    w->calls[rec->call]++;
+    if (rec->time_ms < w->first_ms)
+        w->first_ms = rec->time_ms;
+    if (rec->time_ms > w->last_ms)
+        w->last_ms = rec->time_ms;
+    gr_job_shape(&rec->job, &shape);
+
+    gr_decision_t decided[2];
+    gr_result_t results[2];
+    for (int c = 0; c < r->num_configs; c++) {
+        struct tally *t = &w->tallies[c];
+        gr_result_t res;
+        bool exempt;
+        gr_decision_t d = replay_one(r->configs[c], rec, &shape, &exempt,
+                                     &res);
+
+        if (c < 2) {
+            decided[c] = d;
+            results[c] = res;
+        }
+        if (d != rec->decision)
+            t->changed++;
+        tally(t, d, exempt, &res);
+    }
+    if (r->diff && flipped(w, decided)) {
+        char user[16];
+        snprintf(user, sizeof(user), "%08x", rec->user);
+        file_flip(w, decided, results, rec->account, user, rec->granule);
+    }
+}
+
+/* The plugin's decision for a row of the column file under config c. */
+static gr_decision_t decide_row(const struct replay *r, int c, uint64_t row,
+                                bool *exempt, gr_result_t *res) {
+    const gr_columns_t *cols = r->cols;
+    const struct plan *plan = &r->plans[c];
+
+    *exempt = plan->exempt_users[cols->user[row]] ||
+              plan->exempt_accounts[cols->account[row]];
+    if (*exempt)
+        return GR_ACCEPT;
+    return gr_evaluate_cached(
+        r->configs[c],
+        gr_columns_string(cols, GR_DICT_PARTITION, cols->partition[row]),
+        gr_columns_string(cols, GR_DICT_TRES, cols->tres[row]),
+        cols->cpus[row], res, NULL, 0);
+}
+
+/* Bits of the last mask word that are rows of a chunk of n. */
+static uint64_t valid_bits(uint32_t n, uint32_t word) {
+    return word + 1 < (n + 63) / 64 || n % 64 == 0 ? ~0ull
+                                                   : (1ull << n % 64) - 1;
+}
+
+/*
+ * Rows [start, start + n) of one partition under config c. Bulk checks can
+ * only reject for the ratio; the special rows (no single card) and exempt
+ * ones are skipped in the counts and decided row by row. Leaves bit i of
+ * the config's mask set if row start + i was accepted.
+ */
+static void count_config(struct worker *w, int c, uint64_t start, uint32_t n,
+                         int policy) {
+    struct replay *r = w->replay;
+    const gr_columns_t *cols = r->cols;
+    const struct plan *plan = &r->plans[c];
+    struct tally *t = &w->tallies[c];
+    const uint64_t *special = w->masks;
+    uint64_t *skip = w->masks + ROW_WORDS;
+    uint64_t *accept = w->masks + (2 + c) * ROW_WORDS;
+    uint32_t words = (n + 63) / 64;
+    uint64_t evaluated = 0, accepted = 0;
+    gr_result_t res;
+    gr_decision_t d;
+    bool exempt;
+
+    if (policy == POLICY_ROWS) {
+        memset(accept, 0, words * sizeof(*accept));
+        for (uint32_t i = 0; i < n; i++) {
+            d = decide_row(r, c, start + i, &exempt, &res);
+            tally(t, d, exempt, &res);
+            accept[i / 64] |= (uint64_t) (d == GR_ACCEPT) << (i % 64);
+        }
+        return;
+    }
+
+    memcpy(skip, special, words * sizeof(*skip));
+    if (plan->any_exempt)
+        for (uint32_t i = 0; i < n; i++)
+            if (plan->exempt_users[cols->user[start + i]] ||
+                plan->exempt_accounts[cols->account[start + i]])
+                skip[i / 64] |= 1ull << (i % 64);
+    if (policy >= 0)
+        for (uint32_t i = 0; i < n; i++) {
+            uint16_t card = cols->card[start + i];
+            w->card_ids[i] = card == GR_COLS_NO_CARD ? GR_CARD_UNKNOWN
+                                                     : plan->cards[card];
+        }
+    gr_evaluate_batch(r->configs[c], policy, n, cols->cpus + start,
+                      cols->gpus + start, w->card_ids, accept, NULL);
+
+    for (uint32_t k = 0; k < words; k++) {
+        evaluated += __builtin_popcountll(valid_bits(n, k) & ~skip[k]);
+        accepted += __builtin_popcountll(accept[k] & ~skip[k]);
+        for (uint64_t bits = skip[k]; bits; bits &= bits - 1) {
+            int bit = __builtin_ctzll(bits);
+            d = decide_row(r, c, start + k * 64 + bit, &exempt, &res);
+            tally(t, d, exempt, &res);
+            if (d == GR_ACCEPT)
+                accept[k] |= 1ull << bit;
+            else
+                accept[k] &= ~(1ull << bit);
+        }
+    }
+    t->decisions[GR_ACCEPT] += accepted;
+    t->decisions[GR_REJECT_RATIO] += evaluated - accepted;
+    t->parts[policy + 1][0] += accepted;
+    t->parts[policy + 1][1] += evaluated - accepted;
+}
+
+/*
+ * -d on a chunk: the masks give the flips. Rows both configs reject are
+ * only decided again where the reasons can differ, as a bulk rejection is
+ * always for the ratio.
+ */
+static void diff_rows(struct worker *w, uint64_t start, uint32_t n,
+                      bool by_row) {
+    struct replay *r = w->replay;
+    const gr_columns_t *cols = r->cols;
+    const uint64_t *special = w->masks;
+    const uint64_t *a = w->masks + 2 * ROW_WORDS, *b = a + ROW_WORDS;
+
+    for (uint32_t k = 0; k < (n + 63) / 64; k++) {
+        uint64_t both = ~a[k] & ~b[k] & valid_bits(n, k);
+        uint64_t look = (a[k] ^ b[k]) | (by_row ? both : both & special[k]);
+
+        for (; look; look &= look - 1) {
+            uint64_t row = start + k * 64 + __builtin_ctzll(look);
+            gr_decision_t d[2];
+            gr_result_t res[2];
+            bool exempt;
+
+            for (int c = 0; c < 2; c++)
+                d[c] = decide_row(r, c, row, &exempt, &res[c]);
+            if (flipped(w, d))
+                file_flip(w, d, res,
+                          gr_columns_string(cols, GR_DICT_ACCOUNT,
+                                            cols->account[row]),
+                          gr_columns_string(cols, GR_DICT_USER,
+                                            cols->user[row]),
+                          row);
+        }
+    }
+}
+
+/* Rows [start, end) of a column file, all of one partition. */
+static void count_rows(struct worker *w, uint64_t start, uint64_t end) {
+    struct replay *r = w->replay;
+    const gr_columns_t *cols = r->cols;
+    uint32_t n = end - start;
+    uint16_t part = cols->partition[start];
+    uint64_t *special = w->masks;
+    bool by_row = false;
+
+    w->records += n;
+    memset(special, 0, ROW_WORDS * sizeof(*special));
+    for (uint32_t i = 0; i < n; i++)
+        special[i / 64] |=
+            (uint64_t) (cols->card[start + i] == GR_COLS_NO_CARD) << (i % 64);
+    for (int c = 0; c < r->num_configs; c++) {
+        int policy = r->plans[c].policy[part];
+        count_config(w, c, start, n, policy);
+        by_row |= c < 2 && policy == POLICY_ROWS;
+    }
+    if (r->diff)
+        diff_rows(w, start, n, by_row);
+}
+
+static void *work(void *arg) {
+    struct worker *w = arg;
+    struct replay *r = w->replay;
+    static _Thread_local char buf[GR_TRACE_MAX_RECORD];
+    gr_trace_rec_t rec;
+    uint32_t chunk;
+
+    for (;;) {
+        while (take(w, &chunk)) {
+            if (r->cols) {
+                count_rows(w, r->chunks[chunk], r->chunks[chunk + 1]);
+                continue;
+            }
+            uint64_t pos = r->first + (uint64_t) chunk * CHUNK;
+            uint64_t end = pos + CHUNK < r->end ? pos + CHUNK : r->end;
+            while (gr_trace_next(r->trace, &pos, end, &rec, buf))
+                count(w, &rec);
+        }
+        if (!steal(w))
+            return NULL;
+    }
+}
+
+/* Adds the tallies of every worker into the first one. */
+static void merge(struct replay *r) {
+    struct worker *all = &r->workers[0];
+
+    for (int i = 1; i < r->num_workers; i++) {
+        struct worker *w = &r->workers[i];
+        all->records += w->records;
+        for (int k = 0; k <= GR_TRACE_MODIFY; k++)
+            all->calls[k] += w->calls[k];
+        if (w->first_ms < all->first_ms)
+            all->first_ms = w->first_ms;
+        if (w->last_ms > all->last_ms)
+            all->last_ms = w->last_ms;
+        for (int c = 0; c < r->num_configs; c++) {
+            struct tally *t = &all->tallies[c], *u = &w->tallies[c];
+            t->exempt += u->exempt;
+            t->changed += u->changed;
+            for (int d = 0; d < REASONS; d++)
+                t->decisions[d] += u->decisions[d];
+            for (int p = 0; p <= gr_config_num_partitions(r->configs[c]); p++) {
+                t->parts[p][0] += u->parts[p][0];
+                t->parts[p][1] += u->parts[p][1];
+            }
+        }
+        all->flips[0] += w->flips[0];
+        all->flips[1] += w->flips[1];
+        all->other_reason += w->other_reason;
+        for (int b = 0; b < NUM_BY; b++) {
+            const struct group_map *m = &w->groups[b];
+            for (uint32_t j = 0; j < m->size; j++)
+                if (m->slots[j].key)
+                    add_flips(group_of(&all->groups[b], m->slots[j].key),
+                              m->slots[j].flips, m->slots[j].example);
+        }
+    }
+}
+
+static int setup_workers(struct replay *r, int threads) {
+    r->num_workers = threads;
+    r->workers = aligned_alloc(64, threads * sizeof(*r->workers));
+    if (r->workers == NULL)
+        return -1;
+    memset(r->workers, 0, threads * sizeof(*r->workers));
+
+    for (int i = 0; i < threads; i++) {
+        struct worker *w = &r->workers[i];
+        uint32_t begin = (uint64_t) r->num_chunks * i / threads;
+        uint32_t end = (uint64_t) r->num_chunks * (i + 1) / threads;
+
+        atomic_init(&w->run, pack(begin, end));
+        w->replay = r;
+        w->first_ms = UINT64_MAX;
+        if ((w->tallies = calloc(r->num_configs, sizeof(*w->tallies))) == NULL)
+            return -1;
+        for (int c = 0; c < r->num_configs; c++) {
+            int n = gr_config_num_partitions(r->configs[c]) + 1;
+            if ((w->tallies[c].parts = calloc(n, sizeof(uint64_t[2]))) == NULL)
+                return -1;
+        }
+        if (r->cols &&
+            ((w->card_ids = malloc(ROWS_CHUNK * sizeof(*w->card_ids))) ==
+                 NULL ||
+             (w->masks = malloc((2 + r->num_configs) * ROW_WORDS *
+                                sizeof(*w->masks))) == NULL))
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * UID of a user column entry, a name or a number, GR_NO_VAL if it does not
+ * resolve on this host.
+ */
+static uint32_t uid_of(const char *name) {
+    struct passwd pw, *found = NULL;
+    long size = sysconf(_SC_GETPW_R_SIZE_MAX);
+    char *buf = NULL, *end;
+    uint32_t result = GR_NO_VAL;
+    int rc;
+
+    if (name == NULL)
+        return GR_NO_VAL;
+    unsigned long uid = strtoul(name, &end, 10);
+    if (end != name && *end == '\0')
+        return uid < GR_NO_VAL ? uid : GR_NO_VAL;
+
+    if (size <= 0)
+        size = 1024;
+    do {
+        char *grown = realloc(buf, size);
+        if (grown == NULL) {
+            rc = ENOMEM;
+            break;
+        }
+        buf = grown;
+        rc = getpwnam_r(name, &pw, buf, size, &found);
+        size *= 2;
+    } while (rc == ERANGE && size <= 1 << 20);
+    if (rc == 0 && found)
+        result = pw.pw_uid;
+    free(buf);
+    return result;
+}
+
+static int make_plan(struct replay *r, int c) {
+    const gr_columns_t *cols = r->cols;
+    const gr_config_t *cfg = r->configs[c];
+    struct plan *plan = &r->plans[c];
+    uint32_t parts = gr_columns_dict_size(cols, GR_DICT_PARTITION);
+    uint32_t cards = gr_columns_dict_size(cols, GR_DICT_CARD);
+    uint32_t users = gr_columns_dict_size(cols, GR_DICT_USER);
+    uint32_t accounts = gr_columns_dict_size(cols, GR_DICT_ACCOUNT);
+
+    plan->policy = malloc((parts + 1) * sizeof(*plan->policy));
+    plan->cards = malloc((cards + 1) * sizeof(*plan->cards));
+    plan->exempt_users = malloc(users + 1);
+    plan->exempt_accounts = malloc(accounts + 1);
+    if (!plan->policy || !plan->cards || !plan->exempt_users ||
+        !plan->exempt_accounts)
+        return -1;
+
+    for (uint32_t p = 0; p < parts; p++) {
+        const char *name = gr_columns_string(cols, GR_DICT_PARTITION, p);
+        gr_result_t res;
+
+        /* A policy that applies rejects a job without GRES. */
+        if (name && strchr(name, ','))
+            plan->policy[p] = POLICY_ROWS;
+        else if (gr_evaluate(cfg, name, NULL, 0, &res) == GR_ACCEPT)
+            plan->policy[p] = -1;
+        else
+            plan->policy[p] = res.policy_id;
+    }
+    for (uint32_t k = 0; k < cards; k++)
+        plan->cards[k] =
+            gr_card_id(cfg, gr_columns_string(cols, GR_DICT_CARD, k));
+    for (uint32_t u = 0; u < users; u++)
+        plan->any_exempt |= plan->exempt_users[u] =
+            gr_exempt(cfg, r->uids[u], NULL, NULL, NULL);
+    for (uint32_t a = 0; a < accounts; a++)
+        plan->any_exempt |= plan->exempt_accounts[a] = gr_exempt(
+            cfg, GR_NO_VAL, gr_columns_string(cols, GR_DICT_ACCOUNT, a),
+            NULL, NULL);
+    return 0;
+}
+
+/* Chunks that never straddle two partitions, and a plan per config. */
+static int setup_columns(struct replay *r) {
+    const gr_columns_t *cols = r->cols;
+    uint32_t parts = gr_columns_dict_size(cols, GR_DICT_PARTITION);
+    uint32_t users = gr_columns_dict_size(cols, GR_DICT_USER);
+
+    r->chunks = malloc((cols->rows / ROWS_CHUNK + parts + 1) *
+                       sizeof(*r->chunks));
+    r->uids = malloc((users + 1) * sizeof(*r->uids));
+    r->plans = calloc(r->num_configs, sizeof(*r->plans));
+    if (!r->chunks || !r->uids || !r->plans)
+        return -1;
+
+    for (uint32_t p = 0; p < parts; p++)
+        for (uint64_t row = cols->groups[p]; row < cols->groups[p + 1];
+             row += ROWS_CHUNK)
+            r->chunks[r->num_chunks++] = row;
+    r->chunks[r->num_chunks] = cols->rows;
+    /* Users that do not resolve here lose any exempt_users exemption. */
+    const char *unknown = NULL;
+    uint32_t num_unknown = 0;
+    for (uint32_t u = 0; u < users; u++) {
+        const char *name = gr_columns_string(cols, GR_DICT_USER, u);
+        if ((r->uids[u] = uid_of(name)) == GR_NO_VAL && name) {
+            unknown = unknown ? unknown : name;
+            num_unknown++;
+        }
+    }
+    if (num_unknown)
+        fprintf(stderr, "ratio-replay: %u users (%s first) do not resolve "
+                "here and are never exempt_users\n", num_unknown, unknown);
+    for (int c = 0; c < r->num_configs; c++)
+        if (make_plan(r, c) != 0)
+            return -1;
+    return 0;
+}
+
+static void free_columns(struct replay *r) {
+    for (int c = 0; r->plans && c < r->num_configs; c++) {
+        free(r->plans[c].policy);
+        free(r->plans[c].cards);
+        free(r->plans[c].exempt_users);
+        free(r->plans[c].exempt_accounts);
+    }
+    free(r->plans);
+    free(r->uids);
+    free(r->chunks);
+    gr_columns_unmap((gr_columns_t *) r->cols);
+}
+
+static void free_workers(struct replay *r) {
+    for (int i = 0; r->workers && i < r->num_workers; i++) {
+        for (int c = 0; r->workers[i].tallies && c < r->num_configs; c++)
+            free(r->workers[i].tallies[c].parts);
+        free(r->workers[i].tallies);
+        for (int b = 0; b < NUM_BY; b++)
+            free_groups(&r->workers[i].groups[b]);
+        free(r->workers[i].card_ids);
+        free(r->workers[i].masks);
+    }
+    free(r->workers);
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * part / whole : 0;
+}
+
+static void format_time(uint64_t ms, char *buf, size_t size) {
+    time_t t = ms / 1000;
+    struct tm tm;
+    strftime(buf, size, "%Y-%m-%d %H:%M:%S", localtime_r(&t, &tm));
+}
+
+static void print_trace_header(const struct worker *all,
+                               const char *trace_name) {
+    printf("%s: %llu records (%llu submits, %llu modifies)", trace_name,
+           (unsigned long long) all->records,
+           (unsigned long long) all->calls[GR_TRACE_SUBMIT],
+           (unsigned long long) all->calls[GR_TRACE_MODIFY]);
+    if (all->records) {
+        char from[32], to[32];
+        format_time(all->first_ms, from, sizeof(from));
+        format_time(all->last_ms, to, sizeof(to));
+        printf(", %s to %s", from, to);
+    }
+    printf("\n");
+}
+
+static void print_results(const struct replay *r, const char *input_name,
+                          char **config_names, bool by_partition) {
+    const struct worker *all = &r->workers[0];
+
+    if (r->cols) {
+        printf("%s: %llu jobs\n", input_name,
+               (unsigned long long) all->records);
+    } else {
+        print_trace_header(all, input_name);
+    }
+
+    for (int c = 0; c < r->num_configs; c++) {
+        const gr_config_t *cfg = r->configs[c];
+        const struct tally *t = &all->tallies[c];
+        uint64_t rejected = 0, evaluated;
+
+        for (int d = 1; d < REASONS; d++)
+            rejected += t->decisions[d];
+        evaluated = t->decisions[GR_ACCEPT] + rejected;
+
+        printf("\n%s\n", config_names[c]);
+        printf("jobs      %llu evaluated, %llu rejected (%.2f%%), "
+               "%llu exempt", (unsigned long long) evaluated,
+               (unsigned long long) rejected, percent(rejected, evaluated),
+               (unsigned long long) t->exempt);
+        if (!r->cols)
+            printf(", %llu changed from the trace",
+                   (unsigned long long) t->changed);
+        printf("\n");
+        printf("rejected ");
+        for (int d = 1; d < REASONS; d++)
+            printf(" %s %llu%s", reason_names[d],
+                   (unsigned long long) t->decisions[d],
+                   d + 1 < REASONS ? "," : "\n");
+        if (!by_partition)
+            continue;
+
+        printf("%-20s %12s %12s %8s\n", "partition", "accepted", "rejected",
+               "%");
+        for (int p = 0; p <= gr_config_num_partitions(cfg); p++) {
+            uint64_t a = t->parts[p][0], j = t->parts[p][1];
+            if (a == 0 && j == 0)
+                continue;
+            printf("%-20s %12llu %12llu %8.2f\n",
+                   p ? gr_partition_name(cfg, p - 1) : "-",
+                   (unsigned long long) a, (unsigned long long) j,
+                   percent(j, a + j));
+        }
+    }
+}
+
+/* Most flips first, ties by name so the order never depends on threads. */
+static int by_flips(const void *a, const void *b) {
+    const struct group *x = a, *y = b;
+    uint64_t nx = x->flips[0] + x->flips[1], ny = y->flips[0] + y->flips[1];
+
+    if (nx != ny)
+        return nx > ny ? -1 : 1;
+    return strcmp(x->key, y->key);
+}
+
+static const char *const decision_names[REASONS] = {
+    "accepted", "rejected: no GRES", "rejected: not a GPU", "rejected: ratio",
+};
+
+/* Prints the row of a column file as decided by both configs of -d. */
+static void print_row(const struct replay *r, uint64_t row) {
+    const gr_columns_t *cols = r->cols;
+    const char *user = gr_columns_string(cols, GR_DICT_USER, cols->user[row]);
+    const char *account =
+        gr_columns_string(cols, GR_DICT_ACCOUNT, cols->account[row]);
+    const char *part =
+        gr_columns_string(cols, GR_DICT_PARTITION, cols->partition[row]);
+    const char *tres = gr_columns_string(cols, GR_DICT_TRES, cols->tres[row]);
+    gr_decision_t d[2];
+
+    for (int c = 0; c < 2; c++) {
+        gr_result_t res;
+        bool exempt;
+        d[c] = decide_row(r, c, row, &exempt, &res);
+    }
+    printf("  e.g. job %llu user %s account %s partition %s: %s, %u CPUs "
+           "per node: %s -> %s\n", (unsigned long long) cols->jobid[row],
+           user ? user : "-", account ? account : "-", part ? part : "-",
+           tres ? tres : "no GRES", cols->cpus[row], decision_names[d[0]],
+           decision_names[d[1]]);
+}
+
+/* Prints the job at granule (row) as decided by both configs of -d. */
+static void print_example(const struct replay *r, uint64_t granule) {
+    static char buf[GR_TRACE_MAX_RECORD];
+    gr_trace_rec_t rec;
+    gr_shape_t shape;
+    uint64_t pos = granule;
+    char when[32];
+
+    if (r->cols) {
+        print_row(r, granule);
+        return;
+    }
+    if (!gr_trace_next(r->trace, &pos, granule + 1, &rec, buf)) {
+        printf("  e.g. (overwritten since)\n");
+        return;
+    }
+    gr_job_shape(&rec.job, &shape);
+    gr_decision_t d[2];
+    for (int c = 0; c < 2; c++) {
+        gr_result_t res;
+        bool exempt;
+        d[c] = replay_one(r->configs[c], &rec, &shape, &exempt, &res);
+    }
+    format_time(rec.time_ms, when, sizeof(when));
+    printf("  e.g. %s user %08x account %s partition %s: %s, %u CPUs per "
+           "node: %s -> %s\n", when, rec.user,
+           rec.account ? rec.account : "-",
+           rec.partition ? rec.partition : "-",
+           shape.tres ? shape.tres : "no GRES", shape.cpus,
+           decision_names[d[0]], decision_names[d[1]]);
+}
+
+static void print_diff(struct replay *r, char **config_names,
+                       int max_groups) {
+    const struct worker *all = &r->workers[0];
+
+    printf("\n%s -> %s\n", config_names[0], config_names[1]);
+    printf("flipped   %llu of %llu jobs (%.3f%%): %llu newly rejected, "
+           "%llu newly accepted\n",
+           (unsigned long long) (all->flips[0] + all->flips[1]),
+           (unsigned long long) all->records,
+           percent(all->flips[0] + all->flips[1], all->records),
+           (unsigned long long) all->flips[0],
+           (unsigned long long) all->flips[1]);
+    printf("other     %llu rejected by both, for different reasons\n",
+           (unsigned long long) all->other_reason);
+
+    for (int b = 0; b < NUM_BY; b++) {
+        const struct group_map *m = &all->groups[b];
+        struct group *sorted = malloc((m->num ? m->num : 1) * sizeof(*sorted));
+        uint32_t n = 0;
+
+        if (sorted == NULL) {
+            fprintf(stderr, "ratio-replay: out of memory\n");
+            exit(1);
+        }
+        for (uint32_t i = 0; i < m->size; i++)
+            if (m->slots[i].key)
+                sorted[n++] = m->slots[i];
+        if (n == 0) {
+            free(sorted);
+            continue;
+        }
+        qsort(sorted, n, sizeof(*sorted), by_flips);
+
+        printf("\n%-24s %15s %15s\n", by_names[b], "newly rejected",
+               "newly accepted");
+        for (uint32_t i = 0; i < n && i < (uint32_t) max_groups; i++) {
+            printf("%-24s %15llu %15llu\n", sorted[i].key,
+                   (unsigned long long) sorted[i].flips[0],
+                   (unsigned long long) sorted[i].flips[1]);
+            print_example(r, sorted[i].example);
+        }
+        if (n > (uint32_t) max_groups)
+            printf("and %u more\n", n - max_groups);
+        free(sorted);
+    }
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-t threads] [-p] [-d] [-n groups] "
+            "trace|columns config...\n", prog);
+}
+
+int main(int argc, char **argv) {
+    struct replay r = { 0 };
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    bool by_partition = false;
+    int max_groups = DEFAULT_GROUPS;
+    int opt, rc = 1;
+
+    while ((opt = getopt(argc, argv, "t:pdn:h")) != -1) {
+        switch (opt) {
+        case 't':
+            threads = atol(optarg);
+            if (threads <= 0 || threads > MAX_THREADS) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'p':
+            by_partition = true;
+            break;
+        case 'd':
+            r.diff = true;
+            break;
+        case 'n':
+            max_groups = atoi(optarg);
+            if (max_groups <= 0) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (argc - optind < 2 || (r.diff && argc - optind != 3)) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (threads <= 0)
+        threads = 1;
+    else if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+
+    gr_log_name = "ratio-replay";
+    r.num_configs = argc - optind - 1;
+    if ((r.configs = calloc(r.num_configs, sizeof(*r.configs))) == NULL)
+        return 1;
+    for (int c = 0; c < r.num_configs; c++)
+        if ((r.configs[c] = gr_config_load(argv[optind + 1 + c])) == NULL)
+            goto out;
+    /* Evaluating logs about single jobs, which would drown the results. */
+    gr_set_log(NULL, NULL);
+
+    if (gr_columns_probe(argv[optind])) {
+        if ((r.cols = gr_columns_map(argv[optind])) == NULL) {
+            fprintf(stderr, "ratio-replay: cannot read column file %s\n",
+                    argv[optind]);
+            goto out;
+        }
+        if (setup_columns(&r) != 0) {
+            fprintf(stderr, "ratio-replay: out of memory\n");
+            goto out;
+        }
+    } else if ((r.trace = gr_trace_map(argv[optind])) != NULL) {
+        gr_trace_window(r.trace, &r.first, &r.end);
+        r.num_chunks = (r.end - r.first + CHUNK - 1) / CHUNK;
+    } else {
+        fprintf(stderr, "ratio-replay: %s is not a trace file\n",
+                argv[optind]);
+        goto out;
+    }
+    if (setup_workers(&r, threads) != 0) {
+        fprintf(stderr, "ratio-replay: out of memory\n");
+        goto out;
+    }
+
+    uint64_t start = now_ns();
+    for (int i = 1; i < r.num_workers; i++)
+        if (pthread_create(&r.workers[i].thread, NULL, work,
+                           &r.workers[i]) != 0) {
+            fprintf(stderr, "ratio-replay: cannot start thread %d\n", i);
+            exit(1);
+        }
+    work(&r.workers[0]);
+    for (int i = 1; i < r.num_workers; i++)
+        pthread_join(r.workers[i].thread, NULL);
+    double secs = (now_ns() - start) / 1e9;
+
+    merge(&r);
+    print_results(&r, argv[optind], argv + optind + 1, by_partition);
+    if (r.diff)
+        print_diff(&r, argv + optind + 1, max_groups);
+    fprintf(stderr, "replayed %llu records x %d configs on %d threads in "
+            "%.3f s, %.1fM records/s\n",
+            (unsigned long long) r.workers[0].records, r.num_configs,
+            r.num_workers, secs,
+            secs > 0 ? r.workers[0].records / secs / 1e6 : 0);
+    rc = 0;
+
+out:
+    free_workers(&r);
+    free_columns(&r);
+    gr_trace_unmap((gr_trace_t *) r.trace);
+    for (int c = 0; c < r.num_configs; c++)
+        gr_config_free(r.configs[c]);
+    free(r.configs);
+    return rc;
+}
@@ -0,0 +1,286 @@
+// ratiostat.c
+
+/*
+ * ratiostat: prints the counters the plugin publishes in shared memory when
+ * stats_segment is set (see gresratio_stats.h), without any RPC to
+ * slurmctld or log parsing.
+ *
+ * ratiostat [-s segment] [-w seconds] [-a]
+ *   -s  shared memory name, as in stats_segment (default /slurm_gresratio)
+ *   -w  print what changed every so many seconds until interrupted
+ *   -a  also list partition/card pairs without any job
+ *
+ * The segment is mapped read only. A snapshot is retried until the slot
+ * names did not change while it was copied; the counters themselves only
+ * grow, each read atomically.
+ */
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "gresratio_stats.h"
+
+#define DEFAULT_SEGMENT "/slurm_gresratio"
+#define MAX_TRIES 1000
+
+/* Counters summed over the stripes, with the slot names they belong to. */
+struct snapshot {
+    uint64_t started;
+    uint64_t generation;
+    uint32_t num_parts;
+    uint32_t num_cards;
+    char parts[GR_STATS_PARTS][GR_STATS_NAME];
+    char cards[GR_STATS_CARDS][GR_STATS_NAME];
+    uint64_t accepts[GR_STATS_PARTS][GR_STATS_CARDS];
+    uint64_t rejects[GR_STATS_PARTS][GR_STATS_CARDS];
+    uint64_t reasons[GR_STATS_REASONS];
+    uint64_t exempt;
+    uint64_t adjusted;
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t latency[GR_STATS_BUCKETS];
+};
+
+static const char *const reason_names[GR_STATS_REASONS] = {
+    "accepted", "no GRES", "not a GPU", "ratio",
+};
+
+static uint64_t load(const atomic_uint_fast64_t *counter) {
+    return atomic_load_explicit((atomic_uint_fast64_t *) counter,
+                                memory_order_relaxed);
+}
+
+static const struct gr_stats_segment *map_segment(const char *name) {
+    const struct gr_stats_segment *seg;
+    struct stat st;
+    int fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+
+    if (fd < 0) {
+        fprintf(stderr, "ratiostat: cannot open %s: %m\n"
+                "Is stats_segment set in the plugin config?\n", name);
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(*seg)) {
+        fprintf(stderr, "ratiostat: %s is not a stats segment\n", name);
+        close(fd);
+        return NULL;
+    }
+    seg = mmap(NULL, sizeof(*seg), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED) {
+        fprintf(stderr, "ratiostat: cannot map %s: %m\n", name);
+        return NULL;
+    }
+    if (seg->magic != GR_STATS_MAGIC || seg->version != GR_STATS_VERSION ||
+        seg->size != sizeof(*seg)) {
+        fprintf(stderr, "ratiostat: %s was written by another plugin "
+                "version\n", name);
+        munmap((void *) seg, sizeof(*seg));
+        return NULL;
+    }
+    return seg;
+}
+
+/* Copies the segment, returns -1 if the plugin kept renaming slots. */
+static int read_snapshot(const struct gr_stats_segment *seg,
+                         struct snapshot *s) {
+    atomic_uint *seqp = (atomic_uint *) &seg->seq;
+
+    for (int tries = 0; tries < MAX_TRIES; tries++) {
+        unsigned seq = atomic_load_explicit(seqp, memory_order_acquire);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+
+        memset(s, 0, sizeof(*s));
+        s->started = seg->started;
+        s->generation = seg->generation;
+        s->num_parts = seg->num_parts;
+        s->num_cards = seg->num_cards;
+        memcpy(s->parts, seg->parts, sizeof(s->parts));
+        memcpy(s->cards, seg->cards, sizeof(s->cards));
+        for (int i = 0; i < GR_STATS_STRIPES; i++) {
+            const struct gr_stats_stripe *st = &seg->stripes[i];
+            for (int p = 0; p < GR_STATS_PARTS; p++) {
+                for (int c = 0; c < GR_STATS_CARDS; c++) {
+                    s->accepts[p][c] += load(&st->accepts[p][c]);
+                    s->rejects[p][c] += load(&st->rejects[p][c]);
+                }
+            }
+            for (int r = 0; r < GR_STATS_REASONS; r++)
+                s->reasons[r] += load(&st->reasons[r]);
+            s->exempt += load(&st->exempt);
+            s->adjusted += load(&st->adjusted);
+            s->cache_hits += load(&st->cache_hits);
+            s->cache_misses += load(&st->cache_misses);
+            for (int b = 0; b < GR_STATS_BUCKETS; b++)
+                s->latency[b] += load(&st->latency[b]);
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(seqp, memory_order_relaxed) == seq) {
+            if (s->num_parts > GR_STATS_PARTS)
+                s->num_parts = GR_STATS_PARTS;
+            if (s->num_cards > GR_STATS_CARDS)
+                s->num_cards = GR_STATS_CARDS;
+            for (int i = 0; i < GR_STATS_PARTS; i++)
+                s->parts[i][GR_STATS_NAME - 1] = '\0';
+            for (int i = 0; i < GR_STATS_CARDS; i++)
+                s->cards[i][GR_STATS_NAME - 1] = '\0';
+            return 0;
+        }
+    }
+    fprintf(stderr, "ratiostat: segment kept changing while read\n");
+    return -1;
+}
+
+/* Subtracts the counters of prev from s, for the changes of an interval. */
+static void subtract(struct snapshot *s, const struct snapshot *prev) {
+    for (int p = 0; p < GR_STATS_PARTS; p++) {
+        for (int c = 0; c < GR_STATS_CARDS; c++) {
+            s->accepts[p][c] -= prev->accepts[p][c];
+            s->rejects[p][c] -= prev->rejects[p][c];
+        }
+    }
+    for (int r = 0; r < GR_STATS_REASONS; r++)
+        s->reasons[r] -= prev->reasons[r];
+    s->exempt -= prev->exempt;
+    s->adjusted -= prev->adjusted;
+    s->cache_hits -= prev->cache_hits;
+    s->cache_misses -= prev->cache_misses;
+    for (int b = 0; b < GR_STATS_BUCKETS; b++)
+        s->latency[b] -= prev->latency[b];
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * part / whole : 0;
+}
+
+/* Upper bound in ns of the bucket holding the q-th quantile of calls. */
+static uint64_t quantile(const struct snapshot *s, double q) {
+    uint64_t total = 0, seen = 0;
+
+    for (int b = 0; b < GR_STATS_BUCKETS; b++)
+        total += s->latency[b];
+    if (total == 0)
+        return 0;
+    for (int b = 0; b < GR_STATS_BUCKETS; b++) {
+        seen += s->latency[b];
+        if (seen >= q * total)
+            return 1ull << b;
+    }
+    return 1ull << (GR_STATS_BUCKETS - 1);
+}
+
+static void print_snapshot(const char *name, const struct snapshot *s,
+                           int interval, bool all) {
+    uint64_t rejected = 0, evaluated;
+
+    for (int r = 1; r < GR_STATS_REASONS; r++)
+        rejected += s->reasons[r];
+    evaluated = s->reasons[0] + rejected;
+
+    printf("%s: config generation %llu, ", name,
+           (unsigned long long) s->generation);
+    if (interval)
+        printf("last %d s\n", interval);
+    else
+        printf("up %llu s\n",
+               (unsigned long long) (time(NULL) - (time_t) s->started));
+    printf("jobs      %llu evaluated, %llu rejected (%.2f%%), "
+           "%llu exempt, %llu adjusted\n",
+           (unsigned long long) evaluated, (unsigned long long) rejected,
+           percent(rejected, evaluated), (unsigned long long) s->exempt,
+           (unsigned long long) s->adjusted);
+    printf("rejected ");
+    for (int r = 1; r < GR_STATS_REASONS; r++)
+        printf(" %s %llu%s", reason_names[r],
+               (unsigned long long) s->reasons[r],
+               r + 1 < GR_STATS_REASONS ? "," : "\n");
+    printf("cache     %llu hits, %llu misses (%.1f%% hit)\n",
+           (unsigned long long) s->cache_hits,
+           (unsigned long long) s->cache_misses,
+           percent(s->cache_hits, s->cache_hits + s->cache_misses));
+    printf("latency   p50 < %llu ns, p99 < %llu ns, p999 < %llu ns\n\n",
+           (unsigned long long) quantile(s, 0.5),
+           (unsigned long long) quantile(s, 0.99),
+           (unsigned long long) quantile(s, 0.999));
+
+    printf("%-20s %-16s %12s %12s %8s\n", "partition", "card", "accepted",
+           "rejected", "%");
+    for (uint32_t p = 0; p < s->num_parts; p++) {
+        for (uint32_t c = 0; c < s->num_cards; c++) {
+            uint64_t a = s->accepts[p][c], r = s->rejects[p][c];
+            if (!all && a == 0 && r == 0)
+                continue;
+            printf("%-20s %-16s %12llu %12llu %8.2f\n", s->parts[p],
+                   s->cards[c], (unsigned long long) a,
+                   (unsigned long long) r, percent(r, a + r));
+        }
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-s segment] [-w seconds] [-a]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    static struct snapshot cur, prev;
+    const char *name = DEFAULT_SEGMENT;
+    int interval = 0;
+    bool all = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:w:ah")) != -1) {
+        switch (opt) {
+        case 's':
+            name = optarg;
+            break;
+        case 'w':
+            interval = atoi(optarg);
+            if (interval <= 0) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'a':
+            all = true;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+
+    const struct gr_stats_segment *seg = map_segment(name);
+    if (seg == NULL || read_snapshot(seg, &cur) != 0)
+        return 1;
+    print_snapshot(name, &cur, 0, all);
+
+    while (interval) {
+        prev = cur;
+        sleep(interval);
+        /* A restarted plugin creates a new segment, map it again. */
+        munmap((void *) seg, sizeof(*seg));
+        if ((seg = map_segment(name)) == NULL || read_snapshot(seg, &cur) != 0)
+            return 1;
+        struct snapshot delta = cur;
+        if (cur.started == prev.started)
+            subtract(&delta, &prev);
+        printf("\n");
+        print_snapshot(name, &delta, interval, all);
+        fflush(stdout);
+    }
+    munmap((void *) seg, sizeof(*seg));
+    return 0;
+}
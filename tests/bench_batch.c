@@ -0,0 +1,126 @@
+/*
+ * Measures bulk ratio checks: gr_evaluate_batch() with each kernel the CPU
+ * supports against calling gr_evaluate() once per request, over a million
+ * (CPUs, GPUs, card) requests on es1 of the sample config, about half of
+ * them on the ratio. Every kernel must agree with the scalar one.
+ *
+ * make -C tests bench_batch && ./tests/bench_batch
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/gresratio.h"
+
+#define N (1 << 20)
+#define REPS 20
+
+static const char *const cards[] = { "V100", "A40", "A100", "H100", NULL };
+static const unsigned ratios[] = { 2, 4, 4, 6, 2 };
+#define NUM_CARDS (sizeof(cards) / sizeof(cards[0]))
+
+static uint32_t ncpu[N], ngpu[N];
+static int32_t card_id[N], delta[N], want_delta[N];
+static uint64_t accept[N / 64], want[N / 64];
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* ns per request of the kernel in use, best of REPS runs. */
+static double run_batch(const gr_config_t *cfg, int policy, size_t *accepted) {
+    double best = 1e9;
+
+    for (int r = 0; r < REPS; r++) {
+        double start = now();
+        *accepted = gr_evaluate_batch(cfg, policy, N, ncpu, ngpu, card_id,
+                                      accept, delta);
+        double t = (now() - start) * 1e9 / N;
+        if (t < best)
+            best = t;
+    }
+    return best;
+}
+
+/* The same requests one gr_evaluate() call at a time, TRES preformatted. */
+static double run_single(const gr_config_t *cfg, size_t *accepted) {
+    char (*tres)[32] = malloc(N * sizeof(*tres));
+    if (tres == NULL)
+        exit(1);
+    for (size_t i = 0; i < N; i++) {
+        int c = i % NUM_CARDS;
+        if (cards[c])
+            snprintf(tres[i], sizeof(tres[i]), "gpu:%s:%u", cards[c], ngpu[i]);
+        else
+            snprintf(tres[i], sizeof(tres[i]), "gpu:%u", ngpu[i]);
+    }
+
+    double start = now();
+    *accepted = 0;
+    for (size_t i = 0; i < N; i++)
+        *accepted += gr_evaluate(cfg, "es1", tres[i], ncpu[i], NULL) ==
+                     GR_ACCEPT;
+    double t = (now() - start) * 1e9 / N;
+    free(tres);
+    return t;
+}
+
+int main(void) {
+    gr_set_log(NULL, NULL);
+    gr_config_t *cfg = gr_config_load("../src/job_submit_ratio_config.toml");
+    if (cfg == NULL) {
+        fprintf(stderr, "run from tests/, needs the sample config\n");
+        return 1;
+    }
+    int policy = gr_partition_id(cfg, "es1");
+    unsigned seed = 1;
+
+    for (size_t i = 0; i < N; i++) {
+        unsigned r = rand_r(&seed);
+        int c = i % NUM_CARDS;
+        card_id[i] = gr_card_id(cfg, cards[c]);
+        ngpu[i] = 1 + r % 8;
+        ncpu[i] = ngpu[i] * ratios[c] + (r >> 8) % 2;
+    }
+
+    gr_batch_isa_t best = gr_batch_isa();
+    size_t accepted, single_accepted;
+    double t_single = run_single(cfg, &single_accepted);
+    int rc = 0;
+
+    printf("%d requests of 1-8 GPUs on 5 cards, best of %d batches\n", N,
+           REPS);
+    printf("%12s %10s %12s %10s\n", "path", "ns/job", "Mjobs/s", "accepted");
+    printf("%12s %10.2f %12.1f %10zu\n", "gr_evaluate", t_single,
+           1e3 / t_single, single_accepted);
+
+    double t_scalar = 0;
+    for (int isa = GR_BATCH_SCALAR; isa <= GR_BATCH_AVX512; isa++) {
+        if (gr_batch_use(isa) != 0)
+            continue;
+        double t = run_batch(cfg, policy, &accepted);
+        if (isa == GR_BATCH_SCALAR) {
+            t_scalar = t;
+            memcpy(want, accept, sizeof(want));
+            memcpy(want_delta, delta, sizeof(want_delta));
+        } else if (memcmp(want, accept, sizeof(want)) != 0 ||
+                   memcmp(want_delta, delta, sizeof(want_delta)) != 0) {
+            fprintf(stderr, "%s disagrees with scalar\n",
+                    gr_batch_isa_name(isa));
+            rc = 1;
+        }
+        if (accepted != single_accepted)
+            rc = 1;
+        printf("%12s %10.2f %12.1f %10zu  %.1fx scalar, %.0fx gr_evaluate\n",
+               gr_batch_isa_name(isa), t, 1e3 / t, accepted, t_scalar / t,
+               t_single / t);
+    }
+    gr_batch_use(best);
+    gr_config_free(cfg);
+    return rc;
+}
@@ -0,0 +1,96 @@
+/*
+ * Measures config load time with derive_ratios over generated slurm.conf
+ * files: one NodeName line per host (the worst case, as written by config
+ * generators) plus a few range lines, and PartitionName lines listing the
+ * nodes as hostlist ranges.
+ *
+ * make -C tests bench_inventory && ./tests/bench_inventory
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/gresratio.h"
+
+#define RUNS 5
+#define PARTITIONS 8
+
+static const char *const cards[] = { "A100", "H100", "V100", "A40" };
+static const int sizes[] = { 5000, 10000, 50000 };
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Writes a slurm.conf with lines NodeName lines, returns its size. */
+static long write_conf(const char *path, int lines) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL)
+        return -1;
+
+    fprintf(f, "ClusterName=bench\nGresTypes=gpu\n"
+               "NodeName=DEFAULT Sockets=2 CoresPerSocket=32 "
+               "ThreadsPerCore=2 RealMemory=512000\n");
+    for (int i = 0; i < lines - 4; i++)
+        fprintf(f, "NodeName=n%05d.bench CPUs=128 ThreadsPerCore=2 "
+                   "Gres=gpu:%s:%d(S:0-1) Feature=rack%d State=UNKNOWN\n",
+                i, cards[i % 4], 4 << (i % 2), i / 40);
+    for (int i = 0; i < 4; i++)
+        fprintf(f, "NodeName=r%d-n[0000-0999] Gres=gpu:%s:8\n", i, cards[i]);
+
+    int per_part = (lines - 4) / PARTITIONS;
+    for (int p = 0; p < PARTITIONS; p++)
+        fprintf(f, "PartitionName=p%d Nodes=n[%05d-%05d].bench,r%d-n[0000-0999]"
+                   " MaxTime=INFINITE State=UP\n",
+                p, p * per_part, (p + 1) * per_part - 1, p % 4);
+    fprintf(f, "PartitionName=all Nodes=ALL Default=YES\n");
+
+    long size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+int main(void) {
+    char path[] = "/tmp/bench_inventory.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return 1;
+    close(fd);
+    gr_set_log(NULL, NULL);
+
+    printf("%12s %10s %10s %10s\n", "NodeName", "hosts", "MB", "load ms");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        long size = write_conf(path, sizes[s]);
+        char text[512];
+        snprintf(text, sizeof(text),
+                 "[gresratio]\n"
+                 "partition = p0, p1, p2, p3, p4, p5, p6, p7, all\n"
+                 "node_inventory = %s\n"
+                 "derive_ratios = true\n"
+                 "default_card = A100\n"
+                 "untyped_gpu = strictest\n", path);
+
+        double best = 0;
+        for (int r = 0; r < RUNS; r++) {
+            double start = now();
+            gr_config_t *cfg = gr_config_parse(text, strlen(text), "bench");
+            double ms = (now() - start) * 1e3;
+            if (cfg == NULL) {
+                unlink(path);
+                return 1;
+            }
+            gr_config_free(cfg);
+            if (r == 0 || ms < best)
+                best = ms;
+        }
+        printf("%12d %10d %10.1f %10.2f\n", sizes[s], sizes[s] - 4 + 4000,
+               size / 1e6, best);
+    }
+    unlink(path);
+    return 0;
+}
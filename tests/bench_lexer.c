@@ -0,0 +1,172 @@
+/*
+ * Compares the config lexer in src/gresratio_lexer.c with the regex based
+ * parsing the plugin used before (kept below as legacy_*).
+ *
+ * make -C tests bench_lexer && ./tests/bench_lexer
+ */
+
+#include <regex.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/gresratio_lexer.h"
+
+#define BUFFER_SIZE 2048
+#define ENABLED_PATTERN "=[ \t]*(true)"
+#define EQUALS_PATTERN "=[ \t]*([a-zA-Z0-9.]+)"
+#define NAME_PATTERN "card\\.([a-zA-Z0-9]+)"
+
+/* What both parsers produce, enough to check they agree. */
+struct result {
+    int enabled;
+    long cards;
+    double ratio_sum;
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Regex path, as in the plugin before the lexer. */
+static int legacy_parse_boolean(const char *line) {
+    regex_t regex;
+    if (regcomp(&regex, ENABLED_PATTERN, REG_EXTENDED | REG_ICASE))
+        return -1;
+    int ret = regexec(&regex, line, 0, NULL, 0);
+    regfree(&regex);
+    return ret == 0;
+}
+
+static char *legacy_parse_string(const char *line, const char *pattern) {
+    regex_t regex;
+    regmatch_t match[2];
+    if (regcomp(&regex, pattern, REG_EXTENDED))
+        return NULL;
+    char *value = NULL;
+    if (regexec(&regex, line, 2, match, 0) == 0) {
+        int length = match[1].rm_eo - match[1].rm_so;
+        value = malloc(length + 1);
+        strncpy(value, &line[match[1].rm_so], length);
+        value[length] = '\0';
+    }
+    regfree(&regex);
+    return value;
+}
+
+static void legacy_read_config(const char *filename, struct result *res) {
+    FILE *file = fopen(filename, "r");
+    char *buffer = malloc(BUFFER_SIZE);
+
+    while (fgets(buffer, BUFFER_SIZE, file) != NULL) {
+        if (strncmp(buffer, "enable_gres_ratio_plugin", 24) == 0)
+            res->enabled = legacy_parse_boolean(buffer);
+        if (strncmp(buffer, "card.", 5) == 0) {
+            char *result = legacy_parse_string(buffer, EQUALS_PATTERN);
+            char *name = legacy_parse_string(buffer, NAME_PATTERN);
+            if (result && name) {
+                res->ratio_sum += strtof(result, NULL);
+                res->cards++;
+            }
+            free(result);
+            free(name);
+        }
+    }
+    free(buffer);
+    fclose(file);
+}
+
+/* Lexer path: one read of the file, then one pass over the buffer. */
+static void lexer_read_config(const char *filename, struct result *res) {
+    FILE *file = fopen(filename, "r");
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    char *buffer = malloc(size + 1);
+    size_t len = fread(buffer, 1, size, file);
+    buffer[len] = '\0';
+    fclose(file);
+
+    gr_lexer_t lx;
+    gr_kv_t kv;
+    gr_lexer_init(&lx, buffer, len);
+    while (gr_lexer_next(&lx, &kv) > 0) {
+        if (!gr_slice_eq(kv.section, "gresratio") &&
+            !gr_slice_eq(kv.section, "Enable"))
+            continue;
+        if (gr_slice_eq(kv.key, "enable_gres_ratio_plugin")) {
+            bool on = false;
+            gr_slice_to_bool(kv.value, &on);
+            res->enabled = on;
+        } else if (gr_slice_consume(&kv.key, "card.")) {
+            char num[32];
+            if (kv.value.len >= sizeof(num))
+                continue;
+            memcpy(num, kv.value.ptr, kv.value.len);
+            num[kv.value.len] = '\0';
+            res->ratio_sum += strtof(num, NULL);
+            res->cards++;
+        }
+    }
+    free(buffer);
+}
+
+static void write_config(const char *filename, long cards) {
+    FILE *file = fopen(filename, "w");
+    fprintf(file, "[Enable] # comment\nenable_gres_ratio_plugin = true\n\n");
+    fprintf(file, "[gresratio] # comment test\ndefault_card = GPU0\n");
+    fprintf(file, "partition = es1 # only allows for one partition\n");
+    for (long i = 0; i < cards; i++)
+        fprintf(file, "card.GPU%ld = %ld.0\n", i, 1 + i % 8);
+    fprintf(file, "\n[loremipsum]\nblahblah = True\n");
+    fclose(file);
+}
+
+typedef void (*parse_fn)(const char *, struct result *);
+
+static double run(parse_fn fn, const char *filename, int reps,
+                  struct result *res) {
+    double start = now();
+    for (int i = 0; i < reps; i++) {
+        memset(res, 0, sizeof(*res));
+        fn(filename, res);
+    }
+    return (now() - start) / reps;
+}
+
+int main(void) {
+    const long sizes[] = { 10, 1000, 100000 };
+    char filename[] = "/tmp/bench_lexer_XXXXXX";
+    int fd = mkstemp(filename);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    printf("%10s %14s %14s %10s\n", "cards", "regex (ms)", "lexer (ms)",
+           "speedup");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        struct result legacy, lexer;
+        int reps = sizes[i] >= 100000 ? 1 : (int) (200000 / sizes[i]);
+
+        write_config(filename, sizes[i]);
+        double t_regex = run(legacy_read_config, filename,
+                             reps > 50 ? 50 : reps, &legacy);
+        double t_lexer = run(lexer_read_config, filename, reps, &lexer);
+
+        if (legacy.cards != lexer.cards || legacy.enabled != lexer.enabled) {
+            fprintf(stderr, "parsers disagree on %ld cards\n", sizes[i]);
+            return 1;
+        }
+        printf("%10ld %14.3f %14.3f %9.1fx\n", sizes[i], t_regex * 1e3,
+               t_lexer * 1e3, t_regex / t_lexer);
+    }
+    remove(filename);
+    return 0;
+}
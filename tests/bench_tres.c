@@ -0,0 +1,106 @@
+/*
+ * Measures TRES string parsing throughput: the tokenizer in
+ * src/gresratio_tres.c against the sscanf parsing the plugin used before
+ * (kept below as legacy_parse), over strings as they show up in squeue.
+ *
+ * make -C tests bench_tres && ./tests/bench_tres
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/gresratio_tres.h"
+
+#define REPS 2000000
+
+/* tres_per_node, tres_per_job, tres_per_socket and tres_per_task values. */
+static const char *const corpus[] = {
+    "gpu:1",
+    "gpu:4",
+    "gpu:A100:2",
+    "gpu:V100:1",
+    "gpu:GTX2080TI:4",
+    "gres:gpu:a40:2",
+    "gres/gpu=2",
+    "gres/gpu:a100=4",
+    "gres/gpu:h100=8,gres/shard=4",
+    "gpu:a100:1(S:0),gpu:a100:1(S:1)",
+    "gres/gpu:nvidia_h100_80gb_hbm3=8",
+    "gres/shard=2;gres/gpu:l40s=1;license/matlab=1",
+};
+#define NUM_STRINGS (sizeof(corpus) / sizeof(corpus[0]))
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* sscanf path, as in the plugin before the tokenizer: one entry only. */
+static int legacy_parse(const char *gres, uint64_t *gpus) {
+    char card_name[40];
+    int gpu_count = 0;
+
+    if (sscanf(gres, "gpu:%39[^:]:%d", card_name, &gpu_count) == 2) {
+    } else if (sscanf(gres, "gpu:%d", &gpu_count) == 1) {
+    } else {
+        return -1;
+    }
+    *gpus = gpu_count;
+    return 0;
+}
+
+static int tokenizer_parse(const char *gres, uint64_t *gpus) {
+    gr_tres_iter_t it;
+    gr_tres_t tres;
+    int rc;
+
+    *gpus = 0;
+    gr_tres_init(&it, gres);
+    while ((rc = gr_tres_next(&it, &tres)) > 0)
+        if (gr_slice_eq(tres.name, "gpu"))
+            *gpus += tres.count;
+    return rc;
+}
+
+typedef int (*parse_fn)(const char *, uint64_t *);
+
+/* Returns ns per string, *parsed counts strings that yielded GPUs. */
+static double run(parse_fn fn, size_t *parsed, uint64_t *gpus) {
+    *parsed = 0;
+    *gpus = 0;
+    double start = now();
+    for (int i = 0; i < REPS; i++) {
+        uint64_t n;
+        if (fn(corpus[i % NUM_STRINGS], &n) == 0 && n) {
+            ++*parsed;
+            *gpus += n;
+        }
+    }
+    return (now() - start) * 1e9 / REPS;
+}
+
+int main(void) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < NUM_STRINGS; i++)
+        bytes += strlen(corpus[i]);
+    double avg = (double) bytes / NUM_STRINGS;
+
+    size_t legacy_ok, tok_ok;
+    uint64_t legacy_gpus, tok_gpus;
+    double t_legacy = run(legacy_parse, &legacy_ok, &legacy_gpus);
+    double t_tok = run(tokenizer_parse, &tok_ok, &tok_gpus);
+
+    printf("%zu strings, %.1f bytes on average, %d parses each\n",
+           NUM_STRINGS, avg, REPS);
+    printf("%10s %10s %10s %12s\n", "parser", "ns/string", "MB/s",
+           "understood");
+    printf("%10s %10.1f %10.1f %11.0f%%\n", "sscanf", t_legacy,
+           avg / t_legacy * 1e3, 100.0 * legacy_ok / REPS);
+    printf("%10s %10.1f %10.1f %11.0f%%\n", "tokenizer", t_tok,
+           avg / t_tok * 1e3, 100.0 * tok_ok / REPS);
+    printf("speedup %.1fx\n", t_legacy / t_tok);
+    return tok_ok == REPS ? 0 : 1;
+}
@@ -0,0 +1,15 @@
+/*
+ * Minimal stand-in for <slurm/slurm_errno.h>, just what the plugin uses.
+ * Lets tests/mock_slurmctld build and load the plugin without Slurm.
+ */
+
+#ifndef MOCK_SLURM_ERRNO_H
+#define MOCK_SLURM_ERRNO_H
+
+#define SLURM_SUCCESS 0
+#define SLURM_ERROR -1
+
+#define ESLURM_INVALID_GRES 2072
+#define ESLURM_INTERNAL 2099
+
+#endif
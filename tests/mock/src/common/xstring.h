@@ -0,0 +1,14 @@
+/*
+ * Minimal stand-in for Slurm's xstring.h, provided by tests/mock_slurmctld.c.
+ */
+
+#ifndef MOCK_XSTRING_H
+#define MOCK_XSTRING_H
+
+extern char *slurm_xstrdup(const char *str);
+extern void slurm_xstrcat(char **str1, const char *str2);
+
+#define xstrdup(s) slurm_xstrdup(s)
+#define xstrcat(p, q) slurm_xstrcat(&(p), q)
+
+#endif
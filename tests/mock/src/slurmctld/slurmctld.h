@@ -0,0 +1,89 @@
+/*
+ * Minimal stand-in for slurmctld.h: logging, xmalloc and the job structs
+ * the plugin reads (xstrdup is in ../common/xstring.h). The functions are
+ * provided by tests/mock_slurmctld.c.
+ * Field names follow Slurm (see old/slurmsrcinfo.txt), the layout does not
+ * have to since the plugin is compiled against this header.
+ */
+
+#ifndef MOCK_SLURMCTLD_H
+#define MOCK_SLURMCTLD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SLURM_VERSION_NUMBER 0x170b00
+
+#define NO_VAL   (0xfffffffe)
+#define NO_VAL16 (0xfffe)
+
+extern void info(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2)));
+extern void error(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2)));
+extern void debug(const char *fmt, ...)
+    __attribute__((format(printf, 1, 2)));
+
+extern void *slurm_xmalloc(size_t size, bool clear, const char *file,
+                           int line, const char *func);
+extern void slurm_xfree(void **item);
+
+#define xmalloc(sz) slurm_xmalloc(sz, true, __FILE__, __LINE__, __func__)
+#define xfree(p) slurm_xfree((void **) &(p))
+
+typedef struct job_descriptor {
+    char *account;
+    char *cpus_per_tres;
+    char *partition;
+    char *qos;
+    char *reservation;
+    char *tres_per_job;
+    char *tres_per_node;
+    char *tres_per_socket;
+    char *tres_per_task;
+    uint32_t user_id;
+    uint32_t num_tasks;
+    uint16_t cpus_per_task;
+    uint32_t min_cpus;
+    uint32_t min_nodes;
+    uint32_t max_nodes;
+    uint16_t sockets_per_node;
+    uint16_t ntasks_per_node;
+    uint16_t pn_min_cpus;
+} job_desc_msg_t;
+
+typedef struct slurmdb_qos_rec {
+    char *name;
+} slurmdb_qos_rec_t;
+
+typedef struct multi_core_data {
+    uint16_t sockets_per_node;
+} multi_core_data_t;
+
+typedef struct job_details {
+    uint32_t min_cpus;
+    uint32_t min_nodes;
+    uint32_t num_tasks;
+    uint16_t cpus_per_task;
+    uint16_t ntasks_per_node;
+    uint16_t pn_min_cpus;
+    multi_core_data_t *mc_ptr;
+} job_details_t;
+
+typedef struct job_record {
+    char *account;
+    char *cpus_per_tres;
+    job_details_t *details;
+    char *partition;
+    slurmdb_qos_rec_t *qos_ptr;
+    char *resv_name;
+    char *tres_per_job;
+    char *tres_per_node;
+    char *tres_per_socket;
+    char *tres_per_task;
+    uint32_t total_cpus;
+    uint32_t user_id;
+} job_record_t;
+
+#endif
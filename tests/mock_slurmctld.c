@@ -0,0 +1,554 @@
+/*
+ * mock_slurmctld: load driver for the job_submit plugin.
+ *
+ * Provides the few slurmctld symbols the plugin links against (logging and
+ * xmalloc), dlopens the real plugin built against tests/mock, and calls
+ * job_submit()/job_modify() from several threads the way slurmctld would.
+ * Reports throughput and latency percentiles per entry point.
+ *
+ * make -C tests mock_slurmctld
+ * ./tests/mock_slurmctld [-p plugin.so] [-C config_dir] [-t threads]
+ *     [-n calls_per_thread] [-m modify_percent] [-w workload] [-v] [-e]
+ *
+ * -e checks job_modify instead of driving load: exemptions, with a config
+ * that has exempt_qos = debug and exempt_reservations = maint, and updates
+ * of multi-node jobs.
+ *
+ * The workload is either synthetic or a recorded squeue dump:
+ *   squeue -O "UserName,tres-per-node,MinCpus,Partition,JobID"
+ */
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <slurm/slurm_errno.h>
+#include "src/common/xstring.h"
+#include "src/slurmctld/slurmctld.h"
+
+#include "gresratio.h"
+
+#define XMALLOC_MAGIC 0x42
+
+typedef int (*init_fn)(void);
+typedef int (*submit_fn)(job_desc_msg_t *, uint32_t, char **);
+typedef int (*modify_fn)(job_desc_msg_t *, job_record_t *, uint32_t);
+typedef void (*stats_fn)(gr_cache_stats_t *);
+typedef void (*modify_stats_fn)(uint64_t *, uint64_t *, uint64_t *);
+
+/* One submission of the workload. */
+struct job {
+    char *partition;
+    char *tres;
+    uint32_t cpus;
+};
+
+/* Latencies and results of one entry point on one thread. */
+struct series {
+    uint64_t *ns;
+    size_t count;
+    size_t rejects;
+};
+
+struct worker {
+    pthread_t thread;
+    unsigned id;
+    struct series submit;
+    struct series modify;
+};
+
+static bool verbose = false;
+static atomic_ulong log_lines = 0;
+static atomic_ulong foreign_frees = 0;
+static atomic_ulong err_msgs = 0;
+
+static submit_fn plugin_submit;
+static modify_fn plugin_modify;
+static struct job *jobs;
+static size_t num_jobs;
+static size_t calls_per_thread = 100000;
+static unsigned modify_percent = 10;
+static pthread_barrier_t start_barrier;
+
+/* slurmctld symbols resolved by the plugin. */
+
+static void vlog(const char *level, const char *fmt, va_list ap) {
+    atomic_fetch_add_explicit(&log_lines, 1, memory_order_relaxed);
+    if (!verbose)
+        return;
+    fprintf(stderr, "%s: ", level);
+    vfprintf(stderr, fmt, ap);
+    fputc('\n', stderr);
+}
+
+void info(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vlog("info", fmt, ap);
+    va_end(ap);
+}
+
+void error(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vlog("error", fmt, ap);
+    va_end(ap);
+}
+
+void debug(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vlog("debug", fmt, ap);
+    va_end(ap);
+}
+
+/*
+ * Like Slurm, xmalloc prefixes each block with a header. xfree checks it so
+ * memory handed to slurmctld without xmalloc is counted instead of
+ * corrupting the heap.
+ */
+void *slurm_xmalloc(size_t size, bool clear, const char *file, int line,
+                    const char *func) {
+    size_t *p = clear ? calloc(1, size + 2 * sizeof(size_t)) :
+                        malloc(size + 2 * sizeof(size_t));
+    if (p == NULL) {
+        fprintf(stderr, "xmalloc(%zu) failed at %s:%d %s\n", size, file, line,
+                func);
+        abort();
+    }
+    p[0] = XMALLOC_MAGIC;
+    p[1] = size;
+    return &p[2];
+}
+
+void slurm_xfree(void **item) {
+    if (*item == NULL)
+        return;
+    size_t *p = (size_t *) *item - 2;
+    if (p[0] == XMALLOC_MAGIC) {
+        p[0] = 0;
+        free(p);
+    } else {
+        atomic_fetch_add(&foreign_frees, 1);
+        free(*item);
+    }
+    *item = NULL;
+}
+
+char *slurm_xstrdup(const char *str) {
+    if (str == NULL)
+        return NULL;
+    size_t len = strlen(str) + 1;
+    char *copy = slurm_xmalloc(len, false, __FILE__, __LINE__, __func__);
+    memcpy(copy, str, len);
+    return copy;
+}
+
+void slurm_xstrcat(char **str1, const char *str2) {
+    size_t len1 = *str1 ? strlen(*str1) : 0, len2 = strlen(str2);
+    char *cat = slurm_xmalloc(len1 + len2 + 1, false, __FILE__, __LINE__,
+                              __func__);
+    memcpy(cat, *str1 ? *str1 : "", len1);
+    memcpy(cat + len1, str2, len2 + 1);
+    xfree(*str1);
+    *str1 = cat;
+}
+
+/* Workload. */
+
+static void add_job(const char *partition, const char *tres, uint32_t cpus) {
+    static size_t max_jobs;
+    if (num_jobs == max_jobs) {
+        max_jobs = max_jobs ? max_jobs * 2 : 1024;
+        jobs = realloc(jobs, max_jobs * sizeof(*jobs));
+        if (jobs == NULL) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    jobs[num_jobs].partition = strdup(partition);
+    jobs[num_jobs].tres = tres ? strdup(tres) : NULL;
+    jobs[num_jobs].cpus = cpus;
+    num_jobs++;
+}
+
+/*
+ * Mix of CPU only partitions and GPU jobs on es1, about half of the GPU
+ * jobs matching the ratios of src/job_submit_ratio_config.toml.
+ */
+static void synthetic_workload(void) {
+    const char *cards[] = { "V100", "A40", "A100", "H100", NULL };
+    const unsigned ratio[] = { 2, 4, 4, 6, 2 };
+    unsigned seed = 1;
+
+    for (int i = 0; i < 4096; i++) {
+        unsigned r = rand_r(&seed);
+        if (r % 10 < 7) {
+            add_job(r % 2 ? "lr6" : "savio3", NULL, 1 + r % 64);
+            continue;
+        }
+        char tres[64];
+        unsigned card = (r >> 4) % 5;
+        unsigned gpus = 1 + (r >> 8) % 4;
+        if (cards[card])
+            snprintf(tres, sizeof(tres), "gpu:%s:%u", cards[card], gpus);
+        else
+            snprintf(tres, sizeof(tres), "gpu:%u", gpus);
+        add_job("es1", tres, gpus * ratio[card] + ((r >> 12) % 2));
+    }
+}
+
+/* Reads an squeue -O "UserName,tres-per-node,MinCpus,Partition,JobID" dump. */
+static int recorded_workload(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    char line[1024], user[256], tres[256], part[256];
+    unsigned cpus;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "%255s %255s %u %255s", user, tres, &cpus, part) != 4)
+            continue; // header or malformed
+        add_job(part, strcmp(tres, "N/A") ? tres : NULL, cpus);
+    }
+    fclose(file);
+    return num_jobs ? 0 : -1;
+}
+
+/* Driver. */
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* An update request with nothing set, as scontrol update sends it. */
+static job_desc_msg_t update_desc(void) {
+    job_desc_msg_t desc = {
+        .min_cpus = NO_VAL,
+        .min_nodes = NO_VAL,
+        .num_tasks = NO_VAL,
+        .cpus_per_task = NO_VAL16,
+        .ntasks_per_node = NO_VAL16,
+        .sockets_per_node = NO_VAL16,
+        .pn_min_cpus = NO_VAL16,
+    };
+    return desc;
+}
+
+static void *run_worker(void *arg) {
+    struct worker *w = arg;
+    unsigned seed = w->id + 1;
+
+    w->submit.ns = malloc(calls_per_thread * sizeof(uint64_t));
+    w->modify.ns = malloc(calls_per_thread * sizeof(uint64_t));
+    if (w->submit.ns == NULL || w->modify.ns == NULL) {
+        perror("malloc");
+        exit(1);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    for (size_t i = 0; i < calls_per_thread; i++) {
+        const struct job *job = &jobs[(w->id * 7919 + i) % num_jobs];
+        bool modify = (unsigned) rand_r(&seed) % 100 < modify_percent;
+        job_desc_msg_t desc = { 0 };
+        char *err_msg = NULL;
+        uint64_t start;
+        int rc;
+
+        if (modify) {
+            /*
+             * scontrol update on an existing job: TimeLimit=, or MinCPUs=
+             * to the same or another count, or Partition=.
+             */
+            job_record_t rec = { 0 };
+            rec.partition = job->partition;
+            rec.tres_per_node = job->tres;
+            rec.total_cpus = job->cpus;
+            desc = update_desc();
+            switch (i % 4) {
+            case 1: desc.min_cpus = job->cpus; break;
+            case 2: desc.min_cpus = job->cpus * 2; break;
+            case 3: desc.partition = "es1"; break;
+            }
+            start = now_ns();
+            rc = plugin_modify(&desc, &rec, 1000);
+            w->modify.ns[w->modify.count++] = now_ns() - start;
+            w->modify.rejects += rc != SLURM_SUCCESS;
+        } else {
+            desc.partition = job->partition;
+            desc.tres_per_node = job->tres;
+            desc.min_cpus = job->cpus;
+            desc.min_nodes = NO_VAL;
+            desc.num_tasks = NO_VAL;
+            desc.cpus_per_task = NO_VAL16;
+            desc.ntasks_per_node = NO_VAL16;
+            desc.sockets_per_node = NO_VAL16;
+            desc.pn_min_cpus = NO_VAL16;
+            start = now_ns();
+            rc = plugin_submit(&desc, 1000, &err_msg);
+            w->submit.ns[w->submit.count++] = now_ns() - start;
+            w->submit.rejects += rc != SLURM_SUCCESS;
+            if (err_msg) {
+                atomic_fetch_add(&err_msgs, 1);
+                xfree(err_msg); // slurmctld owns err_msg
+            }
+        }
+    }
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char *name, struct worker *workers,
+                   unsigned threads, struct series *(*pick)(struct worker *),
+                   double wall) {
+    size_t total = 0, rejects = 0;
+    for (unsigned i = 0; i < threads; i++) {
+        total += pick(&workers[i])->count;
+        rejects += pick(&workers[i])->rejects;
+    }
+    if (total == 0)
+        return;
+
+    uint64_t *all = malloc(total * sizeof(uint64_t));
+    size_t n = 0;
+    for (unsigned i = 0; i < threads; i++) {
+        struct series *s = pick(&workers[i]);
+        memcpy(all + n, s->ns, s->count * sizeof(uint64_t));
+        n += s->count;
+    }
+    qsort(all, total, sizeof(uint64_t), cmp_u64);
+
+    printf("%-10s %10zu calls %12.0f calls/s %6.2f%% rejected  "
+           "p50 %6lu ns  p99 %6lu ns  p999 %7lu ns  max %8lu ns\n",
+           name, total, total / wall, 100.0 * rejects / total,
+           (unsigned long) all[total / 2],
+           (unsigned long) all[total * 99 / 100],
+           (unsigned long) all[total * 999 / 1000],
+           (unsigned long) all[total - 1]);
+    free(all);
+}
+
+static struct series *pick_submit(struct worker *w) { return &w->submit; }
+static struct series *pick_modify(struct worker *w) { return &w->modify; }
+
+/*
+ * -e: an update that breaks the ratio of a job in an exempt QOS or
+ * reservation goes through, although the update itself names neither.
+ */
+static int check_exempt_modify(void) {
+    slurmdb_qos_rec_t debug = { .name = "debug" };
+    job_record_t rec = {
+        .partition = "es1",
+        .tres_per_node = "gpu:V100:1",
+        .total_cpus = 2,
+        .user_id = 1000,
+    };
+    job_desc_msg_t desc = update_desc();
+    int failed = 0;
+
+    desc.min_cpus = 3;
+    if (plugin_modify(&desc, &rec, 1000) == SLURM_SUCCESS) {
+        fprintf(stderr, "-e: update off the ratio was not rejected\n");
+        failed = 1;
+    }
+    rec.qos_ptr = &debug;
+    if (plugin_modify(&desc, &rec, 1000) != SLURM_SUCCESS) {
+        fprintf(stderr, "-e: job in exempt QOS rejected on update\n");
+        failed = 1;
+    }
+    rec.qos_ptr = NULL;
+    rec.resv_name = "maint";
+    if (plugin_modify(&desc, &rec, 1000) != SLURM_SUCCESS) {
+        fprintf(stderr, "-e: job in exempt reservation rejected on update\n");
+        failed = 1;
+    }
+    printf("job_modify exemptions %s\n", failed ? "FAILED" : "ok");
+    return failed;
+}
+
+/*
+ * -e: the ratio is per node on update too. A -N 2 --gres=gpu:V100:2 job
+ * with 8 CPUs has 4 per node, right for V100 = 2.
+ */
+static int check_multinode_modify(void) {
+    job_details_t details = {
+        .min_cpus = 8,
+        .min_nodes = 2,
+        .num_tasks = NO_VAL,
+        .cpus_per_task = NO_VAL16,
+        .ntasks_per_node = NO_VAL16,
+        .pn_min_cpus = NO_VAL16,
+    };
+    job_record_t rec = {
+        .details = &details,
+        .partition = "lr6",
+        .tres_per_node = "gpu:V100:2",
+        .total_cpus = 8,
+        .user_id = 1000,
+    };
+    job_desc_msg_t desc = update_desc();
+    int failed = 0;
+
+    desc.partition = "es1";
+    if (plugin_modify(&desc, &rec, 1000) != SLURM_SUCCESS) {
+        fprintf(stderr, "-e: move of a multi-node job rejected\n");
+        failed = 1;
+    }
+    desc = update_desc();
+    rec.partition = "es1";
+    desc.tres_per_node = "gpu:V100:1";
+    desc.min_cpus = 4;
+    if (plugin_modify(&desc, &rec, 1000) != SLURM_SUCCESS) {
+        fprintf(stderr, "-e: multi-node update on the ratio rejected\n");
+        failed = 1;
+    }
+    desc.min_cpus = 6;
+    if (plugin_modify(&desc, &rec, 1000) == SLURM_SUCCESS) {
+        fprintf(stderr, "-e: multi-node update off the ratio accepted\n");
+        failed = 1;
+    }
+    desc = update_desc();
+    desc.min_nodes = 4;
+    if (plugin_modify(&desc, &rec, 1000) == SLURM_SUCCESS) {
+        fprintf(stderr, "-e: update to 2 CPUs per node accepted\n");
+        failed = 1;
+    }
+    printf("job_modify of multi-node jobs %s\n", failed ? "FAILED" : "ok");
+    return failed;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-p plugin.so] [-C config_dir] [-t threads] "
+            "[-n calls_per_thread] [-m modify_percent] [-w workload] [-v] "
+            "[-e]\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    const char *plugin = "./job_submit_require_cpu_gpu_ratio.so";
+    const char *config_dir = NULL;
+    const char *workload = NULL;
+    unsigned threads = 4;
+    bool exempt_check = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:C:t:n:m:w:veh")) != -1) {
+        switch (opt) {
+        case 'p': plugin = optarg; break;
+        case 'C': config_dir = optarg; break;
+        case 't': threads = strtoul(optarg, NULL, 10); break;
+        case 'n': calls_per_thread = strtoull(optarg, NULL, 10); break;
+        case 'm': modify_percent = strtoul(optarg, NULL, 10); break;
+        case 'w': workload = optarg; break;
+        case 'v': verbose = true; break;
+        case 'e': exempt_check = true; break;
+        default: usage(argv[0]); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (threads == 0 || calls_per_thread == 0 || modify_percent > 100) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (workload ? recorded_workload(workload) : (synthetic_workload(), 0)) {
+        fprintf(stderr, "no jobs in workload %s\n", workload);
+        return 1;
+    }
+
+    void *handle = dlopen(plugin, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        fprintf(stderr, "dlopen: %s\n", dlerror());
+        return 1;
+    }
+    init_fn plugin_init = (init_fn) dlsym(handle, "init");
+    init_fn plugin_fini = (init_fn) dlsym(handle, "fini");
+    plugin_submit = (submit_fn) dlsym(handle, "job_submit");
+    plugin_modify = (modify_fn) dlsym(handle, "job_modify");
+    if (!plugin_init || !plugin_fini || !plugin_submit || !plugin_modify) {
+        fprintf(stderr, "%s: missing job_submit plugin symbols\n", plugin);
+        return 1;
+    }
+
+    /* The plugin reads its config relative to the slurmctld cwd. */
+    if (config_dir && chdir(config_dir) != 0) {
+        fprintf(stderr, "%s: %s\n", config_dir, strerror(errno));
+        return 1;
+    }
+    if (plugin_init() != SLURM_SUCCESS) {
+        fprintf(stderr, "plugin init() failed\n");
+        return 1;
+    }
+    if (exempt_check) {
+        int failed = check_exempt_modify() | check_multinode_modify();
+        plugin_fini();
+        dlclose(handle);
+        return failed;
+    }
+
+    struct worker *workers = calloc(threads, sizeof(*workers));
+    pthread_barrier_init(&start_barrier, NULL, threads + 1);
+    for (unsigned i = 0; i < threads; i++) {
+        workers[i].id = i;
+        pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]);
+    }
+
+    pthread_barrier_wait(&start_barrier);
+    uint64_t start = now_ns();
+    for (unsigned i = 0; i < threads; i++)
+        pthread_join(workers[i].thread, NULL);
+    double wall = (now_ns() - start) / 1e9;
+
+    printf("%u threads, %zu workload jobs, %.3f s, %.0f calls/s total\n",
+           threads, num_jobs, wall, threads * calls_per_thread / wall);
+    report("job_submit", workers, threads, pick_submit, wall);
+    report("job_modify", workers, threads, pick_modify, wall);
+    printf("log lines %lu, err_msg returned %lu, err_msg not from xmalloc %lu\n",
+           (unsigned long) log_lines, (unsigned long) err_msgs,
+           (unsigned long) foreign_frees);
+
+    stats_fn cache_stats = (stats_fn) dlsym(handle, "gr_cache_stats");
+    if (cache_stats) {
+        gr_cache_stats_t stats;
+        cache_stats(&stats);
+        uint64_t lookups = stats.hits + stats.misses;
+        printf("decision cache %lu hits, %lu misses (%.1f%% hit) over %u slots\n",
+               (unsigned long) stats.hits, (unsigned long) stats.misses,
+               lookups ? 100.0 * stats.hits / lookups : 0.0, stats.slots);
+    }
+
+    modify_stats_fn modify_stats = (modify_stats_fn) dlsym(handle,
+                                                           "_modify_stats");
+    if (modify_stats) {
+        uint64_t unset, unchanged, checked;
+        modify_stats(&unset, &unchanged, &checked);
+        printf("job_modify %lu without ratio fields, %lu unchanged, "
+               "%lu checked\n", (unsigned long) unset,
+               (unsigned long) unchanged, (unsigned long) checked);
+    }
+
+    plugin_fini();
+    for (unsigned i = 0; i < threads; i++) {
+        free(workers[i].submit.ns);
+        free(workers[i].modify.ns);
+    }
+    free(workers);
+    dlclose(handle);
+    return 0;
+}
@@ -0,0 +1,51 @@
+# Made up sacct -X -P output for the columns target: jobs of 1-8 GPUs per
+# node on one or two nodes, most on a card of the sample config, some
+# untyped, mixed or without GPUs, with the CPUs on the ratio about half of
+# the time. Like real sacct, typed GPUs come with their untyped total and
+# mem may have decimals. Seeded, so every run writes the same jobs.
+#
+# awk -v jobs=300000 -f sacct_jobs.awk
+
+BEGIN {
+    srand(1)
+    split("V100 A40 A100 H100 L4 GTRX2080TI", cards, " ")
+    split("2 4 4 6 2 2", ratios, " ")
+    split("es1 es1 lr6 es1,lr6 -", parts, " ")
+    print "JobIDRaw|User|Account|Partition|ReqTRES|ReqCPUS|ReqNodes"
+    for (i = 0; i < jobs; i++) {
+        nodes = 1 + int(rand() * 2)
+        gpus = 1 + int(rand() * 8)
+        c = 1 + int(rand() * 7)
+        part = parts[1 + int(rand() * 5)]
+        if (part == "-")
+            part = ""
+        total = gpus * nodes
+        if (c == 7) {
+            tres = "gres/gpu=" total
+            cpus = gpus * 2
+        } else {
+            tres = "gres/gpu:" cards[c] "=" total
+            cpus = gpus * ratios[c]
+        }
+        if (rand() < 0.05) {
+            tres = tres ",gres/gpu:A100=" nodes
+            total += nodes
+        }
+        if (c != 7)
+            tres = tres ",gres/gpu=" total
+        if (rand() < 0.5)
+            cpus += 1 + int(rand() * 3)
+        if (rand() < 0.02) {
+            tres = ""
+            cpus = 4
+        }
+        cpus *= nodes
+        printf "%d|u%03d|a%02d|%s|billing=%d,cpu=%d%s,mem=%.2fG,node=%d|%d|%d\n",
+               1000 + i, int(rand() * 500), int(rand() * 40), part, cpus,
+               cpus, tres == "" ? "" : "," tres, cpus * 5.86, nodes, cpus,
+               nodes
+        if (rand() < 0.1)
+            printf "%d.batch|||%s|cpu=%d,node=1|%d|1\n", 1000 + i, part,
+                   cpus / nodes, cpus / nodes
+    }
+}
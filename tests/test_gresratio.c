@@ -0,0 +1,1078 @@
+/*
+ * Unity tests for libgresratio.
+ *
+ * make -C tests test
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "unity/unity.h"
+#include "../src/gresratio.h"
+#include "../src/gresratio_columns.h"
+#include "../src/gresratio_internal.h"
+#include "../src/gresratio_stats.h"
+#include "../src/gresratio_trace.h"
+#include "../src/gresratio_tres.h"
+
+static const char sample[] =
+    "[Enable] # comment\n"
+    "testtest = false # comment asdf\n"
+    "enable_gres_ratio_plugin = true\n"
+    "\n"
+    "[gresratio] # comment test\n"
+    "default_card = V100 # this MUST have a ratio defined below\n"
+    "partition = es1 # one partition or a list\n"
+    "card.GTRX2080TI = 2.0\n"
+    "card.V100 = 2.0\n"
+    "card.A40 = 4.0\n"
+    "card.A100 = 4.0\n"
+    "card.H100 = 6.0\n"
+    "\n"
+    "[loremipsum]\n"
+    "blahblah = True\n"
+    "partition = cpu\n"
+    "loremipsum = [1,2,3]\n";
+
+static gr_config_t *cfg;
+
+static gr_config_t *parse(const char *text) {
+    return gr_config_parse(text, strlen(text), "test");
+}
+
+void setUp(void) {
+    gr_set_log(NULL, NULL);
+    cfg = parse(sample);
+    TEST_ASSERT_NOT_NULL(cfg);
+}
+
+void tearDown(void) {
+    gr_config_free(cfg);
+}
+
+void test_sample_config(void) {
+    TEST_ASSERT_TRUE(gr_config_enabled(cfg));
+    TEST_ASSERT_EQUAL_INT(5, gr_config_num_cards(cfg));
+    TEST_ASSERT_EQUAL_INT(1, gr_config_num_partitions(cfg));
+}
+
+void test_matching_ratio_is_accepted(void) {
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(cfg, "es1", "gpu:A100:2", 8, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(cfg, "es1", "gpu:v100:4", 8, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(cfg, "es1", "gpu:2", 4, NULL));
+}
+
+void test_wrong_ratio_is_rejected(void) {
+    gr_result_t res;
+    char msg[256];
+
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO, gr_evaluate(cfg, "es1", "gpu:A100:2", 6, &res));
+    TEST_ASSERT_EQUAL_STRING("A100", gr_card_name(cfg, res.card_id));
+    TEST_ASSERT_EQUAL_UINT32(2, res.gpus);
+    TEST_ASSERT_TRUE(gr_format_message(cfg, &res, msg, sizeof(msg)) > 0);
+
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO, gr_evaluate(cfg, "es1", "gpu:2", 3, &res));
+    TEST_ASSERT_TRUE(res.default_card);
+}
+
+void test_reject_messages(void) {
+    gr_result_t res;
+    char msg[256], small[16];
+
+    gr_evaluate(cfg, "es1", "gpu:A100:3", 10, &res);
+    TEST_ASSERT_EQUAL_INT(149, gr_format_message(cfg, &res, msg, sizeof(msg)));
+    TEST_ASSERT_EQUAL_STRING(
+        "  Error: GPU/CPU ratio 3.333333 is less than or more than required ratio 4.000000.\n"
+        "Try --cpus-per-gpu=4 (12 CPUs with 3 GPUs) or 2 GPUs with 8 CPUs.\n",
+        msg);
+
+    TEST_ASSERT_EQUAL_INT(149, gr_format_message(cfg, &res, small, sizeof(small)));
+    TEST_ASSERT_EQUAL_STRING("  Error: GPU/CP", small);
+
+    gr_evaluate(cfg, "es1", "gpu:1", 4000000000u, &res);
+    gr_format_message(cfg, &res, msg, sizeof(msg));
+    TEST_ASSERT_NOT_NULL(strstr(msg, "ratio 4000000000.000000 is"));
+
+    gr_evaluate(cfg, "es1", "gpu:A100:2", 1, &res);
+    gr_format_message(cfg, &res, msg, sizeof(msg));
+    TEST_ASSERT_NOT_NULL(strstr(msg, "(8 CPUs with 2 GPUs) or 1 GPU with 4 CPUs.\n"));
+
+    gr_evaluate(cfg, "es1", NULL, 4, &res);
+    gr_format_message(cfg, &res, msg, sizeof(msg));
+    TEST_ASSERT_EQUAL_STRING("Error: partition es1 requires a GPU request.\n", msg);
+
+    gr_evaluate(cfg, "es1", "gpu:A100:2", 8, &res);
+    TEST_ASSERT_EQUAL_INT(0, gr_format_message(cfg, &res, msg, sizeof(msg)));
+    TEST_ASSERT_EQUAL_STRING("", msg);
+}
+
+/* Tokenizes s and checks entry i against name, type and count. */
+static void assert_tres(const char *s, int i, const char *name,
+                        const char *type, uint64_t count) {
+    gr_tres_iter_t it;
+    gr_tres_t t;
+
+    gr_tres_init(&it, s);
+    for (int n = 0; n <= i; n++)
+        TEST_ASSERT_EQUAL_INT_MESSAGE(1, gr_tres_next(&it, &t), s);
+    TEST_ASSERT_TRUE_MESSAGE(gr_slice_eq(t.name, name), s);
+    TEST_ASSERT_TRUE_MESSAGE(gr_slice_eq(t.type, type), s);
+    TEST_ASSERT_EQUAL_UINT64_MESSAGE(count, t.count, s);
+}
+
+static int tres_entries(const char *s) {
+    gr_tres_iter_t it;
+    gr_tres_t t;
+    int n = 0, rc;
+
+    gr_tres_init(&it, s);
+    while ((rc = gr_tres_next(&it, &t)) > 0)
+        n++;
+    return rc < 0 ? -1 : n;
+}
+
+void test_tres_tokenizer(void) {
+    assert_tres("gpu", 0, "gpu", "", 1);
+    assert_tres("gpu:2", 0, "gpu", "", 2);
+    assert_tres("gpu:a100", 0, "gpu", "a100", 1);
+    assert_tres("gpu:a100:2", 0, "gpu", "a100", 2);
+    assert_tres("gpu:a100:2(S:0-1)", 0, "gpu", "a100", 2);
+    assert_tres("gres:gpu:a100:2", 0, "gpu", "a100", 2);
+    assert_tres("gres/gpu=4", 0, "gpu", "", 4);
+    assert_tres("gres/gpu:a100=2", 0, "gpu", "a100", 2);
+    assert_tres("gres/gpu:a100=2,gres/shard=4", 1, "shard", "", 0);
+    assert_tres("gres/shard=4;gres/gpu:h100=1k", 1, "gpu", "h100", 1024);
+    assert_tres("cpu=8,mem=187.50G,gres/gpu:a100=2", 2, "gpu", "a100", 2);
+    assert_tres("license/x=1(a,b),gpu:2", 1, "gpu", "", 2);
+    assert_tres("gpu:nvidia_h100_80gb_hbm3_with_a_long_name:8", 0, "gpu",
+                "nvidia_h100_80gb_hbm3_with_a_long_name", 8);
+
+    TEST_ASSERT_EQUAL_INT(0, tres_entries(NULL));
+    TEST_ASSERT_EQUAL_INT(0, tres_entries(""));
+    TEST_ASSERT_EQUAL_INT(3, tres_entries("gpu:1,,gres/shard=2;license/x=1,"));
+    TEST_ASSERT_EQUAL_INT(-1, tres_entries("gpu::2"));
+    TEST_ASSERT_EQUAL_INT(-1, tres_entries("gpu:a100:x"));
+    TEST_ASSERT_EQUAL_INT(-1, tres_entries("gres/gpu="));
+    TEST_ASSERT_EQUAL_INT(-1, tres_entries("gpu:1(S:0"));
+    TEST_ASSERT_EQUAL_INT(-1, tres_entries("gpu:1)"));
+    TEST_ASSERT_EQUAL_INT(2, tres_entries("mem=1.5G,shard:x:y"));
+}
+
+void test_modern_tres_syntax(void) {
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(cfg, "es1", "gres/gpu:a100=2", 8, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO, gr_evaluate(cfg, "es1", "gres/gpu:a100=2", 6, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(cfg, "es1", "gres/gpu:a100=2,gres/shard=4", 8, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(cfg, "es1", "gpu:a100:1(S:0),gpu:a100:1(S:1)", 8, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(cfg, "es1", "gres:gpu:h100:1", 6, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_BAD_GRES, gr_evaluate(cfg, "es1", "gres/shard=4", 8, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(cfg, "es1",
+        "billing=8,cpu=8,gres/gpu:a100=2,mem=187.50G,node=1", 8, NULL));
+}
+
+/* A job_descriptor with nothing set, as Slurm hands it to job_submit. */
+#define JOB(...) ((gr_job_t) {                                          \
+    .min_cpus = GR_NO_VAL, .min_nodes = GR_NO_VAL,                      \
+    .num_tasks = GR_NO_VAL, .cpus_per_task = GR_NO_VAL16,               \
+    .ntasks_per_node = GR_NO_VAL16, .sockets_per_node = GR_NO_VAL16,    \
+    .pn_min_cpus = GR_NO_VAL16, __VA_ARGS__ })
+
+static gr_decision_t assert_shape(gr_job_t job, const char *tres,
+                                  uint32_t cpus, uint32_t nodes) {
+    gr_shape_t shape;
+    gr_job_shape(&job, &shape);
+    if (tres)
+        TEST_ASSERT_EQUAL_STRING(tres, shape.tres);
+    else
+        TEST_ASSERT_NULL(shape.tres);
+    TEST_ASSERT_EQUAL_UINT32(cpus, shape.cpus);
+    TEST_ASSERT_EQUAL_UINT32(nodes, shape.nodes);
+    return gr_evaluate(cfg, "es1", shape.tres, shape.cpus, NULL);
+}
+
+void test_job_shape(void) {
+    /* --gres=gpu:a100:2 -c 8: passed through as is */
+    gr_job_t single = JOB(.tres_per_node = "gpu:a100:2", .min_cpus = 8);
+    gr_shape_t shape;
+    gr_job_shape(&single, &shape);
+    TEST_ASSERT_EQUAL_PTR(single.tres_per_node, shape.tres);
+
+    /* -N 2 --gres=gpu:a100:4 -n 2 -c 16 */
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, assert_shape(
+        JOB(.tres_per_node = "gpu:a100:4", .min_nodes = 2, .num_tasks = 2,
+            .cpus_per_task = 16, .min_cpus = 32), "gpu:a100:4", 16, 2));
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO, assert_shape(
+        JOB(.tres_per_node = "gpu:a100:4", .min_nodes = 2, .min_cpus = 16),
+        "gpu:a100:4", 8, 2));
+
+    /* -N 2 -n 8 -c 4 --gpus-per-task=a100:1 */
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, assert_shape(
+        JOB(.tres_per_task = "gres/gpu:a100:1", .min_nodes = 2,
+            .num_tasks = 8, .cpus_per_task = 4, .min_cpus = 8),
+        "gpu:a100:4", 16, 2));
+    /* --ntasks-per-node=2 -c 2 --gpus-per-task=1 (V100 by default) */
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, assert_shape(
+        JOB(.tres_per_task = "gres/gpu:1", .ntasks_per_node = 2,
+            .cpus_per_task = 2), "gpu:2", 4, 1));
+
+    /* -N 2 --gpus=a100:8 --cpus-per-gpu=4, min_cpus as sbatch leaves it */
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, assert_shape(
+        JOB(.tres_per_job = "gres/gpu:a100:8", .cpus_per_tres = "gres/gpu:4",
+            .min_nodes = 2, .min_cpus = 2), "gpu:a100:4", 16, 2));
+    /* --gres=gpu:a100:2 --cpus-per-gpu=3 */
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO, assert_shape(
+        JOB(.tres_per_node = "gpu:a100:2", .cpus_per_tres = "gres/gpu:3",
+            .min_cpus = 1), "gpu:a100:2", 6, 1));
+
+    /* -N 2 --gpus-per-socket=a100:1 --sockets-per-node=2 -n 16 */
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, assert_shape(
+        JOB(.tres_per_socket = "gres/gpu:a100:1", .sockets_per_node = 2,
+            .min_nodes = 2, .min_cpus = 16), "gpu:a100:2", 8, 2));
+
+    /* -N 2 --gpus=a100:3 -n 12 does not split evenly, checked as a job */
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, assert_shape(
+        JOB(.tres_per_job = "gres/gpu:a100:3", .min_nodes = 2,
+            .min_cpus = 12), "gpu:a100:3", 12, 1));
+
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_NO_GRES, assert_shape(
+        JOB(.min_nodes = 2, .min_cpus = 8), NULL, 8, 1));
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_BAD_GRES, assert_shape(
+        JOB(.tres_per_job = "gres/shard=4", .min_nodes = 2, .min_cpus = 8),
+        "gres/shard=4", 8, 1));
+}
+
+void test_adjust_mode(void) {
+    gr_result_t res;
+    gr_config_t *adjust = parse("[gresratio]\n"
+                                "partition = es1, es2\n"
+                                "mode = adjust\n"
+                                "enforce_ratio = true\n"
+                                "card.V100 = 2\n"
+                                "card.A100 = 4\n"
+                                "card.A40 = 10/3\n"
+                                "[gresratio.es2]\n"
+                                "card.A100 = 8\n");
+    TEST_ASSERT_NOT_NULL(adjust);
+    TEST_ASSERT_EQUAL_INT(GR_MODE_ADJUST, gr_config_mode(adjust));
+    TEST_ASSERT_EQUAL_INT(GR_MODE_ENFORCE, gr_config_mode(cfg));
+    TEST_ASSERT_NULL(parse("[gresratio]\nmode = fix\n"));
+
+    TEST_ASSERT_EQUAL_UINT32(8, gr_adjust_cpus(adjust, "es1", "gpu:a100:2", 5, &res));
+    TEST_ASSERT_EQUAL_UINT32(8, gr_adjust_cpus(adjust, "es1", "gpu:a100:2", 64, NULL));
+    TEST_ASSERT_EQUAL_UINT32(400, gr_adjust_cpus(adjust, "es1", "gpu:a100:100", 1, NULL));
+    TEST_ASSERT_EQUAL_UINT32(8, gr_adjust_cpus(adjust, "es1", "gpu:a100:1,gpu:v100:2", 2, NULL));
+    TEST_ASSERT_EQUAL_UINT32(10, gr_adjust_cpus(adjust, "es1", "gpu:a40:3", 9, NULL));
+
+    /* nothing to adjust, no whole CPU count, or partitions that disagree */
+    TEST_ASSERT_EQUAL_UINT32(0, gr_adjust_cpus(adjust, "es1", "gpu:a100:2", 8, &res));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, res.decision);
+    TEST_ASSERT_EQUAL_UINT32(0, gr_adjust_cpus(adjust, "es1", "gres/shard=4", 8, &res));
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_BAD_GRES, res.decision);
+    TEST_ASSERT_EQUAL_UINT32(0, gr_adjust_cpus(adjust, "es1", "gpu:a40:1", 3, NULL));
+    TEST_ASSERT_EQUAL_UINT32(0, gr_adjust_cpus(adjust, "es1,es2", "gpu:a100:1", 2, &res));
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO, res.decision);
+    TEST_ASSERT_EQUAL_UINT32(2, res.cpus);
+    gr_config_free(adjust);
+
+    /* back to job fields: -N 2 --gres=gpu:a100:4 with 8 CPUs per node */
+    gr_job_t job = JOB(.tres_per_node = "gpu:a100:4", .min_nodes = 2,
+                       .min_cpus = 16);
+    gr_shape_t shape;
+    gr_job_cpus_t fix;
+    gr_job_shape(&job, &shape);
+    TEST_ASSERT_EQUAL_INT(0, gr_job_adjust(&job, &shape, 16, &fix));
+    TEST_ASSERT_EQUAL_UINT32(32, fix.min_cpus);
+    TEST_ASSERT_EQUAL_UINT32(0, fix.cpus_per_gpu);
+
+    /* -n 4 -c 10 still asks for 40 CPUs */
+    job.num_tasks = 4;
+    job.cpus_per_task = 10;
+    TEST_ASSERT_EQUAL_INT(-1, gr_job_adjust(&job, &shape, 16, &fix));
+
+    /* --gres=gpu:a100:2 --cpus-per-gpu=3 */
+    job = JOB(.tres_per_node = "gpu:a100:2", .cpus_per_tres = "gres/gpu:3");
+    gr_job_shape(&job, &shape);
+    TEST_ASSERT_EQUAL_INT(0, gr_job_adjust(&job, &shape, 8, &fix));
+    TEST_ASSERT_EQUAL_UINT32(8, fix.min_cpus);
+    TEST_ASSERT_EQUAL_UINT32(4, fix.cpus_per_gpu);
+    TEST_ASSERT_EQUAL_INT(-1, gr_job_adjust(&job, &shape, 7, &fix));
+}
+
+void test_exemptions(void) {
+    gr_config_t *ex = parse("[gresratio]\n"
+                            "card.V100 = 2\n"
+                            "exempt_users = 1001, root, [nobody-here], 70000, 3000000000\n"
+                            "exempt_accounts = [\"CI\", ops]\n"
+                            "exempt_qos = debug\n"
+                            "exempt_reservations = Maint\n");
+    TEST_ASSERT_NULL(parse("[gresratio]\nexempt_users = 4294967294\n"));
+    TEST_ASSERT_NULL(parse("[gresratio]\nexempt_qos = a,,b\n"));
+    TEST_ASSERT_NOT_NULL(ex);
+
+    TEST_ASSERT_FALSE(gr_exempt(cfg, 0, "ci", "debug", "Maint"));
+    TEST_ASSERT_FALSE(gr_exempt(NULL, 1001, NULL, NULL, NULL));
+    TEST_ASSERT_TRUE(gr_exempt(ex, 1001, NULL, NULL, NULL));
+    TEST_ASSERT_TRUE(gr_exempt(ex, 0, NULL, NULL, NULL));
+    TEST_ASSERT_TRUE(gr_exempt(ex, 70000, NULL, NULL, NULL));
+    TEST_ASSERT_TRUE(gr_exempt(ex, 3000000000u, NULL, NULL, NULL));
+    TEST_ASSERT_FALSE(gr_exempt(ex, 1000, NULL, NULL, NULL));
+    TEST_ASSERT_FALSE(gr_exempt(ex, 70001, NULL, NULL, NULL));
+    TEST_ASSERT_FALSE(gr_exempt(ex, 2999999999u, NULL, NULL, NULL));
+    TEST_ASSERT_FALSE(gr_exempt(ex, GR_NO_VAL, NULL, NULL, NULL));
+
+    /* accounts and QOS ignore case like Slurm, reservations do not */
+    TEST_ASSERT_TRUE(gr_exempt(ex, 1000, "ci", NULL, NULL));
+    TEST_ASSERT_TRUE(gr_exempt(ex, 1000, "OPS", "normal", NULL));
+    TEST_ASSERT_TRUE(gr_exempt(ex, 1000, "physics", "Debug", NULL));
+    TEST_ASSERT_TRUE(gr_exempt(ex, 1000, NULL, NULL, "Maint"));
+    TEST_ASSERT_FALSE(gr_exempt(ex, 1000, NULL, NULL, "maint"));
+    TEST_ASSERT_FALSE(gr_exempt(ex, 1000, "c", "debugger", ""));
+
+    /* exemption is up to the plugin, evaluation itself is unchanged */
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO,
+                          gr_evaluate(ex, "es1", "gpu:v100:1", 1, NULL));
+    gr_config_free(ex);
+}
+
+static uint64_t stripe_sum(const struct gr_stats_segment *seg,
+                           const atomic_uint_fast64_t *first) {
+    size_t offset = (const char *) first - (const char *) &seg->stripes[0];
+    uint64_t n = 0;
+    for (int i = 0; i < GR_STATS_STRIPES; i++)
+        n += atomic_load((const atomic_uint_fast64_t *)
+                         ((const char *) &seg->stripes[i] + offset));
+    return n;
+}
+
+void test_stats_segment(void) {
+    char name[64], text[256];
+    gr_result_t res;
+    snprintf(name, sizeof(name), "/gresratio_test_%d", (int) getpid());
+    snprintf(text, sizeof(text), "[gresratio]\n"
+             "partition = es1, es2\n"
+             "stats_segment = %s\n"
+             "card.V100 = 2\n", name);
+    TEST_ASSERT_NULL(parse("[gresratio]\nstats_segment = gresratio\n"));
+    TEST_ASSERT_NULL(parse("[gresratio]\nstats_segment = /a/b\n"));
+    TEST_ASSERT_EQUAL_UINT64(0, gr_stats_start());
+
+    gr_config_t *first = parse(text);
+    TEST_ASSERT_NOT_NULL(first);
+    TEST_ASSERT_EQUAL_INT(0, gr_stats_attach(first));
+    int fd = shm_open(name, O_RDONLY, 0);
+    TEST_ASSERT_TRUE(fd >= 0);
+    const struct gr_stats_segment *seg = mmap(NULL, sizeof(*seg), PROT_READ,
+                                              MAP_SHARED, fd, 0);
+    close(fd);
+    TEST_ASSERT_TRUE(seg != MAP_FAILED);
+    TEST_ASSERT_EQUAL_HEX32(GR_STATS_MAGIC, seg->magic);
+    TEST_ASSERT_EQUAL_UINT64(gr_config_generation(first), seg->generation);
+    TEST_ASSERT_EQUAL_UINT32(3, seg->num_parts);
+    TEST_ASSERT_EQUAL_STRING("es2", seg->parts[2]);
+    TEST_ASSERT_EQUAL_STRING("V100", seg->cards[1]);
+
+    /* every call is counted, one in GR_STATS_SAMPLE is timed */
+    for (int i = 0; i < GR_STATS_SAMPLE; i++) {
+        uint64_t start = gr_stats_start();
+        TEST_ASSERT_NOT_EQUAL(0, start);
+        gr_evaluate(first, "es1", "gpu:v100:1", 2 + i % 2, &res);
+        gr_stats_record(first, &res, false, start);
+    }
+    gr_stats_exempt(gr_stats_start());
+    TEST_ASSERT_EQUAL_UINT64(GR_STATS_SAMPLE / 2,
+                             stripe_sum(seg, &seg->stripes[0].accepts[1][1]));
+    TEST_ASSERT_EQUAL_UINT64(GR_STATS_SAMPLE / 2,
+                             stripe_sum(seg, &seg->stripes[0].rejects[1][1]));
+    TEST_ASSERT_EQUAL_UINT64(GR_STATS_SAMPLE / 2, stripe_sum(seg,
+        &seg->stripes[0].reasons[GR_REJECT_RATIO]));
+    TEST_ASSERT_EQUAL_UINT64(1, stripe_sum(seg, &seg->stripes[0].exempt));
+    uint64_t timed = 0;
+    for (int b = 0; b < GR_STATS_BUCKETS; b++)
+        timed += stripe_sum(seg, &seg->stripes[0].latency[b]);
+    TEST_ASSERT_EQUAL_UINT64(2, timed);
+
+    /* a reload keeps the slots of known names and appends new ones */
+    snprintf(text, sizeof(text), "[gresratio]\n"
+             "partition = es3, es2\n"
+             "card.A100 = 4\n"
+             "card.V100 = 2\n");
+    gr_config_t *second = parse(text);
+    TEST_ASSERT_NOT_NULL(second);
+    TEST_ASSERT_EQUAL_INT(0, gr_stats_attach(second));
+    TEST_ASSERT_EQUAL_UINT64(gr_config_generation(second), seg->generation);
+    TEST_ASSERT_EQUAL_INT(0, atomic_load(&seg->seq) & 1);
+    TEST_ASSERT_EQUAL_STRING("es3", seg->parts[3]);
+    TEST_ASSERT_EQUAL_STRING("A100", seg->cards[2]);
+    gr_evaluate(second, "es2", "gpu:v100:1", 2, &res);
+    gr_stats_record(second, &res, false, 1);
+    TEST_ASSERT_EQUAL_UINT64(1, stripe_sum(seg, &seg->stripes[0].accepts[2][1]));
+
+    gr_stats_close();
+    TEST_ASSERT_EQUAL_UINT64(0, gr_stats_start());
+    munmap((void *) seg, sizeof(*seg));
+    shm_unlink(name);
+    gr_config_free(first);
+    gr_config_free(second);
+}
+
+void test_trace_ring(void) {
+    char path[] = "/tmp/test_trace.XXXXXX", text[256], buf[GR_TRACE_MAX_RECORD];
+    char tres[16], account[300];
+    gr_trace_rec_t rec = {
+        .call = GR_TRACE_SUBMIT,
+        .partition = "es1",
+        .account = account,
+        .job = JOB(.tres_per_node = tres, .min_nodes = 2),
+    };
+    int fd = mkstemp(path);
+    TEST_ASSERT_TRUE(fd >= 0);
+    close(fd);
+    snprintf(text, sizeof(text), "[gresratio]\n"
+             "trace_file = %s\n"
+             "trace_size = 64K\n"
+             "trace_salt = test\n"
+             "card.V100 = 2\n", path);
+    TEST_ASSERT_NULL(parse("[gresratio]\ntrace_size = 4K\n"));
+    TEST_ASSERT_NULL(parse("[gresratio]\ntrace_size = 64X\n"));
+    TEST_ASSERT_FALSE(gr_trace_active());
+
+    gr_config_t *tracing = parse(text);
+    TEST_ASSERT_NOT_NULL(tracing);
+    TEST_ASSERT_EQUAL_INT(0, gr_trace_attach(tracing));
+    TEST_ASSERT_TRUE(gr_trace_active());
+
+    /* a 64K ring holds about 1300 of these, so it wraps over 20 times */
+    memset(account, 'a', sizeof(account) - 1);
+    account[sizeof(account) - 1] = '\0';
+    for (uint32_t i = 0; i < 30000; i++) {
+        snprintf(tres, sizeof(tres), "gpu:a100:%u", i % 8 + 1);
+        rec.job.min_cpus = i;
+        rec.decision = i % 3 ? GR_ACCEPT : GR_REJECT_RATIO;
+        account[i % 200 + 50] = '\0';
+        gr_trace_record(i % 5, &rec);
+        account[i % 200 + 50] = 'a';
+    }
+    gr_trace_close();
+    TEST_ASSERT_FALSE(gr_trace_active());
+
+    gr_trace_t *trace = gr_trace_map(path);
+    TEST_ASSERT_NOT_NULL(trace);
+    uint64_t pos, end, count = 0, wrapped = 0;
+    uint32_t last = 0, users[5];
+    gr_trace_window(trace, &pos, &end);
+    TEST_ASSERT_TRUE(pos > 0);
+    while (gr_trace_next(trace, &pos, end, &rec, buf)) {
+        uint32_t i = rec.job.min_cpus;
+        TEST_ASSERT_TRUE(count == 0 || i == last + 1);
+        snprintf(tres, sizeof(tres), "gpu:a100:%u", i % 8 + 1);
+        TEST_ASSERT_EQUAL_STRING(tres, rec.job.tres_per_node);
+        TEST_ASSERT_EQUAL_STRING("es1", rec.partition);
+        TEST_ASSERT_EQUAL_size_t(i % 200 + 50, strlen(rec.account));
+        TEST_ASSERT_NULL(rec.job.tres_per_job);
+        TEST_ASSERT_EQUAL_UINT32(2, rec.job.min_nodes);
+        TEST_ASSERT_EQUAL_UINT32(GR_NO_VAL, rec.job.num_tasks);
+        TEST_ASSERT_EQUAL_UINT16(GR_NO_VAL16, rec.job.cpus_per_task);
+        TEST_ASSERT_EQUAL_INT(i % 3 ? GR_ACCEPT : GR_REJECT_RATIO,
+                              rec.decision);
+        TEST_ASSERT_EQUAL_INT(GR_TRACE_SUBMIT, rec.call);
+        /* the same uid always hashes the same, different ones do not */
+        if (count >= 5)
+            TEST_ASSERT_EQUAL_UINT32(users[i % 5], rec.user);
+        users[i % 5] = rec.user;
+        wrapped += rec.account < buf + sizeof(buf) && rec.account >= buf;
+        last = i;
+        count++;
+    }
+    TEST_ASSERT_EQUAL_UINT32(29999, last);
+    TEST_ASSERT_TRUE(count > 200 && count < 1400);
+    TEST_ASSERT_TRUE(wrapped <= 1);
+    TEST_ASSERT_NOT_EQUAL(users[0], users[1]);
+
+    /* shards starting at any granule find the same records */
+    uint64_t first, shard_count = 0;
+    gr_trace_window(trace, &first, &end);
+    for (uint64_t start = first; start < end; start += 777) {
+        uint64_t stop = start + 777 < end ? start + 777 : end;
+        for (pos = start; pos < stop && gr_trace_next(trace, &pos, stop, &rec, buf);)
+            shard_count++;
+    }
+    TEST_ASSERT_EQUAL_UINT64(count, shard_count);
+
+    /* a record is found again from the granule it starts at */
+    gr_trace_window(trace, &pos, &end);
+    TEST_ASSERT_EQUAL_INT(1, gr_trace_next(trace, &pos, end, &rec, buf));
+    TEST_ASSERT_EQUAL_INT(1, gr_trace_next(trace, &pos, end, &rec, buf));
+    uint64_t at = rec.granule;
+    last = rec.job.min_cpus;
+    TEST_ASSERT_EQUAL_INT(1, gr_trace_next(trace, &at, rec.granule + 1, &rec,
+                                           buf));
+    TEST_ASSERT_EQUAL_UINT32(last, rec.job.min_cpus);
+    TEST_ASSERT_EQUAL_UINT64(pos, at);
+    gr_trace_unmap(trace);
+
+    /* reopening the same ring continues it */
+    TEST_ASSERT_EQUAL_INT(0, gr_trace_attach(tracing));
+    rec.job.min_cpus = 30000;
+    gr_trace_record(0, &rec);
+    gr_trace_close();
+    trace = gr_trace_map(path);
+    gr_trace_window(trace, &pos, &end);
+    while (gr_trace_next(trace, &pos, end, &rec, buf))
+        last = rec.job.min_cpus;
+    TEST_ASSERT_EQUAL_UINT32(30000, last);
+    gr_trace_unmap(trace);
+    gr_config_free(tracing);
+    unlink(path);
+}
+
+void test_mixed_cards(void) {
+    gr_result_t res;
+    char msg[256];
+
+    /* enforce_ratio is on unless set false */
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT,
+        gr_evaluate(cfg, "es1", "gpu:a100:1,gpu:h100:1", 10, NULL));
+
+    gr_config_t *mixed = parse(
+        "[gresratio]\n"
+        "partition = es1, es2\n"
+        "card.V100 = 2\n"
+        "card.A100 = 4\n"
+        "card.A40 = 2.5\n"
+        "card.L40 = 10/3\n"
+        "[gresratio.es2]\n"
+        "enforce_ratio = false\n");
+    TEST_ASSERT_NOT_NULL(mixed);
+
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(mixed, "es1", "gpu:a100:1,gpu:v100:2", 8, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(mixed, "es1", "gres/gpu:a100=2,gres/gpu=1", 10, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(mixed, "es1", "gpu:a40:1,gpu:l40:3,gpu:a40:1", 15, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO, gr_evaluate(mixed, "es1", "gpu:a40:1,gpu:l40:3", 12, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(mixed, "es1", "gpu:a100:1,gpu:unknown:4", 4, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_BAD_GRES, gr_evaluate(mixed, "es2", "gpu:a100:1,gpu:v100:2", 8, &res));
+    gr_format_message(mixed, &res, msg, sizeof(msg));
+    TEST_ASSERT_EQUAL_STRING("Error: the job mixes GPU types, partition es2 only"
+                             " accepts one type per job.\n", msg);
+
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO, gr_evaluate(mixed, "es1", "gpu:a100:1,gpu:v100:1", 4, &res));
+    TEST_ASSERT_TRUE(res.mixed);
+    TEST_ASSERT_EQUAL_UINT32(2, res.gpus);
+    TEST_ASSERT_EQUAL_UINT32(3, res.ratio.num);
+    TEST_ASSERT_EQUAL_UINT32(1, res.ratio.den);
+    gr_format_message(mixed, &res, msg, sizeof(msg));
+    TEST_ASSERT_EQUAL_STRING(
+        "  Error: GPU/CPU ratio 2.000000 is less than or more than the weighted"
+        " ratio of the requested cards 3.000000.\n", msg);
+    gr_config_free(mixed);
+}
+
+/* Appends each host and a space to the string buffer arg. */
+static int collect_host(const char *host, size_t len, void *arg) {
+    strncat(arg, host, len);
+    strcat(arg, " ");
+    return 0;
+}
+
+static const char *expand(const char *list) {
+    static char hosts[512];
+    hosts[0] = '\0';
+    if (gr_hostlist_expand((gr_slice_t) { list, strlen(list) }, collect_host,
+                           hosts))
+        return NULL;
+    return hosts;
+}
+
+void test_hostlist(void) {
+    TEST_ASSERT_EQUAL_STRING("n1 ", expand("n1"));
+    TEST_ASSERT_EQUAL_STRING("n0009.es1 n0010.es1 n0012.es1 ",
+                             expand("n[0009-0010,0012].es1"));
+    TEST_ASSERT_EQUAL_STRING("a b1 b2 ", expand("a,b[1-2]"));
+    TEST_ASSERT_EQUAL_STRING("r1n01 r1n02 r2n01 r2n02 ", expand("r[1-2]n[01-02]"));
+    TEST_ASSERT_EQUAL_STRING("n98 n99 n100 ", expand("n[98-100]"));
+    TEST_ASSERT_NULL(expand("n[1-"));
+    TEST_ASSERT_NULL(expand("n[2-1]"));
+    TEST_ASSERT_NULL(expand("n[a-b]"));
+    TEST_ASSERT_NULL(expand("n]1["));
+}
+
+static int count_host(const char *host, size_t len, void *arg) {
+    (void) host, (void) len;
+    ++*(uint64_t *) arg;
+    return 0;
+}
+
+/* Huge ranges are refused up front, nested ones once past the cap. */
+void test_hostlist_cap(void) {
+    const char *huge = "n[0-4294967295]", *nested = "r[1-2000]n[1-2000]";
+    const char *exact = "n[1-1048576]";
+    uint64_t hosts = 0;
+
+    TEST_ASSERT_EQUAL_INT(-1, gr_hostlist_expand(
+        (gr_slice_t) { huge, strlen(huge) }, count_host, &hosts));
+    TEST_ASSERT_EQUAL_UINT64(0, hosts);
+    TEST_ASSERT_EQUAL_INT(-1, gr_hostlist_expand(
+        (gr_slice_t) { nested, strlen(nested) }, count_host, &hosts));
+    TEST_ASSERT_TRUE(hosts > 0 && hosts <= GR_MAX_HOSTLIST);
+    hosts = 0;
+    TEST_ASSERT_EQUAL_INT(0, gr_hostlist_expand(
+        (gr_slice_t) { exact, strlen(exact) }, count_host, &hosts));
+    TEST_ASSERT_EQUAL_UINT64(GR_MAX_HOSTLIST, hosts);
+    TEST_ASSERT_NULL(parse("[gresratio]\npartition = es1\ncard.V100 = 2\n"
+                           "node_inventory = inventory/huge_range.conf\n"));
+}
+
+static gr_config_t *parse_inventory(const char *file, const char *mode) {
+    char text[512];
+    snprintf(text, sizeof(text),
+             "[gresratio]\n"
+             "partition = es1, es2, lr6\n"
+             "node_inventory = inventory/%s\n"
+             "untyped_gpu = %s\n"
+             "card.GTX2080TI = 2\n"
+             "card.V100 = 2\n"
+             "card.A40 = 4\n"
+             "card.A100 = 5\n"
+             "card.H100 = 6\n", file, mode);
+    return parse(text);
+}
+
+void test_untyped_gpu_from_slurm_conf(void) {
+    gr_config_t *strict = parse_inventory("slurm.conf", "strictest");
+    gr_config_t *lenient = parse_inventory("slurm.conf", "lenient");
+    gr_config_t *def = parse_inventory("slurm.conf", "default");
+    TEST_ASSERT_NOT_NULL(strict);
+    TEST_ASSERT_NOT_NULL(lenient);
+    TEST_ASSERT_NOT_NULL(def);
+
+    /* es1 has 2080TI, V100, H100 and A40 nodes */
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(strict, "es1", "gpu:2", 12, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO, gr_evaluate(strict, "es1", "gpu:2", 4, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(lenient, "es1", "gpu:2", 4, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(def, "es1", "gpu:2", 4, NULL));
+
+    /* es2 only has A40 nodes, lr6 has no GPUs at all */
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(lenient, "es2", "gpu:2", 8, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(strict, "lr6", "gpu:1", 2, NULL));
+
+    /* typed requests are unaffected */
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(strict, "es1", "gpu:v100:2", 4, NULL));
+
+    gr_config_free(strict);
+    gr_config_free(lenient);
+    gr_config_free(def);
+}
+
+void test_untyped_gpu_from_scontrol_dump(void) {
+    gr_config_t *strict = parse_inventory("nodes.txt", "strictest");
+    gr_config_t *lenient = parse_inventory("nodes.txt", "lenient");
+    TEST_ASSERT_NOT_NULL(strict);
+    TEST_ASSERT_NOT_NULL(lenient);
+
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(strict, "es1", "gpu:2", 10, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(lenient, "es1", "gpu:2", 8, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(lenient, "es2", "gpu:1", 6, NULL));
+
+    gr_config_free(strict);
+    gr_config_free(lenient);
+    TEST_ASSERT_NULL(parse_inventory("missing.conf", "strictest"));
+    TEST_ASSERT_NULL(parse_inventory("slurm.conf", "strict"));
+}
+
+void test_ratios_derived_from_nodes(void) {
+    gr_config_t *derived = parse("[gresratio]\n"
+                                 "partition = es1\n"
+                                 "node_inventory = inventory/slurm.conf\n"
+                                 "derive_ratios = true\n"
+                                 "card.A40 = 3\n");
+    TEST_ASSERT_NOT_NULL(derived);
+
+    /* 16 CPUs and 4 cards, 2 sockets of 8 cores and the DEFAULT V100:2 */
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(derived, "es1", "gpu:gtx2080ti:1", 4, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(derived, "es1", "gpu:v100:2", 16, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO, gr_evaluate(derived, "es1", "gpu:v100:2", 4, NULL));
+    /* DEFAULT CPUs=32 over 8 cards, card.* wins over the nodes */
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(derived, "es1", "gpu:h100:2", 8, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(derived, "es1", "gpu:a40:2", 6, NULL));
+    gr_config_free(derived);
+
+    TEST_ASSERT_NULL(parse("[gresratio]\nderive_ratios = true\n"));
+}
+
+void test_missing_or_invalid_gres(void) {
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_NO_GRES, gr_evaluate(cfg, "es1", NULL, 4, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_BAD_GRES, gr_evaluate(cfg, "es1", "gpu:0", 4, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_BAD_GRES, gr_evaluate(cfg, "es1", "gpu::2", 4, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(cfg, "es1", "gpu:unknown:2", 3, NULL));
+}
+
+void test_other_partitions_are_not_checked(void) {
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(cfg, "cpu", "gpu:A100:2", 1, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(cfg, NULL, "gpu:A100:2", 1, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO, gr_evaluate(cfg, "cpu,es1", "gpu:A100:2", 1, NULL));
+}
+
+void test_partition_sections(void) {
+    gr_config_t *multi = parse(
+        "[gresratio]\n"
+        "default_card = V100\n"
+        "partition = \"es1, es2\"\n"
+        "card.V100 = 2.0\n"
+        "card.A100 = 4.0\n"
+        "[gresratio.es3]\n"
+        "default_card = A40\n"
+        "card.A40 = 8\n"
+        "card.A100 = 6.0\n");
+    TEST_ASSERT_NOT_NULL(multi);
+    TEST_ASSERT_EQUAL_INT(3, gr_config_num_partitions(multi));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(multi, "es2", "gpu:2", 4, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(multi, "es3", "gpu:2", 16, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(multi, "es3", "gpu:A100:1", 6, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO, gr_evaluate(multi, "es1", "gpu:A100:1", 6, NULL));
+    gr_config_free(multi);
+}
+
+void test_comments_and_sections_are_honored(void) {
+    gr_config_t *off = parse(
+        "enable_gres_ratio_plugin = false # true\n"
+        "[gresratio]\ncard.V100 = 2\n");
+    TEST_ASSERT_NOT_NULL(off);
+    TEST_ASSERT_FALSE(gr_config_enabled(off));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(off, "es1", "gpu:V100:1", 1, NULL));
+    gr_config_free(off);
+}
+
+/* Sections of other tools may use TOML the lexer does not handle. */
+void test_foreign_sections_are_skipped(void) {
+    gr_config_t *shared = parse(
+        "[tool]\n"
+        "hosts = [\n"
+        "  \"a\", # first\n"
+        "  [1, 2],\n"
+        "]\n"
+        "owner = { name = \"x\",\n"
+        "          uid = 1 }\n"
+        "[[tool.jobs]]\n"
+        "name = \"nightly\"\n"
+        "[gresratio]\n"
+        "partition = es1\n"
+        "card.V100 = 2\n");
+    TEST_ASSERT_NOT_NULL(shared);
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(shared, "es1", "gpu:V100:1", 2, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO, gr_evaluate(shared, "es1", "gpu:V100:1", 1, NULL));
+    gr_config_free(shared);
+
+    /* ours are still checked */
+    TEST_ASSERT_NULL(parse("[gresratio]\ncard.V100 = [\n  2,\n]\n"));
+    TEST_ASSERT_NULL(parse("[tool]\nx = 1\n[gresratio.es1]\ncard.V100 = [\n]\n"));
+}
+
+void test_invalid_configs_are_refused(void) {
+    TEST_ASSERT_NULL(parse("[gresratio]\ncard.V100 = 0\n"));
+    TEST_ASSERT_NULL(parse("[gresratio]\ncard.V100 = two\n"));
+    TEST_ASSERT_NULL(parse("[gresratio]\ncard.V100 = 2/0\n"));
+    TEST_ASSERT_NULL(parse("[gresratio]\ncard.V100 = 2e3\n"));
+    TEST_ASSERT_NULL(parse("[gresratio]\ncard.V100 = -2\n"));
+    TEST_ASSERT_NULL(parse("[gresratio]\ncard.V100 = 99999999999\n"));
+    TEST_ASSERT_NULL(parse("[gresratio]\ndefault_card = A100\ncard.V100 = 2\n"));
+    TEST_ASSERT_NULL(parse("[gresratio\ncard.V100 = 2\n"));
+    TEST_ASSERT_NULL(parse("[gresratio]\nenable_gres_ratio_plugin = maybe\n"));
+}
+
+void test_ratios_are_exact(void) {
+    gr_config_t *frac = parse(
+        "[gresratio]\n"
+        "default_card = A40\n"
+        "card.A40 = 3.33\n"
+        "card.L40 = 10/3\n"
+        "card.H100 = 4\n");
+    TEST_ASSERT_NOT_NULL(frac);
+
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(frac, "es1", "gpu:100", 333, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO, gr_evaluate(frac, "es1", "gpu:1", 3, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO, gr_evaluate(frac, "es1", "gpu:100", 334, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(frac, "es1", "gpu:L40:3", 10, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(frac, "es1", "gpu:L40:300", 1000, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO, gr_evaluate(frac, "es1", "gpu:L40:1", 3, NULL));
+
+    /* Beyond float precision: 20000001 / 5000000 is not 4. */
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT, gr_evaluate(frac, "es1", "gpu:H100:5000000", 20000000, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO, gr_evaluate(frac, "es1", "gpu:H100:5000000", 20000001, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO, gr_evaluate(frac, "es1", "gpu:H100:1", 0, NULL));
+
+    gr_result_t res;
+    gr_evaluate(frac, "es1", "gpu:L40:1", 3, &res);
+    TEST_ASSERT_EQUAL_UINT32(10, res.ratio.num);
+    TEST_ASSERT_EQUAL_UINT32(3, res.ratio.den);
+
+    /* no whole CPU count for 1 GPU, so only the nearest request is offered */
+    char msg[256];
+    gr_format_message(frac, &res, msg, sizeof(msg));
+    TEST_ASSERT_NOT_NULL(strstr(msg, "3.333333.\nTry 3 GPUs with 10 CPUs.\n"));
+    gr_config_free(frac);
+}
+
+void test_cache_matches_evaluate(void) {
+    gr_cache_stats_t before, after;
+    gr_result_t res;
+    char msg[256], expect[256];
+
+    gr_cache_stats(&before);
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO,
+        gr_evaluate_cached(cfg, "es1", "gpu:A100:2", 6, &res, msg, sizeof(msg)));
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO,
+        gr_evaluate_cached(cfg, "es1", "gpu:A100:2", 6, &res, msg, sizeof(msg)));
+    gr_cache_stats(&after);
+    TEST_ASSERT_EQUAL_UINT64(before.hits + 1, after.hits);
+    TEST_ASSERT_EQUAL_UINT64(before.misses + 1, after.misses);
+
+    gr_format_message(cfg, &res, expect, sizeof(expect));
+    TEST_ASSERT_EQUAL_STRING(expect, msg);
+    TEST_ASSERT_EQUAL_UINT32(2, res.gpus);
+
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT,
+        gr_evaluate_cached(cfg, "es1", "gpu:A100:2", 8, NULL, msg, sizeof(msg)));
+    TEST_ASSERT_EQUAL_STRING("", msg);
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_NO_GRES,
+        gr_evaluate_cached(cfg, "es1", NULL, 8, NULL, NULL, 0));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT,
+        gr_evaluate_cached(cfg, NULL, NULL, 8, NULL, NULL, 0));
+}
+
+void test_cache_follows_config_generation(void) {
+    gr_config_t *strict = parse("[gresratio]\ncard.V100 = 3\ncard.A100 = 3\n");
+    TEST_ASSERT_NOT_NULL(strict);
+    TEST_ASSERT_NOT_EQUAL(gr_config_generation(cfg), gr_config_generation(strict));
+
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT,
+        gr_evaluate_cached(cfg, "es1", "gpu:A100:1", 4, NULL, NULL, 0));
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO,
+        gr_evaluate_cached(strict, "es1", "gpu:A100:1", 4, NULL, NULL, 0));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT,
+        gr_evaluate_cached(cfg, "es1", "gpu:A100:1", 4, NULL, NULL, 0));
+
+    /* Both stay cached, as ratio-replay evaluates configs side by side. */
+    gr_cache_stats_t before, after;
+    gr_cache_stats(&before);
+    TEST_ASSERT_EQUAL_INT(GR_REJECT_RATIO,
+        gr_evaluate_cached(strict, "es1", "gpu:A100:1", 4, NULL, NULL, 0));
+    TEST_ASSERT_EQUAL_INT(GR_ACCEPT,
+        gr_evaluate_cached(cfg, "es1", "gpu:A100:1", 4, NULL, NULL, 0));
+    gr_cache_stats(&after);
+    TEST_ASSERT_EQUAL_UINT64(before.hits + 2, after.hits);
+    gr_config_free(strict);
+}
+
+/* Every kernel the CPU has agrees with gr_evaluate() and gr_adjust_cpus(). */
+void test_batch_matches_evaluate(void) {
+    gr_config_t *frac = parse("[gresratio]\ndefault_card = V100\n"
+                              "partition = es1\ncard.V100 = 2\n"
+                              "card.A100 = 2.5\ncard.H100 = 6\n"
+                              "card.L40 = 0.75\n");
+    const char *names[] = { "V100", "A100", "H100", "L40" };
+    enum { N = 1003 };
+    static uint32_t ncpu[N], ngpu[N];
+    static int32_t card[N], delta[N];
+    uint64_t accept[(N + 63) / 64];
+    int policy = gr_partition_id(frac, "es1");
+    gr_batch_isa_t best = gr_batch_isa();
+
+    TEST_ASSERT_NOT_NULL(frac);
+    TEST_ASSERT_EQUAL_INT(0, policy);
+    TEST_ASSERT_EQUAL_INT(-1, gr_partition_id(frac, "lr6"));
+    TEST_ASSERT_EQUAL_INT(GR_CARD_UNTYPED, gr_card_id(frac, NULL));
+    TEST_ASSERT_EQUAL_INT(GR_CARD_UNKNOWN, gr_card_id(frac, "P100"));
+    for (int i = 0; i < N; i++) {
+        ngpu[i] = i % 23; // 0 and past the accept table too
+        ncpu[i] = i * 7 % 70;
+        card[i] = i % 6 - 2;
+        if (card[i] >= 0)
+            card[i] = gr_card_id(frac, names[card[i]]);
+    }
+    card[5] = gr_card_id(frac, "A100");
+    ngpu[5] = 4;
+    ncpu[5] = 10; // matching 2.5 exactly
+    ncpu[6] = 3000000000u;
+
+    for (int isa = GR_BATCH_SCALAR; isa <= GR_BATCH_AVX512; isa++) {
+        if (gr_batch_use(isa) != 0)
+            continue;
+        size_t accepted = gr_evaluate_batch(frac, policy, N, ncpu, ngpu,
+                                            card, accept, delta);
+        size_t expect_accepted = 0;
+        for (int i = 0; i < N; i++) {
+            char tres[64];
+            if (card[i] == GR_CARD_UNTYPED)
+                snprintf(tres, sizeof(tres), "gpu:%u", ngpu[i]);
+            else if (card[i] == GR_CARD_UNKNOWN)
+                snprintf(tres, sizeof(tres), "gpu:P100:%u", ngpu[i]);
+            else
+                snprintf(tres, sizeof(tres), "gpu:%s:%u",
+                         gr_card_name(frac, card[i]), ngpu[i]);
+            bool ok = gr_evaluate(frac, "es1", tres, ncpu[i], NULL) == GR_ACCEPT;
+            uint32_t cpus = gr_adjust_cpus(frac, "es1", tres, ncpu[i], NULL);
+            expect_accepted += ok;
+            TEST_ASSERT_EQUAL_MESSAGE(ok, accept[i / 64] >> (i % 64) & 1,
+                                      gr_batch_isa_name(isa));
+            TEST_ASSERT_EQUAL_INT32_MESSAGE(cpus ? (int32_t) (cpus - ncpu[i]) : 0,
+                                            delta[i], gr_batch_isa_name(isa));
+        }
+        TEST_ASSERT_EQUAL_size_t(expect_accepted, accepted);
+        TEST_ASSERT_EQUAL_UINT64(0, accept[N / 64] >> (N % 64));
+    }
+    TEST_ASSERT_TRUE(accept[0] >> 5 & 1);
+
+    /* partitions without a policy accept everything */
+    TEST_ASSERT_EQUAL_size_t(N, gr_evaluate_batch(frac, -1, N, ncpu, ngpu,
+                                                  card, accept, NULL));
+    TEST_ASSERT_EQUAL_INT(0, gr_batch_use(best));
+    gr_config_free(frac);
+}
+
+/* Rows come back grouped by partition, shaped, and check as gr_evaluate(). */
+void test_columns_round_trip(void) {
+    char path[] = "/tmp/test_columns.XXXXXX";
+    const gr_columns_row_t rows[] = {
+        { 7, "alice", "physics", "es2", JOB(.tres_per_node = "gpu:V100:2",
+                                            .min_cpus = 4) },
+        { 8, "bob", NULL, "es1",
+          JOB(.tres_per_job = "cpu=16,gres/gpu:a100=4,node=2",
+              .min_cpus = 16, .min_nodes = 2) },
+        { 9, "alice", "physics", "es2", JOB(.tres_per_node = "gpu:3",
+                                            .min_cpus = 6) },
+        { 10, NULL, "chem", "es1",
+          JOB(.tres_per_node = "gpu:V100:1,gpu:A100:1", .min_cpus = 6) },
+        { 11, "bob", "chem", NULL, JOB(.min_cpus = 2) },
+        { 12, "carol", "chem", "es1", JOB(.tres_per_node = "gpu:V100:1",
+                                          .min_cpus = 3) },
+    };
+    enum { N = sizeof(rows) / sizeof(rows[0]) };
+    /* file order: es2 first, then es1, then no partition */
+    const int order[N] = { 0, 2, 1, 3, 5, 4 };
+    gr_config_t *cfg = parse("[gresratio]\ndefault_card = V100\n"
+                             "partition = es1, es2\ncard.V100 = 2\n"
+                             "card.A100 = 4\n");
+    int fd = mkstemp(path);
+
+    TEST_ASSERT_NOT_NULL(cfg);
+    TEST_ASSERT_TRUE(fd >= 0);
+    close(fd);
+    gr_columns_writer_t *w = gr_columns_writer();
+    for (int i = 0; i < N; i++)
+        TEST_ASSERT_EQUAL_INT(0, gr_columns_add(w, &rows[i]));
+    TEST_ASSERT_EQUAL_INT(0, gr_columns_write(w, path));
+    gr_columns_writer_free(w);
+
+    TEST_ASSERT_TRUE(gr_columns_probe(path));
+    TEST_ASSERT_FALSE(gr_columns_probe("../src/job_submit_ratio_config.toml"));
+    gr_columns_t *cols = gr_columns_map(path);
+    TEST_ASSERT_NOT_NULL(cols);
+    TEST_ASSERT_EQUAL_UINT64(N, cols->rows);
+    TEST_ASSERT_EQUAL_UINT32(3, gr_columns_dict_size(cols, GR_DICT_PARTITION));
+    TEST_ASSERT_EQUAL_UINT64(0, cols->groups[0]);
+    TEST_ASSERT_EQUAL_UINT64(2, cols->groups[1]);
+    TEST_ASSERT_EQUAL_UINT64(5, cols->groups[2]);
+    TEST_ASSERT_EQUAL_UINT64(N, cols->groups[3]);
+    TEST_ASSERT_EQUAL_INT(0, (uintptr_t) cols->cpus % GR_COLS_ALIGN);
+    TEST_ASSERT_EQUAL_INT(0, (uintptr_t) cols->gpus % GR_COLS_ALIGN);
+
+    for (int i = 0; i < N; i++) {
+        const gr_columns_row_t *in = &rows[order[i]];
+        const char *part = gr_columns_string(cols, GR_DICT_PARTITION,
+                                             cols->partition[i]);
+        const char *tres = gr_columns_string(cols, GR_DICT_TRES,
+                                             cols->tres[i]);
+        gr_shape_t shape;
+
+        gr_job_shape(&in->job, &shape);
+        TEST_ASSERT_EQUAL_UINT64(in->jobid, cols->jobid[i]);
+        if (in->user)
+            TEST_ASSERT_EQUAL_STRING(in->user, gr_columns_string(
+                cols, GR_DICT_USER, cols->user[i]));
+        else
+            TEST_ASSERT_NULL(gr_columns_string(cols, GR_DICT_USER,
+                                               cols->user[i]));
+        if (in->partition)
+            TEST_ASSERT_EQUAL_STRING(in->partition, part);
+        else
+            TEST_ASSERT_NULL(part);
+        if (shape.tres)
+            TEST_ASSERT_EQUAL_STRING(shape.tres, tres);
+        else
+            TEST_ASSERT_NULL(tres);
+        TEST_ASSERT_EQUAL_UINT32(shape.cpus, cols->cpus[i]);
+
+        /* single card rows check in bulk as their TRES does one by one */
+        if (cols->card[i] == GR_COLS_NO_CARD)
+            continue;
+        const char *card = gr_columns_string(cols, GR_DICT_CARD,
+                                             cols->card[i]);
+        int32_t card_id = gr_card_id(cfg, card);
+        uint64_t accept;
+        gr_evaluate_batch(cfg, gr_partition_id(cfg, part), 1, &cols->cpus[i],
+                          &cols->gpus[i], &card_id, &accept, NULL);
+        TEST_ASSERT_EQUAL(gr_evaluate(cfg, part, tres, cols->cpus[i], NULL) ==
+                              GR_ACCEPT, accept & 1);
+    }
+    /* per node: 2 A100 and 8 CPUs, 3 untyped, mixed and none by TRES */
+    TEST_ASSERT_EQUAL_UINT32(2, cols->gpus[2]);
+    TEST_ASSERT_EQUAL_UINT32(8, cols->cpus[2]);
+    TEST_ASSERT_EQUAL_STRING("a100", gr_columns_string(cols, GR_DICT_CARD,
+                                                       cols->card[2]));
+    TEST_ASSERT_EQUAL_UINT32(3, cols->gpus[1]);
+    TEST_ASSERT_NULL(gr_columns_string(cols, GR_DICT_CARD, cols->card[1]));
+    TEST_ASSERT_EQUAL_UINT16(GR_COLS_NO_CARD, cols->card[3]);
+    TEST_ASSERT_EQUAL_UINT16(GR_COLS_NO_CARD, cols->card[5]);
+    off_t users = cols->hdr->columns[GR_COL_USER].offset;
+    gr_columns_unmap(cols);
+
+    /* a code outside its dictionary, which tools index by, is refused */
+    uint32_t bad = UINT32_MAX;
+    fd = open(path, O_WRONLY);
+    TEST_ASSERT_TRUE(fd >= 0);
+    TEST_ASSERT_EQUAL_INT(sizeof(bad), pwrite(fd, &bad, sizeof(bad),
+                                              users + 4));
+    close(fd);
+    TEST_ASSERT_NULL(gr_columns_map(path));
+
+    /* a cut off file is refused rather than read past its end */
+    TEST_ASSERT_EQUAL_INT(0, truncate(path, 600));
+    TEST_ASSERT_NULL(gr_columns_map(path));
+    unlink(path);
+    gr_config_free(cfg);
+}
+
+int main(void) {
+    UNITY_BEGIN();
+    RUN_TEST(test_sample_config);
+    RUN_TEST(test_matching_ratio_is_accepted);
+    RUN_TEST(test_wrong_ratio_is_rejected);
+    RUN_TEST(test_reject_messages);
+    RUN_TEST(test_tres_tokenizer);
+    RUN_TEST(test_modern_tres_syntax);
+    RUN_TEST(test_job_shape);
+    RUN_TEST(test_adjust_mode);
+    RUN_TEST(test_exemptions);
+    RUN_TEST(test_stats_segment);
+    RUN_TEST(test_trace_ring);
+    RUN_TEST(test_mixed_cards);
+    RUN_TEST(test_hostlist);
+    RUN_TEST(test_hostlist_cap);
+    RUN_TEST(test_untyped_gpu_from_slurm_conf);
+    RUN_TEST(test_untyped_gpu_from_scontrol_dump);
+    RUN_TEST(test_ratios_derived_from_nodes);
+    RUN_TEST(test_missing_or_invalid_gres);
+    RUN_TEST(test_other_partitions_are_not_checked);
+    RUN_TEST(test_partition_sections);
+    RUN_TEST(test_comments_and_sections_are_honored);
+    RUN_TEST(test_foreign_sections_are_skipped);
+    RUN_TEST(test_invalid_configs_are_refused);
+    RUN_TEST(test_ratios_are_exact);
+    RUN_TEST(test_cache_matches_evaluate);
+    RUN_TEST(test_cache_follows_config_generation);
+    RUN_TEST(test_batch_matches_evaluate);
+    RUN_TEST(test_columns_round_trip);
+    return UNITY_END();
+}